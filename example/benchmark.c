@@ -0,0 +1,143 @@
+/*
+ * Benchmark of the large compact table
+ *
+ * Searches random text for many random 4 to 7 byte patterns, so that most
+ * positions go through the large compact table. Build it once with
+ * DFC_CUCKOO_LARGE_CT set and once without to compare the cuckoo and the
+ * chained layout.
+ *
+ * Usage: benchmark [pattern count] [input size in MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfc.h"
+#include "timer.h"
+
+#define DEFAULT_PATTERN_COUNT 10000
+#define DEFAULT_INPUT_MB 64
+
+// every this many bytes a random pattern is copied into the input
+#define PATTERN_DISTANCE 64
+
+static char *benchmarkInput;
+static int benchmarkInputLength;
+static int benchmarkReadOffset;
+
+static int matchCount;
+
+static void randomLetters(uint8_t *buffer, int count) {
+  for (int i = 0; i < count; ++i) {
+    buffer[i] = 'a' + rand() % 26;
+  }
+}
+
+static int readInput(int maxLength, int maxPatternLength, char *input) {
+  (void)(maxPatternLength);  // matches across two reads are not of interest
+
+  int count = benchmarkInputLength - benchmarkReadOffset;
+  count = count < maxLength ? count : maxLength;
+
+  memcpy(input, benchmarkInput + benchmarkReadOffset, count);
+  benchmarkReadOffset += count;
+
+  return count;
+}
+
+static void onMatch(DFC_FIXED_PATTERN *pattern) {
+  (void)(pattern);
+  ++matchCount;
+}
+
+static void printLargeCompactTable(DFC_STRUCTURE *dfc) {
+  if (CUCKOO_LARGE_CT) {
+    int slotCount = 1 << dfc->sizes.ctLargeBits;
+    int usedCount = 0;
+    for (int i = 0; i < slotCount; ++i) {
+      usedCount += dfc->ctLargeEntries[i].pidCount > 0;
+    }
+
+    printf("Large CT: cuckoo, %d of %d slots used, at most 2 probes\n",
+           usedCount, slotCount);
+    return;
+  }
+
+  int bucketCount = 1 << dfc->sizes.ctLargeBits;
+  int entryCount = 0;
+  int longestBucket = 0;
+  long compareCount = 0;
+  for (int i = 0; i < bucketCount; ++i) {
+    int length = dfc->ctLargeBuckets[i].entryCount;
+
+    entryCount += length;
+    longestBucket = length > longestBucket ? length : longestBucket;
+    // finding the k-th entry of a bucket takes k compares
+    compareCount += (long)length * (length + 1) / 2;
+  }
+
+  printf(
+      "Large CT: chained, %d entries in %d buckets, at most %d probes, "
+      "%.2f on average per hit\n",
+      entryCount, bucketCount, longestBucket,
+      entryCount ? (double)compareCount / entryCount : 0);
+}
+
+int main(int argc, char **argv) {
+  int patternCount = argc > 1 ? atoi(argv[1]) : DEFAULT_PATTERN_COUNT;
+  int inputMb = argc > 2 ? atoi(argv[2]) : DEFAULT_INPUT_MB;
+
+  srand(1);
+  DFC_SetupEnvironment();
+
+  DFC_PATTERN_INIT *patternInit = DFC_PATTERN_INIT_New();
+
+  uint8_t *patterns = malloc(patternCount * 8);
+  int *patternLengths = malloc(patternCount * sizeof(int));
+  benchmarkInputLength = inputMb * 1024 * 1024;
+  benchmarkInput = malloc(benchmarkInputLength);
+  if (!patterns || !patternLengths || !benchmarkInput) {
+    fprintf(stderr, "Could not allocate memory for the benchmark\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < patternCount; ++i) {
+    patternLengths[i] = 4 + rand() % 4;
+    randomLetters(patterns + i * 8, patternLengths[i]);
+
+    DFC_AddPattern(patternInit, patterns + i * 8, patternLengths[i],
+                   i % 4 == 0 /*every fourth is case-insensitive*/, i);
+  }
+
+  randomLetters((uint8_t *)benchmarkInput, benchmarkInputLength);
+  for (int i = 0; i + 8 <= benchmarkInputLength; i += PATTERN_DISTANCE) {
+    int pattern = rand() % patternCount;
+    memcpy(benchmarkInput + i, patterns + pattern * 8,
+           patternLengths[pattern]);
+  }
+
+  DFC_STRUCTURE *dfc = DFC_Compile(patternInit);
+
+  printf("Compiled %d patterns in %.1f ms\n", patternCount,
+         readTimerMs(TIMER_COMPILE_DFC));
+  printLargeCompactTable(dfc);
+
+  startTimer(TIMER_SEARCH);
+  DFC_Search(readInput, onMatch);
+  stopTimer(TIMER_SEARCH);
+
+  double searchMs = readTimerMs(TIMER_SEARCH);
+  printf("Searched %d MB in %.1f ms (%.1f MB/s), %d matches\n", inputMb,
+         searchMs, inputMb / (searchMs / 1000), matchCount);
+
+  DFC_FreePatternsInit(patternInit);
+  DFC_FreeStructure();
+  DFC_ReleaseEnvironment();
+
+  free(patterns);
+  free(patternLengths);
+  free(benchmarkInput);
+
+  return 0;
+}
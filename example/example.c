@@ -70,9 +70,11 @@ int readInput(int maxLength, int maxPatternLength, char *input) {
 }
 
 void printResult(DFC_FIXED_PATTERN *pattern) {
-  printf("Matched %.*s ", pattern->pattern_length, pattern->original_pattern);
+  printf("Matched %.*s ", pattern->pattern_length,
+         DFC_GetPatternBytes(pattern));
+  PID_TYPE *externalIds = DFC_GetExternalIds(pattern);
   for (int i = 0; i < pattern->external_id_count; ++i) {
-    printf(" %d,", pattern->external_ids[i]);
+    printf(" %d,", externalIds[i]);
   }
   printf("\n");
 }
\ No newline at end of file
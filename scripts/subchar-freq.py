@@ -7,12 +7,16 @@ import matplotlib.pyplot as plt
 CT_LARGE_OFFSET = 0
 CT_LARGE_LENGTH = 4
 
+# DFC_Compile picks the size and the hash of the large compact table for each
+# ruleset, see chooseLargeCompactTableHash, these are the former fixed ones
 CT_LARGE_SIZE = int('0x20000', 16)
-CT_LARGE_HASH = 8339
+CT_LARGE_HASH = 8389
+CT_LARGE_SHIFT = 0
 
 
 def hash_large_ct(val):
-    return (to_int(val) * CT_LARGE_HASH) & (CT_LARGE_SIZE - 1)
+    product = (to_int(val) * CT_LARGE_HASH) & 0xffffffff
+    return (product >> CT_LARGE_SHIFT) & (CT_LARGE_SIZE - 1)
 
 
 def to_int(val):
@@ -0,0 +1,92 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// larger allocations get a block of their own
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock_ {
+  ArenaBlock *next;
+  size_t size;
+  size_t used;
+  uint8_t *memory;
+};
+
+static size_t alignToArena(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// the memory follows the block
+static ArenaBlock *addBlock(Arena *arena, size_t size) {
+  size_t headerSize = alignToArena(sizeof(ArenaBlock));
+  ArenaBlock *block = malloc(headerSize + size);
+  if (!block) {
+    fprintf(stderr, "Could not allocate %zu bytes for an arena\n", size);
+    exit(1);
+  }
+
+  block->memory = (uint8_t *)block + headerSize;
+  block->size = size;
+  block->used = 0;
+  block->next = arena->blocks;
+  arena->blocks = block;
+
+  return block;
+}
+
+void *allocateFromArena(Arena *arena, size_t size) {
+  size = alignToArena(size > 0 ? size : 1);
+
+  ArenaBlock *block = arena->blocks;
+  if (!block || block->size - block->used < size) {
+    if (size > ARENA_BLOCK_SIZE / 4) {
+      // keeps the rest of the current block in use
+      block = addBlock(arena, size);
+      if (block->next) {
+        arena->blocks = block->next;
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+      }
+    } else {
+      block = addBlock(arena, ARENA_BLOCK_SIZE);
+    }
+  }
+
+  void *memory = block->memory + block->used;
+  block->used += size;
+  memset(memory, 0, size);
+
+  return memory;
+}
+
+static int isPowerOfTwo(int value) { return (value & (value - 1)) == 0; }
+
+void *growArrayInArena(Arena *arena, void *array, int count,
+                       size_t elementSize) {
+  if (count > 0 && !isPowerOfTwo(count)) {
+    return array;
+  }
+
+  int capacity = count > 0 ? 2 * count : 1;
+  void *grown = allocateFromArena(arena, capacity * elementSize);
+  if (count > 0) {
+    memcpy(grown, array, count * elementSize);
+  }
+
+  return grown;
+}
+
+void releaseArena(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  arena->blocks = NULL;
+}
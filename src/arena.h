@@ -0,0 +1,31 @@
+#ifndef DFC_ARENA_H
+#define DFC_ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock_ ArenaBlock;
+
+/*
+ * Hands out memory for many small objects that all die at the same time,
+ * such as the patterns added before compiling and the dynamic compact tables.
+ * Nothing is freed on its own, the whole arena is released at once.
+ * An arena of zeroes is empty and ready to use.
+ */
+typedef struct {
+  ArenaBlock *blocks;
+} Arena;
+
+// zeroed, aligned for any type
+void *allocateFromArena(Arena *arena, size_t size);
+
+/*
+ * Makes room for element count + 1 of an array holding count elements.
+ * Arrays grow to the next power of two, so the count alone tells when they
+ * are full. The elements are moved if so, the old ones stay in the arena.
+ */
+void *growArrayInArena(Arena *arena, void *array, int count,
+                       size_t elementSize);
+
+void releaseArena(Arena *arena);
+
+#endif
@@ -25,5 +25,13 @@
 #define OPENCL_COULD_NOT_UNMAP_DFC 23
 #define OPENCL_COULD_NOT_UNMAP_PATTERNS 24
 #define OPENCL_COULD_NOT_UNMAP_INPUT 25
+#define COULD_NOT_START_THREAD_EXIT_CODE 26
+#define INVALID_MATCH_BUFFER_EXIT_CODE 27
+#define STREAM_NEEDS_HOST_FILTERS_EXIT_CODE 28
+#define STRUCTURE_PUBLISHED_TWICE_EXIT_CODE 29
+#define PUBLISHING_NEEDS_HOST_SEARCH_EXIT_CODE 30
+#define STRUCTURE_CANNOT_BE_UPDATED_EXIT_CODE 31
+#define NO_ROOM_FOR_ADDED_PATTERN_EXIT_CODE 32
+#define INVALID_PATTERN_FILE_EXIT_CODE 33
 
 #endif
\ No newline at end of file
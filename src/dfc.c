@@ -1,13 +1,38 @@
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 
 #include "dfc.h"
 #include "memory.h"
+#include "pattern-file.h"
+#include "publish.h"
+#include "search-scratch.h"
+#include "search-stream.h"
 #include "search.h"
 #include "shared-functions.h"
+#include "structure-file.h"
+#include "thread-pool.h"
 #include "timer.h"
+#include "update.h"
 #include "utility.h"
 
-static unsigned char xlatcase[256];
+// matches buffered by DFC_Search before they are passed on one by one
+#define MATCH_BATCH_SIZE 256
+
+// case permutations of the 4 byte fragment of a large pattern
+#define LARGE_FRAGMENT_PERMUTATIONS (2 << SMALL_DF_MAX_PATTERN_SIZE)
+
+// FNV-1a of the patterns added, see DFC_LoadStructure
+#define CONTENT_HASH_BASIS 14695981039346656037u
+#define CONTENT_HASH_PRIME 1099511628211u
+
+// below this amount of patterns per thread, compiling in parallel is not
+// worth starting the threads
+#define MIN_PATTERNS_PER_COMPILE_THREAD 2048
+
+// patterns that may be added to any compiled structure, on top of
+// UPDATE_SLACK_PERCENT
+#define UPDATE_MIN_SLACK_PATTERNS 64
 
 typedef struct DynamicCtSmallEntry_ {
   uint8_t pattern;
@@ -26,27 +51,67 @@ typedef struct DynamicCtLarge_ {
   DynamicCtLargeEntry *entries;
 } DynamicCtLarge;
 
-static void *DFC_REALLOC(void *p, uint16_t n, dfcDataType type);
+typedef struct DynamicCtLongEntry_ {
+  uint64_t pattern;
+  int32_t pidCount;
+  PID_TYPE *pids;
+} DynamicCtLongEntry;
+
+typedef struct DynamicCtLong_ {
+  int entryCount;
+  DynamicCtLongEntry *entries;
+} DynamicCtLong;
+
+// see Parallel compilation
+typedef struct {
+  ThreadPool *pool;
+  int threadCount;
+
+  // in the order of the pattern list
+  DFC_PATTERN **patterns;
+  int patternCount;
+
+  // the keys of pattern i in the large compact table start at
+  // largeKeyOffsets[i], see collectLargeCompactTableKeys
+  uint32_t *largeKeys;
+  int *largeKeyOffsets;
+
+  // where pattern i goes in patternBytes and externalIds, the last offsets
+  // are the amount of bytes and ids
+  uint32_t *patternOffsets;
+  uint32_t *externalIdOffsets;
+
+  DFC_TABLE_SIZES sizes;
+  DynamicCtSmallEntry *ctSmall;
+  DynamicCtLarge *ctLarge;
+  DynamicCtLong *ctLong;
+  // one per thread, holding the dynamic compact tables until they are
+  // flattened
+  Arena *arenas;
+
+  DFC_STRUCTURE *dfc;
+  // the direct filters set by each thread, DIRECT_FILTER_COUNT per thread,
+  // the first thread sets those of dfc
+  uint8_t **threadFilters;
+} CompileJob;
+
 static void *DFC_MALLOC(int n);
-static inline DFC_PATTERN *DFC_InitHashLookup(DFC_PATTERN_INIT *ctx,
-                                              uint8_t *pat, uint16_t patlen);
-static inline int DFC_InitHashAdd(DFC_PATTERN_INIT *ctx, DFC_PATTERN *p);
-
-static void setupPatternListFromHash(DFC_PATTERN_INIT *init);
-static void setupMatchList(DFC_PATTERN_INIT *init, DFC_PATTERNS *patterns);
-
-static void setupDirectFilters(DFC_STRUCTURE *dfc, DFC_PATTERN_INIT *patterns);
-static void addPatternToSmallDirectFilter(DFC_STRUCTURE *dfc,
-                                          DFC_PATTERN *pattern);
-static void addPatternToLargeDirectFilter(DFC_STRUCTURE *dfc,
-                                          DFC_PATTERN *pattern);
-static void addPatternToLargeDirectFilterHash(DFC_STRUCTURE *dfc,
-                                              DFC_PATTERN *pattern);
+static void setupMatchList(CompileJob *job, int threadIndex);
+
+static void setupDirectFilters(CompileJob *job, int threadIndex);
+static int collectFilterBits(DFC_STRUCTURE *dfc, DFC_PATTERN *pattern,
+                             FilterBits *filterBits);
 static void createPermutations(uint8_t *pattern, int patternLength,
                                int permutationCount, uint8_t *permutations);
-static void setupCompactTables(DFC_PATTERN_INIT *patterns,
-                               DynamicCtSmallEntry **ctSmall,
-                               DynamicCtLarge **ctLarge);
+static uint8_t *getFragment(DFC_PATTERN *pattern);
+static void setupCompactTables(CompileJob *job, int threadIndex);
+
+static int sliceStart(int count, int sliceCount, int slice);
+static CompileJob createCompileJob(DFC_PATTERN_INIT *patterns);
+static void freeCompileJob(CompileJob *job);
+static void collectLargeKeysInParallel(CompileJob *job);
+static void setupCompactTablesInParallel(CompileJob *job);
+static void setupPatternsInParallel(CompileJob *job);
 
 static uint8_t toggleCharacterCase(uint8_t);
 
@@ -56,65 +121,57 @@ void DFC_ReleaseEnvironment() { releaseExecutionEnvironment(); }
 DFC_PATTERN_INIT *DFC_PATTERN_INIT_New(void) {
   DFC_PATTERN_INIT *p;
 
-  init_xlatcase(xlatcase);
-
   p = (DFC_PATTERN_INIT *)DFC_MALLOC(sizeof(DFC_PATTERN_INIT));
   MEMASSERT_DFC(p, "DFC_PATTERN_INIT_New");
 
   if (p) {
-    p->init_hash =
-        (DFC_PATTERN **)malloc(sizeof(DFC_PATTERN *) * INIT_HASH_SIZE);
-    if (p->init_hash == NULL) {
-      exit(1);
-    }
-    memset(p->init_hash, 0, sizeof(DFC_PATTERN *) * INIT_HASH_SIZE);
+    init_xlatcase(p->xlatcase);
+    p->contentHash = CONTENT_HASH_BASIS;
   }
 
   return p;
 }
 
-static void DFC_FreePattern(DFC_PATTERN *p) {
-  free(p->patrn);
-  free(p->casepatrn);
-  free(p->sids);
-}
-
 void DFC_FreePatternsInit(DFC_PATTERN_INIT *patterns) {
-  DFC_PATTERN *plist;
-  DFC_PATTERN *p_next;
-
-  for (plist = patterns->dfcPatterns; plist != NULL;) {
-    DFC_FreePattern(plist);
-    p_next = plist->next;
-    free(plist);
-    plist = p_next;
-  }
+  releaseArena(&patterns->patternArena);
 
-  free(patterns->init_hash);
+  freePatternIndex(&patterns->index);
+  free(patterns->pairFrequencies);
   free(patterns);
 }
 
-void DFC_FreeStructure() { freeDfcStructure(); }
+void DFC_FreeStructure() { freeDfcStructure(DFC_HOST_MEMORY.dfcStructure); }
+
+void DFC_FreeStructureOf(DFC_STRUCTURE *dfc) { freeDfcStructure(dfc); }
 
 void DFC_FreeInput() { freeDfcInput(); }
 
-void DFC_AddPattern(DFC_PATTERN_INIT *dfc, unsigned char *pat, int n,
-                    int is_case_insensitive, PID_TYPE sid) {
-  DFC_PATTERN *plist = DFC_InitHashLookup(dfc, pat, n);
+static uint64_t hashContent(uint64_t hash, const void *content, int length) {
+  const uint8_t *bytes = content;
+  for (int i = 0; i < length; ++i) {
+    hash = (hash ^ bytes[i]) * CONTENT_HASH_PRIME;
+  }
 
-  if (plist == NULL) {
-    plist = (DFC_PATTERN *)DFC_MALLOC(sizeof(DFC_PATTERN));
-    MEMASSERT_DFC(plist, "DFC_AddPattern");
-    memset(plist, 0, sizeof(DFC_PATTERN));
+  return hash;
+}
 
-    plist->patrn = (unsigned char *)DFC_MALLOC(n);
-    MEMASSERT_DFC(plist->patrn, "DFC_AddPattern");
+static void addPattern(DFC_PATTERN_INIT *dfc, const unsigned char *pat, int n,
+                       int is_case_insensitive, PID_TYPE sid) {
+  int header[] = {n, is_case_insensitive, sid};
+  dfc->contentHash = hashContent(dfc->contentHash, header, sizeof(header));
+  dfc->contentHash = hashContent(dfc->contentHash, pat, n);
 
-    ConvertCaseEx(plist->patrn, pat, n, xlatcase);
+  uint64_t hash = hashPatternKey(pat, n);
+  DFC_PATTERN *plist = findIndexedPattern(&dfc->index, pat, n, hash);
+
+  if (plist == NULL) {
+    Arena *arena = &dfc->patternArena;
+    plist = allocateFromArena(arena, sizeof(DFC_PATTERN));
 
-    plist->casepatrn = (unsigned char *)DFC_MALLOC(n);
-    MEMASSERT_DFC(plist->casepatrn, "DFC_AddPattern");
+    plist->patrn = allocateFromArena(arena, n);
+    ConvertCaseEx(plist->patrn, (unsigned char *)pat, n, dfc->xlatcase);
 
+    plist->casepatrn = allocateFromArena(arena, n);
     memcpy(plist->casepatrn, pat, n);
 
     plist->n = n;
@@ -122,35 +179,70 @@ void DFC_AddPattern(DFC_PATTERN_INIT *dfc, unsigned char *pat, int n,
     plist->iid = dfc->numPatterns;  // internal id
     plist->next = NULL;
 
-    DFC_InitHashAdd(dfc, plist);
+    addIndexedPattern(&dfc->index, plist, hash);
 
-    /* sid update */
-    plist->sids_size = 1;
-    plist->sids = (PID_TYPE *)DFC_MALLOC(sizeof(PID_TYPE));
-    MEMASSERT_DFC(plist->sids, "DFC_AddPattern");
-    plist->sids[0] = sid;
-
-    /* Add this pattern to the list */
+    /* Add this pattern to the end of the list */
+    if (dfc->lastPattern) {
+      dfc->lastPattern->next = plist;
+    } else {
+      dfc->dfcPatterns = plist;
+    }
+    dfc->lastPattern = plist;
     dfc->numPatterns++;
-  } else {
-    int found = 0;
-    uint32_t x = 0;
+  }
 
-    for (x = 0; x < plist->sids_size; x++) {
-      if (plist->sids[x] == sid) {
-        found = 1;
-        break;
-      }
-    }
+  /* sid update */
+  if (addIndexedExternalId(&dfc->index, plist->iid, sid)) {
+    plist->sids = growArrayInArena(&dfc->patternArena, plist->sids,
+                                   plist->sids_size, sizeof(PID_TYPE));
+    plist->sids[plist->sids_size] = sid;
+    plist->sids_size++;
+  }
+}
 
-    if (!found) {
-      PID_TYPE *sids = (PID_TYPE *)DFC_REALLOC(
-          plist->sids, plist->sids_size + 1, DFC_PID_TYPE);
-      plist->sids = sids;
-      plist->sids[plist->sids_size] = sid;
-      plist->sids_size++;
+void DFC_AddPattern(DFC_PATTERN_INIT *dfc, unsigned char *pat, int n,
+                    int is_case_insensitive, PID_TYPE sid) {
+  addPattern(dfc, pat, n, is_case_insensitive, sid);
+}
+
+void DFC_AddPatterns(DFC_PATTERN_INIT *patterns,
+                     const DFC_PATTERN_DESCRIPTION *descriptions, int count) {
+  reservePatternIndex(&patterns->index, count);
+
+  for (int i = 0; i < count; ++i) {
+    addPattern(patterns, descriptions[i].pattern, descriptions[i].length,
+               descriptions[i].is_case_insensitive, descriptions[i].sid);
+  }
+}
+
+int DFC_AddPatternFile(DFC_PATTERN_INIT *patterns, const char *path) {
+  return addPatternFile(patterns, path);
+}
+
+// patrn is upper case already, the samples are folded the same way
+static uint16_t pairAt(const uint8_t *bytes) {
+  return bytes[1] << 8 | bytes[0];
+}
+
+void DFC_AddFragmentSample(DFC_PATTERN_INIT *patterns,
+                           const unsigned char *sample, int length) {
+  if (!patterns->pairFrequencies) {
+    patterns->pairFrequencies = calloc(1 << 16, sizeof(uint32_t));
+    if (!patterns->pairFrequencies) {
+      fprintf(stderr, "Could not allocate memory for the pair frequencies\n");
+      exit(1);
     }
   }
+
+  patterns->contentHash = hashContent(patterns->contentHash, &length,
+                                      sizeof(length));
+  patterns->contentHash = hashContent(patterns->contentHash, sample, length);
+
+  const unsigned char *xlatcase = patterns->xlatcase;
+  for (int i = 0; i + 1 < length; ++i) {
+    ++patterns->pairFrequencies[xlatcase[sample[i + 1]] << 8 |
+                                xlatcase[sample[i]]];
+  }
 }
 
 int countNumberOfPidsInSmallCt(DynamicCtSmallEntry *ct) {
@@ -162,17 +254,17 @@ int countNumberOfPidsInSmallCt(DynamicCtSmallEntry *ct) {
   return count;
 }
 
-int countNumberOfEntriesInLargeCt(DynamicCtLarge *ct) {
+int countNumberOfEntriesInLargeCt(DynamicCtLarge *ct, int bucketCount) {
   int count = 0;
-  for (int i = 0; i < COMPACT_TABLE_SIZE_LARGE; ++i) {
+  for (int i = 0; i < bucketCount; ++i) {
     count += ct[i].entryCount;
   }
   return count;
 }
 
-int countNumberOfPidsInLargeCt(DynamicCtLarge *ct) {
+int countNumberOfPidsInLargeCt(DynamicCtLarge *ct, int bucketCount) {
   int count = 0;
-  for (int i = 0; i < COMPACT_TABLE_SIZE_LARGE; ++i) {
+  for (int i = 0; i < bucketCount; ++i) {
     for (int j = 0; j < ct[i].entryCount; ++j) {
       count += ct[i].entries[j].pidCount;
     }
@@ -199,20 +291,12 @@ static void flattenSmallCt(DynamicCtSmallEntry *dynamicCt,
   }
 }
 
-static void freeDynamicSmallCt(DynamicCtSmallEntry *ct) {
-  for (int i = 0; i < COMPACT_TABLE_SIZE_SMALL; ++i) {
-    DynamicCtSmallEntry *entry = ct + i;
-    free(entry->pids);
-  }
-  free(ct);
-}
-
-static void flattenLargeCt(DynamicCtLarge *dynamicCt,
+static void flattenLargeCt(DynamicCtLarge *dynamicCt, int bucketCount,
                            CompactTableLargeBucket *staticCt,
                            CompactTableLargeEntry *entries, PID_TYPE *pids) {
   int entryOffset = 0;
   int pidOffset = 0;
-  for (int i = 0; i < COMPACT_TABLE_SIZE_LARGE; ++i) {
+  for (int i = 0; i < bucketCount; ++i) {
     DynamicCtLarge *dynamicBucket = dynamicCt + i;
     CompactTableLargeBucket *staticBucket = staticCt + i;
 
@@ -237,137 +321,749 @@ static void flattenLargeCt(DynamicCtLarge *dynamicCt,
   }
 }
 
-static void freeDynamicLargeCt(DynamicCtLarge *ct) {
-  for (int i = 0; i < COMPACT_TABLE_SIZE_LARGE; ++i) {
-    DynamicCtLarge *bucket = ct + i;
-    for (int j = 0; j < bucket->entryCount; ++j) {
-      DynamicCtLargeEntry *entry = bucket->entries + j;
-      free(entry->pids);
+int countNumberOfEntriesInLongCt(DynamicCtLong *ct, int bucketCount) {
+  int count = 0;
+  for (int i = 0; i < bucketCount; ++i) {
+    count += ct[i].entryCount;
+  }
+  return count;
+}
+
+int countNumberOfPidsInLongCt(DynamicCtLong *ct, int bucketCount) {
+  int count = 0;
+  for (int i = 0; i < bucketCount; ++i) {
+    for (int j = 0; j < ct[i].entryCount; ++j) {
+      count += ct[i].entries[j].pidCount;
+    }
+  }
+
+  return count;
+}
+
+static void flattenLongCt(DynamicCtLong *dynamicCt, int bucketCount,
+                          CompactTableLongBucket *staticCt,
+                          CompactTableLongEntry *entries, PID_TYPE *pids) {
+  int entryOffset = 0;
+  int pidOffset = 0;
+  for (int i = 0; i < bucketCount; ++i) {
+    DynamicCtLong *dynamicBucket = dynamicCt + i;
+    CompactTableLongBucket *staticBucket = staticCt + i;
+
+    staticBucket->entryOffset = entryOffset;
+    staticBucket->entryCount = dynamicBucket->entryCount;
+    for (int j = 0; j < dynamicBucket->entryCount; ++j) {
+      DynamicCtLongEntry *dynamicEntry = dynamicBucket->entries + j;
+      CompactTableLongEntry *staticEntry =
+          entries + staticBucket->entryOffset + j;
+
+      staticEntry->pattern = dynamicEntry->pattern;
+      staticEntry->pidCount = dynamicEntry->pidCount;
+      staticEntry->pidOffset = pidOffset;
+
+      for (int k = 0; k < dynamicEntry->pidCount; ++k) {
+        pids[pidOffset] = dynamicEntry->pids[k];
+        ++pidOffset;
+      }
+
+      ++entryOffset;
+    }
+  }
+}
+
+// empty slots have no pids, the single bucket is not used
+static void flattenLargeCuckooCt(DynamicCtLargeEntry **slots, int slotCount,
+                                 CompactTableLargeBucket *staticCt,
+                                 CompactTableLargeEntry *entries,
+                                 PID_TYPE *pids) {
+  staticCt->entryOffset = 0;
+  staticCt->entryCount = 0;
+
+  int pidOffset = 0;
+  for (int i = 0; i < slotCount; ++i) {
+    DynamicCtLargeEntry *dynamicEntry = slots[i];
+    CompactTableLargeEntry *staticEntry = entries + i;
+
+    staticEntry->pidOffset = pidOffset;
+    if (!dynamicEntry) {
+      staticEntry->pattern = 0;
+      staticEntry->pidCount = 0;
+      continue;
+    }
+
+    staticEntry->pattern = dynamicEntry->pattern;
+    staticEntry->pidCount = dynamicEntry->pidCount;
+
+    for (int k = 0; k < dynamicEntry->pidCount; ++k) {
+      pids[pidOffset] = dynamicEntry->pids[k];
+      ++pidOffset;
     }
+  }
+}
 
-    free(bucket->entries);
+static int ceilLog2(double value) {
+  int bits = 0;
+  while ((double)(1UL << bits) < value) {
+    ++bits;
   }
 
-  free(ct);
+  return bits;
 }
 
-DFC_STRUCTURE *DFC_Compile(DFC_PATTERN_INIT *patterns) {
-  startTimer(TIMER_COMPILE_DFC);
+static int clampBits(int bits, int min, int max) {
+  return bits < min ? min : (bits > max ? max : bits);
+}
 
-  DynamicCtSmallEntry *ctSmall;
-  DynamicCtLarge *ctLarge;
+static uint32_t firstFourBytes(uint8_t *pattern) {
+  return pattern[3] << 24 | pattern[2] << 16 | pattern[1] << 8 | pattern[0];
+}
+
+// the keys of a large pattern in the large compact table, the first 4 bytes
+// of its fragment in every case if it is case insensitive, they may repeat
+static int collectLargeCompactTableKeys(DFC_PATTERN *pattern, uint32_t *keys) {
+  int patternLength = SMALL_DF_MAX_PATTERN_SIZE + 1;
+  assert(pattern->n >= patternLength);
+
+  if (!pattern->is_case_insensitive) {
+    keys[0] = firstFourBytes(getFragment(pattern));
+    return 1;
+  }
+
+  uint8_t permutations[LARGE_FRAGMENT_PERMUTATIONS *
+                       (SMALL_DF_MAX_PATTERN_SIZE + 1)];
+  createPermutations(getFragment(pattern), patternLength,
+                     LARGE_FRAGMENT_PERMUTATIONS, permutations);
+
+  for (int i = 0; i < LARGE_FRAGMENT_PERMUTATIONS; ++i) {
+    keys[i] = firstFourBytes(permutations + i * patternLength);
+  }
+
+  return LARGE_FRAGMENT_PERMUTATIONS;
+}
+
+static int compareKeys(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// sorts the keys and drops the repeated ones, returns the amount left
+static int uniqueKeys(uint32_t *keys, int count) {
+  qsort(keys, count, sizeof(uint32_t), compareKeys);
+
+  int distinctCount = 0;
+  for (int i = 0; i < count; ++i) {
+    if (distinctCount == 0 || keys[distinctCount - 1] != keys[i]) {
+      keys[distinctCount++] = keys[i];
+    }
+  }
+
+  return distinctCount;
+}
+
+// the distinct keys of the large compact table, that is the fragments of the
+// large patterns and all their case permutations
+static uint32_t *collectLargeKeys(CompileJob *job, int *keyCount) {
+  int count = job->largeKeyOffsets[job->patternCount];
+
+  uint32_t *keys = malloc((count + 1) * sizeof(uint32_t));
+  if (!keys) {
+    fprintf(stderr, "Could not allocate the keys of the large CT\n");
+    exit(1);
+  }
+  memcpy(keys, job->largeKeys, count * sizeof(uint32_t));
+
+  *keyCount = uniqueKeys(keys, count);
+  return keys;
+}
 
-  setupPatternListFromHash(patterns);
+static int hashDirectFilterBits(int keyCount, int hashCount) {
+  // a filter of m bits holding n keys with k bits each passes a position that
+  // starts none of them with a probability of (1 - e^(-k * n / m))^k
+  double rate = HASH_FILTER_FALSE_POSITIVE_PERCENT / 100.0;
+  double bitCount =
+      hashCount * keyCount / -log(1 - pow(rate, 1.0 / hashCount));
 
-  setupCompactTables(patterns, &ctSmall, &ctLarge);
+  return clampBits(ceilLog2(bitCount), DF_HASH_MIN_BITS, DF_HASH_MAX_BITS);
+}
+
+static int compactTableBits(int keyCount) {
+  return clampBits(ceilLog2(keyCount), COMPACT_TABLE_MIN_BITS,
+                   COMPACT_TABLE_MAX_BITS);
+}
+
+/*
+ * Odd multipliers tried for the large compact table, the first one is the
+ * hash that used to be fixed. Each is tried keeping the low and the high bits
+ * of the product.
+ */
+static const uint32_t LARGE_CT_HASH_MULTIPLIERS[] = {
+    8389,       0x9E3779B1, 0x85EBCA6B, 0xC2B2AE35, 0x27D4EB2F,
+    0x165667B1, 0xCC9E2D51, 0x1B873593, 0x2545F491, 0x01000193};
+
+// picks the hash with the shortest longest bucket, as every position that
+// passes the filters scans a bucket, and then the fewest expected compares
+static void chooseLargeCompactTableHash(uint32_t *keys, int keyCount,
+                                        DFC_TABLE_SIZES *sizes) {
+  int bucketCount = 1 << sizes->ctLargeBits;
+  int *bucketLengths = malloc(bucketCount * sizeof(int));
+  if (!bucketLengths) {
+    fprintf(stderr, "Could not allocate memory to choose the large CT hash\n");
+    exit(1);
+  }
+
+  int shifts[] = {0, 32 - sizes->ctLargeBits};
+  int multiplierCount =
+      sizeof(LARGE_CT_HASH_MULTIPLIERS) / sizeof(LARGE_CT_HASH_MULTIPLIERS[0]);
+
+  int bestMaxLength = keyCount + 1;
+  uint64_t bestCompareCount = UINT64_MAX;
+  for (int i = 0; i < multiplierCount; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      memset(bucketLengths, 0, bucketCount * sizeof(int));
+
+      int maxLength = 0;
+      uint64_t compareCount = 0;
+      for (int k = 0; k < keyCount; ++k) {
+        int *length = bucketLengths +
+                      hashForLargeCompactTable(
+                          keys[k], LARGE_CT_HASH_MULTIPLIERS[i], shifts[j],
+                          sizes->ctLargeBits);
+
+        ++*length;
+        compareCount += *length;
+        maxLength = *length > maxLength ? *length : maxLength;
+      }
+
+      if (maxLength < bestMaxLength ||
+          (maxLength == bestMaxLength && compareCount < bestCompareCount)) {
+        bestMaxLength = maxLength;
+        bestCompareCount = compareCount;
+        sizes->ctLargeHashMultiplier = LARGE_CT_HASH_MULTIPLIERS[i];
+        sizes->ctLargeHashShift = shifts[j];
+      }
+    }
+  }
+
+  free(bucketLengths);
+}
+
+static uint32_t cuckooSlot(uint32_t pattern, uint32_t multiplier,
+                           DFC_TABLE_SIZES *sizes) {
+  return hashForLargeCompactTable(pattern, multiplier, sizes->ctLargeHashShift,
+                                  sizes->ctLargeBits);
+}
+
+// puts every entry of the chained table in the slot of one of its two hashes,
+// moving the entry in the way to its other slot, fails when that goes on for
+// too long as the entries most likely form a cycle
+static bool placeLargeCuckooEntries(DynamicCtLarge *ct, int bucketCount,
+                                    DFC_TABLE_SIZES *sizes,
+                                    DynamicCtLargeEntry **slots) {
+  memset(slots, 0, (1 << sizes->ctLargeBits) * sizeof(DynamicCtLargeEntry *));
+
+  for (int i = 0; i < bucketCount; ++i) {
+    for (int j = 0; j < ct[i].entryCount; ++j) {
+      DynamicCtLargeEntry *entry = ct[i].entries + j;
+
+      uint32_t slot =
+          cuckooSlot(entry->pattern, sizes->ctLargeHashMultiplier, sizes);
+      if (slots[slot]) {
+        uint32_t second =
+            cuckooSlot(entry->pattern, sizes->ctLargeCuckooMultiplier, sizes);
+        slot = slots[second] ? slot : second;
+      }
+
+      for (int kick = 0; entry; ++kick) {
+        if (kick == CUCKOO_MAX_KICKS) {
+          return false;
+        }
+
+        DynamicCtLargeEntry *evicted = slots[slot];
+        slots[slot] = entry;
+        entry = evicted;
+
+        if (entry) {
+          uint32_t first =
+              cuckooSlot(entry->pattern, sizes->ctLargeHashMultiplier, sizes);
+          slot = slot != first ? first
+                               : cuckooSlot(entry->pattern,
+                                            sizes->ctLargeCuckooMultiplier,
+                                            sizes);
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// tries pairs of multipliers until all entries of the chained table fit
+static DynamicCtLargeEntry **setupLargeCuckooCt(DynamicCtLarge *ct,
+                                                int bucketCount,
+                                                DFC_TABLE_SIZES *sizes) {
+  int slotCount = 1 << sizes->ctLargeBits;
+  DynamicCtLargeEntry **slots =
+      malloc(slotCount * sizeof(DynamicCtLargeEntry *));
+  if (!slots) {
+    fprintf(stderr, "Could not allocate memory for the large cuckoo CT\n");
+    exit(1);
+  }
+
+  int entryCount = countNumberOfEntriesInLargeCt(ct, bucketCount);
+
+  // once the table has its maximum size, more entries than slots may be left
+  // and no pair has to be tried
+  int multiplierCount =
+      entryCount <= slotCount ? sizeof(LARGE_CT_HASH_MULTIPLIERS) /
+                                    sizeof(LARGE_CT_HASH_MULTIPLIERS[0])
+                              : 0;
+  for (int i = 0; i < multiplierCount; ++i) {
+    for (int j = 0; j < multiplierCount; ++j) {
+      if (i == j) {
+        continue;
+      }
+
+      sizes->ctLargeHashMultiplier = LARGE_CT_HASH_MULTIPLIERS[i];
+      sizes->ctLargeCuckooMultiplier = LARGE_CT_HASH_MULTIPLIERS[j];
+      if (placeLargeCuckooEntries(ct, bucketCount, sizes, slots)) {
+        return slots;
+      }
+    }
+  }
+
+  fprintf(stderr,
+          "Could not place the %d large CT entries in %d cuckoo slots\n",
+          entryCount, slotCount);
+  exit(TOO_MANY_ENTRIES_IN_LARGE_CT_EXIT_CODE);
+}
+
+static DFC_TABLE_SIZES chooseTableSizes(CompileJob *job) {
+  int largeKeyCount;
+  uint32_t *largeKeys = collectLargeKeys(job, &largeKeyCount);
+
+  int longKeyCount = 0;
+  for (int i = 0; i < job->patternCount; ++i) {
+    // the long fragment is case folded
+    if (job->patterns[i]->n >= LONG_DF_MIN_PATTERN_SIZE) {
+      ++longKeyCount;
+    }
+  }
+
+  DFC_TABLE_SIZES sizes = {
+      .dfLargeHashBits = hashDirectFilterBits(
+          largeKeyCount, BLOCKED_BLOOM_FILTER ? BLOOM_FILTER_HASH_COUNT : 1),
+      .dfLongHashBits = hashDirectFilterBits(longKeyCount, 1),
+      // two choice cuckoo hashing starts failing at half of the slots used,
+      // so it is kept to at most a third
+      .ctLargeBits = compactTableBits(CUCKOO_LARGE_CT ? 3 * largeKeyCount
+                                                      : largeKeyCount),
+      .ctLongBits = compactTableBits(longKeyCount)};
+
+  if (USE_LOCAL_MEMORY) {
+    // copied to the local memory next to the 2 byte filters by every group
+    sizes.dfLargeHashBits = DF_HASH_MIN_BITS;
+  }
+
+  if (CUCKOO_LARGE_CT) {
+    // the chained table only collects the entries, the multipliers are
+    // chosen when they are placed into the slots
+    sizes.ctLargeHashMultiplier = LARGE_CT_HASH_MULTIPLIERS[0];
+    sizes.ctLargeCuckooMultiplier = LARGE_CT_HASH_MULTIPLIERS[1];
+    sizes.ctLargeHashShift = 32 - sizes.ctLargeBits;
+  } else {
+    chooseLargeCompactTableHash(largeKeys, largeKeyCount, &sizes);
+  }
+  free(largeKeys);
+
+  return sizes;
+}
+
+/*
+ * Rarest fragment selection (RAREST_FRAGMENT)
+ *
+ * Only positions whose first two bytes are in the 2 byte direct filter get to
+ * the hash filters and the compact tables. If the patterns are keyed on their
+ * first bytes, common prefixes such as "GET " let most of the input through.
+ * Instead each large and long pattern is keyed on the fragment starting with
+ * the rarest pair of bytes, followed by the rarest next pair.
+ */
+static void countPairsOf(uint32_t *frequencies, const uint8_t *folded,
+                         int length, int delta) {
+  for (int i = 0; i + 1 < length; ++i) {
+    frequencies[pairAt(folded + i)] += delta;
+  }
+}
+
+static uint32_t *countPatternPairs(DFC_PATTERN_INIT *patterns) {
+  uint32_t *frequencies = calloc(1 << 16, sizeof(uint32_t));
+  if (!frequencies) {
+    fprintf(stderr, "Could not allocate memory for the pair frequencies\n");
+    exit(1);
+  }
+
+  for (DFC_PATTERN *plist = patterns->dfcPatterns; plist != NULL;
+       plist = plist->next) {
+    countPairsOf(frequencies, plist->patrn, plist->n, 1);
+  }
+
+  return frequencies;
+}
+
+// the offset is at most maxOffset
+static int chooseFragmentOffset(DFC_PATTERN *pattern, uint32_t *frequencies,
+                                int maxOffset) {
+  int fragmentLength = pattern->n >= LONG_DF_MIN_PATTERN_SIZE
+                           ? LONG_DF_MIN_PATTERN_SIZE
+                           : SMALL_DF_MAX_PATTERN_SIZE + 1;
+
+  int bestOffset = 0;
+  uint64_t bestScore = UINT64_MAX;
+  for (int offset = 0;
+       offset <= maxOffset && offset + fragmentLength <= pattern->n; ++offset) {
+    uint64_t score =
+        (frequencies[pairAt(pattern->patrn + offset)] + 1ULL) *
+        (frequencies[pairAt(pattern->patrn + offset + 2)] + 1ULL);
+
+    if (score < bestScore) {
+      bestScore = score;
+      bestOffset = offset;
+    }
+  }
+
+  return bestOffset;
+}
+
+// returns the largest offset, all of them are 0 without RAREST_FRAGMENT
+static int chooseFragmentOffsets(DFC_PATTERN_INIT *patterns) {
+  if (!RAREST_FRAGMENT) {
+    return 0;
+  }
 
+  uint32_t *frequencies = patterns->pairFrequencies
+                              ? patterns->pairFrequencies
+                              : countPatternPairs(patterns);
+
+  int maxOffset = 0;
+  for (DFC_PATTERN *plist = patterns->dfcPatterns; plist != NULL;
+       plist = plist->next) {
+    if (plist->n > SMALL_DF_MAX_PATTERN_SIZE) {
+      plist->fragment_offset =
+          chooseFragmentOffset(plist, frequencies, MAX_PATTERN_LENGTH);
+      maxOffset = plist->fragment_offset > maxOffset ? plist->fragment_offset
+                                                     : maxOffset;
+    }
+  }
+
+  if (frequencies != patterns->pairFrequencies) {
+    free(frequencies);
+  }
+
+  return maxOffset;
+}
+
+// items a table gets for the patterns added later on, perPattern being the
+// most one pattern takes, at most limit in all
+static int addSlack(int count, int perPattern, int limit) {
+  int slack = (int64_t)count * UPDATE_SLACK_PERCENT / 100;
+  if (slack < UPDATE_MIN_SLACK_PATTERNS * perPattern) {
+    slack = UPDATE_MIN_SLACK_PATTERNS * perPattern;
+  }
+
+  int64_t total = (int64_t)count + slack;
+  if (total > limit) {
+    total = limit > count ? limit : count;
+  }
+
+  return total;
+}
+
+// the pids and the offsets of the compact tables are 32 bit
+static DfcMemoryRequirements withSlack(DfcMemoryRequirements used) {
+  int maxCount = INT_MAX;
+
+  DfcMemoryRequirements capacity = used;
+  capacity.patternCount = addSlack(used.patternCount, 1, maxCount);
+  capacity.patternByteCount =
+      addSlack(used.patternByteCount, 3 * MAX_PATTERN_LENGTH, INT_MAX);
+  capacity.externalIdCount = addSlack(used.externalIdCount, 1, INT_MAX);
+  capacity.ctSmallPidCount = addSlack(used.ctSmallPidCount, 2, maxCount);
+  capacity.ctLargePidCount = addSlack(
+      used.ctLargePidCount, LARGE_FRAGMENT_PERMUTATIONS, maxCount);
+  capacity.ctLongEntryCount = addSlack(used.ctLongEntryCount, 1, maxCount);
+  capacity.ctLongPidCount = addSlack(used.ctLongPidCount, 1, maxCount);
+
+  // the cuckoo variant has a fixed amount of slots instead of entries
+  if (!CUCKOO_LARGE_CT) {
+    capacity.ctLargeEntryCount = addSlack(
+        used.ctLargeEntryCount, LARGE_FRAGMENT_PERMUTATIONS, maxCount);
+  }
+
+  return capacity;
+}
+
+// the structure searched by the functions not given one
+static void makeSearchedLast(DFC_STRUCTURE *dfc) {
+  // the structure compiled before may be freed by its last reader meanwhile
+  __atomic_store_n(&DFC_HOST_MEMORY.dfcStructure, dfc, __ATOMIC_RELEASE);
+  if (shouldUseOpenCl()) {
+    prepareOpenClBuffersForSearch();
+  }
+}
+
+DFC_STRUCTURE *DFC_Compile(DFC_PATTERN_INIT *patterns) {
+  startTimer(TIMER_COMPILE_DFC);
+
+  int maxFragmentOffset = chooseFragmentOffsets(patterns);
+  CompileJob job = createCompileJob(patterns);
+  collectLargeKeysInParallel(&job);
+
+  DFC_TABLE_SIZES sizes = chooseTableSizes(&job);
+  int ctLargeDynamicBucketCount = 1 << sizes.ctLargeBits;
+  int ctLongBucketCount = 1 << sizes.ctLongBits;
+
+  job.sizes = sizes;
+  setupCompactTablesInParallel(&job);
+  DynamicCtSmallEntry *ctSmall = job.ctSmall;
+  DynamicCtLarge *ctLarge = job.ctLarge;
+  DynamicCtLong *ctLong = job.ctLong;
+
+  DFC_STRUCTURE *dfc;
+  DynamicCtLargeEntry **ctLargeSlots = NULL;
+  if (CUCKOO_LARGE_CT) {
+    ctLargeSlots =
+        setupLargeCuckooCt(ctLarge, ctLargeDynamicBucketCount, &sizes);
+  }
+
+  DfcMemoryRequirements used;
   {
     int ctSmallPidCount = countNumberOfPidsInSmallCt(ctSmall);
-    int ctLargeEntryCount = countNumberOfEntriesInLargeCt(ctLarge);
-    int ctLargePidCount = countNumberOfPidsInLargeCt(ctLarge);
+    int ctLargeEntryCount =
+        CUCKOO_LARGE_CT
+            ? ctLargeDynamicBucketCount
+            : countNumberOfEntriesInLargeCt(ctLarge,
+                                            ctLargeDynamicBucketCount);
+    int ctLargePidCount =
+        countNumberOfPidsInLargeCt(ctLarge, ctLargeDynamicBucketCount);
+    int ctLongEntryCount =
+        countNumberOfEntriesInLongCt(ctLong, ctLongBucketCount);
+    int ctLongPidCount = countNumberOfPidsInLongCt(ctLong, ctLongBucketCount);
+
+    used = (DfcMemoryRequirements){
+        .patternCount = patterns->numPatterns,
+        .patternByteCount = job.patternOffsets[job.patternCount],
+        .externalIdCount = job.externalIdOffsets[job.patternCount],
+        .ctSmallPidCount = ctSmallPidCount,
+        .ctLargeEntryCount = ctLargeEntryCount,
+        .ctLargePidCount = ctLargePidCount,
+        .ctLongEntryCount = ctLongEntryCount,
+        .ctLongPidCount = ctLongPidCount,
+        .sizes = sizes};
+  }
+
+  DfcMemoryRequirements capacity = withSlack(used);
+  dfc = allocateDfcStructure(capacity);
+  dfc->updates = createUpdates(capacity, used);
+
+  dfc->sizes = sizes;
+  dfc->maxFragmentOffset = maxFragmentOffset;
+  dfc->patternHash = patterns->contentHash;
+
+  job.dfc = dfc;
+  setupPatternsInParallel(&job);
+
+  flattenSmallCt(ctSmall, dfc->ctSmallEntries, dfc->ctSmallPids);
+  if (CUCKOO_LARGE_CT) {
+    flattenLargeCuckooCt(ctLargeSlots, ctLargeDynamicBucketCount,
+                         dfc->ctLargeBuckets, dfc->ctLargeEntries,
+                         dfc->ctLargePids);
+  } else {
+    flattenLargeCt(ctLarge, ctLargeDynamicBucketCount, dfc->ctLargeBuckets,
+                   dfc->ctLargeEntries, dfc->ctLargePids);
+  }
+  flattenLongCt(ctLong, ctLongBucketCount, dfc->ctLongBuckets,
+                dfc->ctLongEntries, dfc->ctLongPids);
+
+  free(ctLargeSlots);
+  freeCompileJob(&job);
+
+  makeSearchedLast(dfc);
+
+  stopTimer(TIMER_COMPILE_DFC);
+
+  return dfc;
+}
+
+bool DFC_SaveStructure(DFC_STRUCTURE *dfc, const char *path) {
+  return saveStructure(dfc, path);
+}
+
+DFC_STRUCTURE *DFC_LoadStructure(const char *path,
+                                 DFC_PATTERN_INIT *patterns) {
+  DFC_STRUCTURE *dfc =
+      loadStructure(path, patterns ? patterns->contentHash : 0);
+  if (dfc) {
+    makeSearchedLast(dfc);
+  }
+
+  return dfc;
+}
+
+DFC_STRUCTURE *DFC_CompileCached(DFC_PATTERN_INIT *patterns,
+                                 const char *path) {
+  DFC_STRUCTURE *dfc = DFC_LoadStructure(path, patterns);
+  if (dfc) {
+    return dfc;
+  }
+
+  dfc = DFC_Compile(patterns);
+  // the next start compiles again if the cache cannot be written
+  DFC_SaveStructure(dfc, path);
+
+  return dfc;
+}
+
+typedef struct {
+  MatchFunction onMatch;
+  DFC_FIXED_PATTERN *patterns;
+} SingleMatchDelivery;
+
+static void deliverMatchesOneByOne(DFC_MATCH *matches, int matchCount,
+                                   void *userData) {
+  SingleMatchDelivery *delivery = (SingleMatchDelivery *)userData;
+
+  for (int i = 0; i < matchCount; ++i) {
+    delivery->onMatch(&delivery->patterns[matches[i].pid]);
+  }
+}
+
+int DFC_Search(ReadFunction read, MatchFunction onMatch) {
+  DFC_MATCH matches[MATCH_BATCH_SIZE];
+  SingleMatchDelivery delivery = {
+      .onMatch = onMatch,
+      .patterns = DFC_HOST_MEMORY.dfcStructure->patterns->dfcMatchList};
+
+  return DFC_SearchBatched(read, matches, MATCH_BATCH_SIZE,
+                           deliverMatchesOneByOne, &delivery);
+}
 
-    DfcMemoryRequirements requirements = {
-        .patternCount = patterns->numPatterns,
-        .ctSmallPidCount = ctSmallPidCount,
-        .ctLargeEntryCount = ctLargeEntryCount,
-        .ctLargePidCount = ctLargePidCount};
-    allocateDfcStructure(requirements);
+static MatchBatch createMatchBatch(DFC_MATCH *matchBuffer, int matchBufferSize,
+                                   MatchBatchFunction onMatches,
+                                   void *userData) {
+  if (!matchBuffer || matchBufferSize < 1) {
+    fprintf(stderr, "The match buffer must hold at least one match\n");
+    exit(INVALID_MATCH_BUFFER_EXIT_CODE);
   }
 
-  DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
+  MatchBatch batch = {.matches = matchBuffer,
+                      .capacity = matchBufferSize,
+                      .matchCount = 0,
+                      .onMatches = onMatches,
+                      .userData = userData,
+                      .chunkOffset = 0};
+  return batch;
+}
 
-  setupDirectFilters(dfc, patterns);
-  setupMatchList(patterns, dfc->patterns);
+int DFC_SearchBatched(ReadFunction read, DFC_MATCH *matchBuffer,
+                      int matchBufferSize, MatchBatchFunction onMatches,
+                      void *userData) {
+  MatchBatch batch =
+      createMatchBatch(matchBuffer, matchBufferSize, onMatches, userData);
 
-  flattenSmallCt(ctSmall, dfc->ctSmallEntries, dfc->ctSmallPids);
-  flattenLargeCt(ctLarge, dfc->ctLargeBuckets, dfc->ctLargeEntries,
-                 dfc->ctLargePids);
+  int matches = search(read, &batch);
+  flushMatchBatch(&batch);
 
-  freeDynamicSmallCt(ctSmall);
-  freeDynamicLargeCt(ctLarge);
+  return matches;
+}
 
-  if (shouldUseOpenCl()) {
-    prepareOpenClBuffersForSearch();
-  }
+DFC_FIXED_PATTERN *DFC_GetPattern(PID_TYPE pid) {
+  return DFC_GetPatternOf(DFC_HOST_MEMORY.dfcStructure, pid);
+}
 
-  stopTimer(TIMER_COMPILE_DFC);
+unsigned char *DFC_GetPatternBytes(DFC_FIXED_PATTERN *pattern) {
+  return DFC_GetPatternBytesOf(DFC_HOST_MEMORY.dfcStructure, pattern);
+}
 
-  return dfc;
+PID_TYPE *DFC_GetExternalIds(DFC_FIXED_PATTERN *pattern) {
+  return DFC_GetExternalIdsOf(DFC_HOST_MEMORY.dfcStructure, pattern);
 }
 
-int DFC_Search(ReadFunction read, MatchFunction onMatch) {
-  return search(read, onMatch);
+DFC_FIXED_PATTERN *DFC_GetPatternOf(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  return &dfc->patterns->dfcMatchList[pid];
 }
 
-static void *DFC_REALLOC(void *p, uint16_t n, dfcDataType type) {
-  switch (type) {
-    case DFC_PID_TYPE:
-      p = realloc((PID_TYPE *)p, sizeof(PID_TYPE) * n);
-      return p;
-    default:
-      fprintf(stderr, "ERROR! Data Type is not correct!\n");
-      break;
-  }
-  return NULL;
+unsigned char *DFC_GetPatternBytesOf(DFC_STRUCTURE *dfc,
+                                     DFC_FIXED_PATTERN *pattern) {
+  return dfc->patterns->patternBytes + pattern->pattern_offset +
+         2 * pattern->pattern_length;
 }
 
-static void *DFC_MALLOC(int n) {
-  void *p = calloc(1, n);  // initialize it to 0
-  return p;
+PID_TYPE *DFC_GetExternalIdsOf(DFC_STRUCTURE *dfc,
+                               DFC_FIXED_PATTERN *pattern) {
+  return dfc->patterns->externalIds + pattern->external_id_offset;
 }
 
-static inline uint32_t DFC_InitHashRaw(uint8_t *pat, uint16_t patlen) {
-  uint32_t hash = patlen * pat[0];
-  if (patlen > 1) hash += pat[1];
+DFC_STREAM *DFC_StreamOpen(DFC_MATCH *matchBuffer, int matchBufferSize,
+                           MatchBatchFunction onMatches, void *userData) {
+  return openStream(
+      DFC_HOST_MEMORY.dfcStructure,
+      createMatchBatch(matchBuffer, matchBufferSize, onMatches, userData));
+}
 
-  return (hash % INIT_HASH_SIZE);
+int DFC_StreamWrite(DFC_STREAM *stream, const unsigned char *data,
+                    int length) {
+  return writeToStream(stream, data, length);
 }
 
-static inline DFC_PATTERN *DFC_InitHashLookup(DFC_PATTERN_INIT *ctx,
-                                              uint8_t *pat, uint16_t patlen) {
-  uint32_t hash = DFC_InitHashRaw(pat, patlen);
+int DFC_StreamClose(DFC_STREAM *stream) { return closeStream(stream); }
 
-  if (ctx->init_hash == NULL) {
-    return NULL;
-  }
+DFC_SCRATCH *DFC_AllocateScratch() { return allocateScratch(); }
 
-  DFC_PATTERN *t = ctx->init_hash[hash];
-  for (; t != NULL; t = t->next) {
-    if (t->n == patlen && memcmp(t->casepatrn, pat, patlen) == 0) {
-      return t;
-    }
-  }
+void DFC_FreeScratch(DFC_SCRATCH *scratch) { free(scratch); }
 
-  return NULL;
+int DFC_SearchWithScratch(DFC_STRUCTURE *dfc, DFC_SCRATCH *scratch,
+                          const unsigned char *input, int length,
+                          MatchBatchFunction onMatches, void *userData) {
+  return searchWithScratch(dfc, scratch, input, length, onMatches, userData);
 }
 
-static inline int DFC_InitHashAdd(DFC_PATTERN_INIT *ctx, DFC_PATTERN *p) {
-  uint32_t hash = DFC_InitHashRaw(p->casepatrn, p->n);
+DFC_PUBLISHER *DFC_CreatePublisher(DFC_STRUCTURE *dfc) {
+  return createPublisher(dfc);
+}
 
-  if (ctx->init_hash == NULL) {
-    return 0;
-  }
+void DFC_Publish(DFC_PUBLISHER *publisher, DFC_STRUCTURE *dfc) {
+  publishStructure(publisher, dfc);
+}
 
-  if (ctx->init_hash[hash] == NULL) {
-    ctx->init_hash[hash] = p;
-    return 0;
-  }
+DFC_STRUCTURE *DFC_AcquireStructure(DFC_PUBLISHER *publisher) {
+  return acquireStructure(publisher);
+}
 
-  DFC_PATTERN *tt = NULL;
-  DFC_PATTERN *t = ctx->init_hash[hash];
+void DFC_ReleaseStructure(DFC_STRUCTURE *dfc) { releaseStructure(dfc); }
 
-  /* get the list tail */
-  do {
-    tt = t;
-    t = t->next;
-  } while (t != NULL);
+void DFC_FreePublisher(DFC_PUBLISHER *publisher) { freePublisher(publisher); }
 
-  tt->next = p;
+static void *DFC_MALLOC(int n) {
+  void *p = calloc(1, n);  // initialize it to 0
+  return p;
+}
 
-  return 0;
+static uint8_t getVerifier(int patternLength) {
+  if (patternLength <= 8) {
+    return VERIFY_UP_TO_8;
+  }
+  if (patternLength <= 16) {
+    return VERIFY_UP_TO_16;
+  }
+  if (patternLength <= 32) {
+    return VERIFY_UP_TO_32;
+  }
+  return VERIFY_LONGER;
 }
 
-static DFC_FIXED_PATTERN createFixed(DFC_PATTERN *original) {
+static DFC_FIXED_PATTERN createFixed(DFC_PATTERN *original,
+                                     DFC_PATTERNS *patterns,
+                                     uint32_t patternOffset,
+                                     uint32_t externalIdOffset) {
   if (original->n > MAX_PATTERN_LENGTH) {
     fprintf(stderr,
             "Pattern %d \"%s\" is too long with length %d. Please remove it or "
@@ -386,63 +1082,69 @@ static DFC_FIXED_PATTERN createFixed(DFC_PATTERN *original) {
     exit(TOO_MANY_EQUAL_PATTERNS_EXIT_CODE);
   }
 
+  // no padding left uninitialized, so that saved structures are reproducible
   DFC_FIXED_PATTERN new;
+  memset(&new, 0, sizeof(new));
 
   new.pattern_length = original->n;
   new.is_case_insensitive = original->is_case_insensitive;
+  new.verifier = getVerifier(original->n);
+  new.fragment_offset = original->fragment_offset;
+  new.pattern_offset = patternOffset;
+  new.external_id_offset = externalIdOffset;
+
+  uint8_t *folded = patterns->patternBytes + patternOffset;
+  uint8_t *mask = folded + original->n;
+  uint8_t *casePattern = folded + 2 * original->n;
 
   for (int i = 0; i < original->n; ++i) {
-    new.upper_case_pattern[i] = original->patrn[i];
-    new.original_pattern[i] = original->casepatrn[i];
+    casePattern[i] = original->casepatrn[i];
+
+    if (original->is_case_insensitive && isalpha(original->casepatrn[i])) {
+      folded[i] = tolower(original->casepatrn[i]);
+      mask[i] = 0x20;
+    } else {
+      folded[i] = original->casepatrn[i];
+      mask[i] = 0;
+    }
   }
 
   new.external_id_count = original->sids_size;
-  for (uint32_t i = 0; i < original->sids_size; ++i) {
-    new.external_ids[i] = original->sids[i];
-  }
+  memcpy(patterns->externalIds + externalIdOffset, original->sids,
+         sizeof(PID_TYPE) * original->sids_size);
 
   return new;
 }
 
-static void setupPatternListFromHash(DFC_PATTERN_INIT *init) {
-  int begin_node_flag = 1;
-  for (int i = 0; i < INIT_HASH_SIZE; i++) {
-    DFC_PATTERN *node = init->init_hash[i], *prev_node;
-    int first_node_flag = 1;
-    while (node != NULL) {
-      if (begin_node_flag) {
-        begin_node_flag = 0;
-        init->dfcPatterns = node;
-      } else {
-        if (first_node_flag) {
-          first_node_flag = 0;
-          prev_node->next = node;
-        }
-      }
-      prev_node = node;
-      node = node->next;
-    }
+// the patterns of the slice of the thread
+static void setupMatchList(CompileJob *job, int threadIndex) {
+  DFC_PATTERNS *patterns = job->dfc->patterns;
+
+  int begin = sliceStart(job->patternCount, job->threadCount, threadIndex);
+  int end = sliceStart(job->patternCount, job->threadCount, threadIndex + 1);
+  for (int i = begin; i < end; ++i) {
+    DFC_PATTERN *pattern = job->patterns[i];
+    patterns->dfcMatchList[pattern->iid] =
+        createFixed(pattern, patterns, job->patternOffsets[i],
+                    job->externalIdOffsets[i]);
   }
 }
 
-static void setupMatchList(DFC_PATTERN_INIT *init, DFC_PATTERNS *patterns) {
-  patterns->numPatterns = init->numPatterns;
+// sets the bits of the slice of the thread in its own filters
+static void setupDirectFilters(CompileJob *job, int threadIndex) {
+  uint8_t **filters = job->threadFilters + threadIndex * DIRECT_FILTER_COUNT;
+  FilterBits filterBits[2];
 
-  for (DFC_PATTERN *plist = init->dfcPatterns; plist != NULL;
-       plist = plist->next) {
-    patterns->dfcMatchList[plist->iid] = createFixed(plist);
-  }
-}
+  int begin = sliceStart(job->patternCount, job->threadCount, threadIndex);
+  int end = sliceStart(job->patternCount, job->threadCount, threadIndex + 1);
+  for (int i = begin; i < end; ++i) {
+    int filterCount = collectFilterBits(job->dfc, job->patterns[i], filterBits);
 
-static void setupDirectFilters(DFC_STRUCTURE *dfc, DFC_PATTERN_INIT *patterns) {
-  for (DFC_PATTERN *plist = patterns->dfcPatterns; plist != NULL;
-       plist = plist->next) {
-    if (plist->n >= SMALL_DF_MIN_PATTERN_SIZE &&
-        plist->n <= SMALL_DF_MAX_PATTERN_SIZE) {
-      addPatternToSmallDirectFilter(dfc, plist);
-    } else {
-      addPatternToLargeDirectFilter(dfc, plist);
-      addPatternToLargeDirectFilterHash(dfc, plist);
+    for (int j = 0; j < filterCount; ++j) {
+      uint8_t *df = filters[filterBits[j].filter];
+      for (int k = 0; k < filterBits[j].bitCount; ++k) {
+        df[BINDEX(filterBits[j].bits[k])] |= BMASK(filterBits[j].bits[k]);
+      }
     }
   }
 }
@@ -467,26 +1169,29 @@ static void createPermutations(uint8_t *pattern, int patternLength,
   free(shouldToggleCase);
 }
 
-static void maskPatternIntoDirectFilter(uint8_t *df, uint8_t *pattern) {
+static void addFilterBit(FilterBits *filterBits, uint32_t bit) {
+  filterBits->bits[filterBits->bitCount++] = bit;
+}
+
+static void maskPatternIntoDirectFilter(FilterBits *filterBits,
+                                        uint8_t *pattern) {
   uint16_t fragment_16 = (pattern[1] << 8) | pattern[0];
-  uint16_t byteIndex = BINDEX(fragment_16 & DF_MASK);
-  uint16_t bitMask = BMASK(fragment_16 & DF_MASK);
 
-  df[byteIndex] |= bitMask;
+  addFilterBit(filterBits, fragment_16 & DF_MASK);
 }
 
-static void add1BPatternToSmallDirectFilter(DFC_STRUCTURE *dfc,
+static void add1BPatternToSmallDirectFilter(FilterBits *filterBits,
                                             uint8_t pattern) {
   uint8_t newPattern[2];
   newPattern[0] = pattern;
   for (int j = 0; j < 256; j++) {
     newPattern[1] = j;
 
-    maskPatternIntoDirectFilter(dfc->directFilterSmall, newPattern);
+    maskPatternIntoDirectFilter(filterBits, newPattern);
   }
 }
 
-static void addPatternToDirectFilter(uint8_t *directFilter,
+static void addPatternToDirectFilter(FilterBits *filterBits,
                                      bool isCaseInsensitive, uint8_t *pattern,
                                      int patternLength) {
   if (isCaseInsensitive) {
@@ -498,52 +1203,76 @@ static void addPatternToDirectFilter(uint8_t *directFilter,
                        patternPermutations);
 
     for (int i = 0; i < permutationCount; ++i) {
-      maskPatternIntoDirectFilter(directFilter,
+      maskPatternIntoDirectFilter(filterBits,
                                   patternPermutations + (i * patternLength));
     }
 
     free(patternPermutations);
   } else {
-    maskPatternIntoDirectFilter(directFilter, pattern);
+    maskPatternIntoDirectFilter(filterBits, pattern);
   }
 }
 
-static void addLongerPatternToSmallDirectFilter(DFC_STRUCTURE *dfc,
+static void addLongerPatternToSmallDirectFilter(FilterBits *filterBits,
                                                 DFC_PATTERN *pattern) {
-  addPatternToDirectFilter(dfc->directFilterSmall, pattern->is_case_insensitive,
+  addPatternToDirectFilter(filterBits, pattern->is_case_insensitive,
                            pattern->casepatrn, 2);
 }
 
-static void addPatternToSmallDirectFilter(DFC_STRUCTURE *dfc,
+static void addPatternToSmallDirectFilter(FilterBits *filterBits,
                                           DFC_PATTERN *pattern) {
   assert(pattern->n >= SMALL_DF_MIN_PATTERN_SIZE);
   assert(pattern->n <= SMALL_DF_MAX_PATTERN_SIZE);
 
   if (pattern->n == 1) {
-    add1BPatternToSmallDirectFilter(dfc, pattern->casepatrn[0]);
+    uint8_t character = pattern->casepatrn[0];
+    uint8_t toggled = toggleCharacterCase(character);
+    add1BPatternToSmallDirectFilter(filterBits, character);
+
+    // the small compact table holds the byte in both cases as well
+    if (pattern->is_case_insensitive && toggled != character) {
+      add1BPatternToSmallDirectFilter(filterBits, toggled);
+    }
   } else {
-    addLongerPatternToSmallDirectFilter(dfc, pattern);
+    addLongerPatternToSmallDirectFilter(filterBits, pattern);
   }
 }
 
-static void addPatternToLargeDirectFilter(DFC_STRUCTURE *dfc,
+static void addPatternToLargeDirectFilter(FilterBits *filterBits,
                                           DFC_PATTERN *pattern) {
   assert(pattern->n > SMALL_DF_MAX_PATTERN_SIZE);
 
-  addPatternToDirectFilter(dfc->directFilterLarge, pattern->is_case_insensitive,
-                           pattern->casepatrn, 2);
+  addPatternToDirectFilter(filterBits, pattern->is_case_insensitive,
+                           getFragment(pattern), 2);
+}
+
+static void maskPatternIntoBloomFilter(FilterBits *filterBits, int bits,
+                                       uint32_t data) {
+  uint64_t hash = bloomFilterHash(data);
+  uint32_t block = 8 * bloomFilterBlockOffset(hash, bits);
+
+  for (int j = 0; j < BLOOM_FILTER_HASH_COUNT; ++j) {
+    addFilterBit(filterBits, block + bloomFilterBit(hash, j));
+  }
 }
 
-static void maskPatternIntoDirectFilterHash(uint8_t *df, uint8_t *pattern) {
+static void maskPatternIntoDirectFilterHash(FilterBits *filterBits, int bits,
+                                            uint8_t *pattern) {
   uint32_t data =
       pattern[3] << 24 | pattern[2] << 16 | pattern[1] << 8 | pattern[0];
-  uint16_t byteIndex = directFilterHash(data);
-  uint16_t bitMask = BMASK(data & DF_MASK);
 
-  df[byteIndex] |= bitMask;
+  if (BLOCKED_BLOOM_FILTER) {
+    maskPatternIntoBloomFilter(filterBits, bits, data);
+    return;
+  }
+
+  uint32_t byteIndex = directFilterHash(data, bits);
+
+  addFilterBit(filterBits, 8 * byteIndex + (data & 0x7));
 }
 
 static void addPatternToLargeDirectFilterHash(DFC_STRUCTURE *dfc,
+                                              FilterBits *filterBits,
                                               DFC_PATTERN *pattern) {
   int patternLength = 4;
   assert(pattern->n >= patternLength);
@@ -553,53 +1282,111 @@ static void addPatternToLargeDirectFilterHash(DFC_STRUCTURE *dfc,
     uint8_t *patternPermutations =
         (uint8_t *)malloc(permutationCount * patternLength);
 
-    createPermutations(pattern->casepatrn, patternLength, permutationCount,
+    createPermutations(getFragment(pattern), patternLength, permutationCount,
                        patternPermutations);
 
     for (int i = 0; i < permutationCount; ++i) {
       maskPatternIntoDirectFilterHash(
-          dfc->directFilterLargeHash,
+          filterBits, dfc->sizes.dfLargeHashBits,
           patternPermutations + (i * patternLength));
     }
 
     free(patternPermutations);
   } else {
-    maskPatternIntoDirectFilterHash(dfc->directFilterLargeHash,
-                                    pattern->casepatrn);
+    maskPatternIntoDirectFilterHash(filterBits, dfc->sizes.dfLargeHashBits,
+                                    getFragment(pattern));
   }
 }
 
-static void pushPatternToSmallCompactTable(DynamicCtSmallEntry *ct,
+// the large and long patterns are keyed on the bytes starting here
+static uint8_t *getFragment(DFC_PATTERN *pattern) {
+  return pattern->casepatrn + pattern->fragment_offset;
+}
+
+static uint64_t getLongFragment(DFC_PATTERN *pattern) {
+  assert(pattern->n >= LONG_DF_MIN_PATTERN_SIZE);
+
+  uint64_t fragment;
+  memcpy(&fragment, getFragment(pattern), sizeof(fragment));
+
+  return foldLongFragment(fragment);
+}
+
+static void addPatternToLongDirectFilterHash(DFC_STRUCTURE *dfc,
+                                             FilterBits *filterBits,
+                                             DFC_PATTERN *pattern) {
+  addFilterBit(filterBits, directFilterLongHash(getLongFragment(pattern),
+                                                dfc->sizes.dfLongHashBits));
+}
+
+static void startFilterBits(FilterBits *filterBits, int filter) {
+  filterBits->filter = filter;
+  filterBits->bitCount = 0;
+}
+
+/*
+ * The bits the pattern sets in the small filter, or in the large filter and
+ * one of the hash filters, returns the amount of filters. The bits are
+ * distinct, so that the patterns are counted once per bit when updating.
+ */
+static int collectFilterBits(DFC_STRUCTURE *dfc, DFC_PATTERN *pattern,
+                             FilterBits *filterBits) {
+  if (pattern->n >= SMALL_DF_MIN_PATTERN_SIZE &&
+      pattern->n <= SMALL_DF_MAX_PATTERN_SIZE) {
+    startFilterBits(filterBits, TABLE_DF_SMALL);
+    addPatternToSmallDirectFilter(filterBits, pattern);
+    filterBits->bitCount = uniqueKeys(filterBits->bits, filterBits->bitCount);
+
+    return 1;
+  }
+
+  // the long patterns share the 2 byte filter with the large ones
+  startFilterBits(filterBits, TABLE_DF_LARGE);
+  addPatternToLargeDirectFilter(filterBits, pattern);
+
+  if (pattern->n >= LONG_DF_MIN_PATTERN_SIZE) {
+    startFilterBits(filterBits + 1, TABLE_DF_LONG_HASH);
+    addPatternToLongDirectFilterHash(dfc, filterBits + 1, pattern);
+  } else {
+    startFilterBits(filterBits + 1, TABLE_DF_LARGE_HASH);
+    addPatternToLargeDirectFilterHash(dfc, filterBits + 1, pattern);
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    filterBits[i].bitCount =
+        uniqueKeys(filterBits[i].bits, filterBits[i].bitCount);
+  }
+
+  return 2;
+}
+
+static void pushPatternToSmallCompactTable(Arena *arena,
+                                           DynamicCtSmallEntry *ct,
                                            uint8_t pattern, PID_TYPE pid) {
   DynamicCtSmallEntry *entry = &ct[pattern];
 
   entry->pattern = pattern;
-  entry->pids = realloc(entry->pids, (entry->pidCount + 1) * sizeof(PID_TYPE));
-  if (!entry->pids) {
-    fprintf(stderr, "Could not allocate memory for dynamic CT");
-    exit(1);
-  }
-
+  entry->pids = growArrayInArena(arena, entry->pids, entry->pidCount,
+                                 sizeof(PID_TYPE));
   entry->pids[entry->pidCount] = pid;
   ++entry->pidCount;
 }
 
-static void addPatternToSmallCompactTable(DynamicCtSmallEntry *ct,
-                                          DFC_PATTERN *pattern) {
+// the keys of a small pattern in the small compact table, its first byte in
+// both cases if it is case insensitive and a letter
+static int collectSmallCompactTableKeys(DFC_PATTERN *pattern, uint8_t *keys) {
   assert(pattern->n >= SMALL_DF_MIN_PATTERN_SIZE);
   assert(pattern->n <= SMALL_DF_MAX_PATTERN_SIZE);
 
-  uint8_t character = pattern->casepatrn[0];
-  pushPatternToSmallCompactTable(ct, character, pattern->iid);
+  keys[0] = pattern->casepatrn[0];
+  keys[1] = toggleCharacterCase(keys[0]);
 
-  if (pattern->is_case_insensitive) {
-    pushPatternToSmallCompactTable(ct, toggleCharacterCase(character),
-                                   pattern->iid);
-  }
+  return pattern->is_case_insensitive && keys[1] != keys[0] ? 2 : 1;
 }
 
 static DynamicCtLargeEntry *getEmptyOrEqualLargeCompactTableEntry(
-    uint32_t pattern, int *entryCount, DynamicCtLargeEntry **entry) {
+    Arena *arena, uint32_t pattern, int *entryCount,
+    DynamicCtLargeEntry **entry) {
   int entryIndex = 0;
   while (entryIndex < *entryCount && (*entry + entryIndex)->pidCount &&
          (*entry + entryIndex)->pattern != pattern) {
@@ -607,13 +1394,9 @@ static DynamicCtLargeEntry *getEmptyOrEqualLargeCompactTableEntry(
   }
 
   if (entryIndex == *entryCount) {
+    *entry = growArrayInArena(arena, *entry, *entryCount,
+                              sizeof(DynamicCtLargeEntry));
     ++(*entryCount);
-    *entry = realloc(*entry, (*entryCount) * sizeof(DynamicCtLargeEntry));
-
-    if (!*entry) {
-      fprintf(stderr, "Could not allocate dynamic large CT");
-      exit(1);
-    }
 
     (*entry + entryIndex)->pidCount = 0;
     (*entry + entryIndex)->pids = NULL;
@@ -632,73 +1415,112 @@ static bool hasPid(DynamicCtLargeEntry *entry, PID_TYPE pid) {
   return false;
 }
 
-static void pushPatternToLargeCompactTable(DynamicCtLarge *ct, uint32_t pattern,
-                                           PID_TYPE pid) {
-  uint32_t hash = hashForLargeCompactTable(pattern);
+static void pushPatternToLargeCompactTable(Arena *arena, DynamicCtLarge *ct,
+                                           DFC_TABLE_SIZES *sizes,
+                                           uint32_t pattern, PID_TYPE pid) {
+  uint32_t hash =
+      hashForLargeCompactTable(pattern, sizes->ctLargeHashMultiplier,
+                               sizes->ctLargeHashShift, sizes->ctLargeBits);
   DynamicCtLarge *bucket = &ct[hash];
   DynamicCtLargeEntry *entry = getEmptyOrEqualLargeCompactTableEntry(
-      pattern, &bucket->entryCount, &bucket->entries);
+      arena, pattern, &bucket->entryCount, &bucket->entries);
 
   if (!hasPid(entry, pid)) {
     entry->pattern = pattern;
-    entry->pids =
-        realloc(entry->pids, (entry->pidCount + 1) * sizeof(PID_TYPE));
-
-    if (!entry->pids) {
-      fprintf(stderr, "Could not allocate memory for large dynamic CT");
-      exit(1);
-    }
-
+    entry->pids = growArrayInArena(arena, entry->pids, entry->pidCount,
+                                   sizeof(PID_TYPE));
     entry->pids[entry->pidCount] = pid;
     ++entry->pidCount;
   }
 }
 
-static void addPatternToLargeCompactTable(DynamicCtLarge *ct,
-                                          DFC_PATTERN *pattern) {
-  int patternLength = SMALL_DF_MAX_PATTERN_SIZE + 1;
-  assert(pattern->n >= patternLength);
+static DynamicCtLongEntry *getEmptyOrEqualLongCompactTableEntry(
+    Arena *arena, uint64_t pattern, DynamicCtLong *bucket) {
+  for (int i = 0; i < bucket->entryCount; ++i) {
+    if (bucket->entries[i].pattern == pattern) {
+      return bucket->entries + i;
+    }
+  }
 
-  uint8_t *firstCharactersOfPattern = pattern->casepatrn;
+  bucket->entries = growArrayInArena(arena, bucket->entries,
+                                     bucket->entryCount,
+                                     sizeof(DynamicCtLongEntry));
+  ++bucket->entryCount;
 
-  if (pattern->is_case_insensitive) {
-    int permutationCount = 2 << (patternLength - 1);
-    uint8_t *patternPermutations =
-        (uint8_t *)malloc(permutationCount * patternLength);
+  DynamicCtLongEntry *entry = bucket->entries + bucket->entryCount - 1;
+  entry->pattern = pattern;
+  entry->pidCount = 0;
+  entry->pids = NULL;
 
-    createPermutations(firstCharactersOfPattern, patternLength,
-                       permutationCount, patternPermutations);
+  return entry;
+}
 
-    for (int i = 0; i < permutationCount; ++i) {
-      uint32_t data = patternPermutations[i * patternLength + 3] << 24 |
-                      patternPermutations[i * patternLength + 2] << 16 |
-                      patternPermutations[i * patternLength + 1] << 8 |
-                      patternPermutations[i * patternLength + 0];
-      pushPatternToLargeCompactTable(ct, data, pattern->iid);
-    }
+static void pushPatternToLongCompactTable(Arena *arena, DynamicCtLong *bucket,
+                                          uint64_t fragment,
+                                          DFC_PATTERN *pattern) {
+  DynamicCtLongEntry *entry =
+      getEmptyOrEqualLongCompactTableEntry(arena, fragment, bucket);
 
-    free(patternPermutations);
-  } else {
-    uint32_t data =
-        firstCharactersOfPattern[3] << 24 | firstCharactersOfPattern[2] << 16 |
-        firstCharactersOfPattern[1] << 8 | firstCharactersOfPattern[0];
-    pushPatternToLargeCompactTable(ct, data, pattern->iid);
-  }
+  // the fragment is case folded, so every pattern is added exactly once
+  entry->pids = growArrayInArena(arena, entry->pids, entry->pidCount,
+                                 sizeof(PID_TYPE));
+
+  entry->pids[entry->pidCount] = pattern->iid;
+  ++entry->pidCount;
 }
 
-static void setupCompactTables(DFC_PATTERN_INIT *patterns,
-                               DynamicCtSmallEntry **ctSmall,
-                               DynamicCtLarge **ctLarge) {
-  *ctSmall = calloc(1, COMPACT_TABLE_SIZE_SMALL * sizeof(DynamicCtSmallEntry));
-  *ctLarge = calloc(1, COMPACT_TABLE_SIZE_LARGE * sizeof(DynamicCtLarge));
+// the thread owning a bucket is the only one adding to it
+static bool ownsBucket(CompileJob *job, int threadIndex, uint32_t bucket,
+                       int bucketCount) {
+  return (int)((uint64_t)bucket * job->threadCount / bucketCount) ==
+         threadIndex;
+}
 
-  for (DFC_PATTERN *plist = patterns->dfcPatterns; plist != NULL;
-       plist = plist->next) {
-    if (plist->n >= SMALL_DF_MIN_PATTERN_SIZE &&
-        plist->n <= SMALL_DF_MAX_PATTERN_SIZE) {
-      addPatternToSmallCompactTable(*ctSmall, plist);
+/*
+ * Every thread walks all patterns in the order of the list and adds those
+ * keyed to its buckets, so the tables are the same for any thread count
+ */
+static void setupCompactTables(CompileJob *job, int threadIndex) {
+  Arena *arena = job->arenas + threadIndex;
+  DFC_TABLE_SIZES *sizes = &job->sizes;
+  int ctLargeBucketCount = 1 << sizes->ctLargeBits;
+  int ctLongBucketCount = 1 << sizes->ctLongBits;
+
+  for (int i = 0; i < job->patternCount; ++i) {
+    DFC_PATTERN *pattern = job->patterns[i];
+
+    if (pattern->n >= SMALL_DF_MIN_PATTERN_SIZE &&
+        pattern->n <= SMALL_DF_MAX_PATTERN_SIZE) {
+      uint8_t keys[2];
+      int keyCount = collectSmallCompactTableKeys(pattern, keys);
+
+      for (int j = 0; j < keyCount; ++j) {
+        if (ownsBucket(job, threadIndex, keys[j], COMPACT_TABLE_SIZE_SMALL)) {
+          pushPatternToSmallCompactTable(arena, job->ctSmall, keys[j],
+                                         pattern->iid);
+        }
+      }
+    } else if (pattern->n >= LONG_DF_MIN_PATTERN_SIZE) {
+      uint64_t fragment = getLongFragment(pattern);
+      uint32_t bucket = hashForLongCompactTable(fragment, sizes->ctLongBits);
+
+      if (ownsBucket(job, threadIndex, bucket, ctLongBucketCount)) {
+        pushPatternToLongCompactTable(arena, job->ctLong + bucket, fragment,
+                                      pattern);
+      }
     } else {
-      addPatternToLargeCompactTable(*ctLarge, plist);
+      for (int j = job->largeKeyOffsets[i]; j < job->largeKeyOffsets[i + 1];
+           ++j) {
+        uint32_t key = job->largeKeys[j];
+        uint32_t bucket = hashForLargeCompactTable(
+            key, sizes->ctLargeHashMultiplier, sizes->ctLargeHashShift,
+            sizes->ctLargeBits);
+
+        if (ownsBucket(job, threadIndex, bucket, ctLargeBucketCount)) {
+          pushPatternToLargeCompactTable(arena, job->ctLarge, sizes, key,
+                                         pattern->iid);
+        }
+      }
     }
   }
 }
@@ -711,3 +1533,380 @@ static uint8_t toggleCharacterCase(uint8_t character) {
   }
   return character;
 }
+
+/*
+ * Updates of a compiled structure
+ *
+ * The patterns are turned back into a DFC_PATTERN, so that an update sets
+ * and clears the same filter bits and compact table keys as the compilation.
+ */
+static DFC_PATTERN patternOf(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  DFC_FIXED_PATTERN *fixed = DFC_GetPatternOf(dfc, pid);
+
+  DFC_PATTERN pattern = {
+      .casepatrn = DFC_GetPatternBytesOf(dfc, fixed),
+      .n = fixed->pattern_length,
+      .is_case_insensitive = fixed->is_case_insensitive,
+      .iid = pid,
+      .fragment_offset = fixed->fragment_offset};
+
+  return pattern;
+}
+
+static void countPairsOfPattern(uint32_t *frequencies, DFC_PATTERN *pattern,
+                                int delta) {
+  uint8_t folded[MAX_PATTERN_LENGTH];
+  for (int i = 0; i < pattern->n; ++i) {
+    folded[i] = toupper(pattern->casepatrn[i]);
+  }
+
+  countPairsOf(frequencies, folded, pattern->n, delta);
+}
+
+// the reference counts and index are only built once they are needed
+static void prepareUpdates(DFC_STRUCTURE *dfc) {
+  if (shouldUseMappedMemory()) {
+    fprintf(stderr,
+            "The tables are mapped from OpenCL buffers with MAP_MEMORY, so "
+            "patterns cannot be added to or removed from a compiled "
+            "structure\n");
+    exit(STRUCTURE_CANNOT_BE_UPDATED_EXIT_CODE);
+  }
+
+  if (hasStartedUpdates(dfc)) {
+    return;
+  }
+  startUpdates(dfc);
+
+  FilterBits filterBits[2];
+  for (int pid = 0; pid < dfc->patterns->numPatterns; ++pid) {
+    // removed before the structure was saved
+    if (!DFC_GetPatternOf(dfc, pid)->external_id_count) {
+      releasePid(dfc, pid);
+      continue;
+    }
+
+    DFC_PATTERN pattern = patternOf(dfc, pid);
+
+    int filterCount = collectFilterBits(dfc, &pattern, filterBits);
+    for (int i = 0; i < filterCount; ++i) {
+      countFilterBits(dfc, filterBits + i);
+    }
+
+    indexPattern(dfc, pid);
+
+    if (RAREST_FRAGMENT) {
+      countPairsOfPattern(dfc->updates->pairFrequencies, &pattern, 1);
+    }
+  }
+}
+
+// adds the pattern to the filters and compact tables, or removes it from
+// them if delta is -1
+static void updateTables(DFC_STRUCTURE *dfc, DFC_PATTERN *pattern,
+                         int delta) {
+  FilterBits filterBits[2];
+  int filterCount = collectFilterBits(dfc, pattern, filterBits);
+  for (int i = 0; i < filterCount; ++i) {
+    referenceFilterBits(dfc, filterBits + i, delta);
+  }
+
+  PID_TYPE pid = pattern->iid;
+  if (pattern->n >= SMALL_DF_MIN_PATTERN_SIZE &&
+      pattern->n <= SMALL_DF_MAX_PATTERN_SIZE) {
+    uint8_t keys[2];
+    int keyCount = collectSmallCompactTableKeys(pattern, keys);
+
+    for (int i = 0; i < keyCount; ++i) {
+      if (delta > 0) {
+        addToSmallCompactTable(dfc, keys[i], pid);
+      } else {
+        removeFromSmallCompactTable(dfc, keys[i], pid);
+      }
+    }
+  } else if (pattern->n >= LONG_DF_MIN_PATTERN_SIZE) {
+    uint64_t key = getLongFragment(pattern);
+
+    if (delta > 0) {
+      addToLongCompactTable(dfc, key, pid);
+    } else {
+      removeFromLongCompactTable(dfc, key, pid);
+    }
+  } else {
+    uint32_t keys[LARGE_FRAGMENT_PERMUTATIONS];
+    int keyCount = collectLargeCompactTableKeys(pattern, keys);
+
+    for (int i = 0; i < keyCount; ++i) {
+      if (delta > 0) {
+        addToLargeCompactTable(dfc, keys[i], pid);
+      } else {
+        removeFromLargeCompactTable(dfc, keys[i], pid);
+      }
+    }
+  }
+}
+
+void DFC_AddPatternTo(DFC_STRUCTURE *dfc, unsigned char *pat, int n,
+                      int is_case_insensitive, PID_TYPE sid) {
+  prepareUpdates(dfc);
+
+  dfc->patternHash = 0;
+
+  int existing = findPattern(dfc, pat, n);
+  if (existing >= 0) {
+    addExternalId(dfc, existing, sid);
+    uploadUpdates(dfc);
+    return;
+  }
+
+  if (n > MAX_PATTERN_LENGTH) {
+    fprintf(stderr,
+            "Pattern is too long with length %d. Please remove it or increase "
+            "MAX_PATTERN_LENGTH. (Currently %d)\n",
+            n, MAX_PATTERN_LENGTH);
+    exit(PATTERN_TOO_LARGE_EXIT_CODE);
+  }
+
+  uint8_t folded[MAX_PATTERN_LENGTH];
+  unsigned char xlatcase[256];
+  init_xlatcase(xlatcase);
+  ConvertCaseEx(folded, pat, n, xlatcase);
+
+  DFC_PATTERN pattern = {.patrn = folded,
+                         .casepatrn = pat,
+                         .n = n,
+                         .is_case_insensitive = is_case_insensitive,
+                         .sids_size = 1,
+                         .sids = &sid,
+                         .iid = takePid(dfc)};
+
+  // the search looks at most maxFragmentOffset bytes before a fragment
+  if (RAREST_FRAGMENT) {
+    countPairsOf(dfc->updates->pairFrequencies, folded, n, 1);
+    if (n > SMALL_DF_MAX_PATTERN_SIZE) {
+      pattern.fragment_offset = chooseFragmentOffset(
+          &pattern, dfc->updates->pairFrequencies, dfc->maxFragmentOffset);
+    }
+  }
+
+  *DFC_GetPatternOf(dfc, pattern.iid) =
+      createFixed(&pattern, dfc->patterns, takePatternBytes(dfc, 3 * n),
+                  takeExternalIds(dfc, 1));
+  markPatternChanged(dfc, pattern.iid);
+  indexPattern(dfc, pattern.iid);
+
+  updateTables(dfc, &pattern, 1);
+  uploadUpdates(dfc);
+}
+
+void DFC_RemovePatternFrom(DFC_STRUCTURE *dfc, unsigned char *pat, int n,
+                           PID_TYPE sid) {
+  prepareUpdates(dfc);
+
+  int pid = findPattern(dfc, pat, n);
+  if (pid < 0 || !removeExternalId(dfc, pid, sid)) {
+    return;
+  }
+  dfc->patternHash = 0;
+
+  if (!DFC_GetPatternOf(dfc, pid)->external_id_count) {
+    DFC_PATTERN pattern = patternOf(dfc, pid);
+    updateTables(dfc, &pattern, -1);
+
+    if (RAREST_FRAGMENT) {
+      countPairsOfPattern(dfc->updates->pairFrequencies, &pattern, -1);
+    }
+
+    unindexPattern(dfc, pid);
+    releasePid(dfc, pid);
+  }
+
+  uploadUpdates(dfc);
+}
+
+/*
+ * Parallel compilation
+ *
+ * The patterns are split into one slice per thread in the order of the list.
+ * The keys of the large compact table, the direct filters and the match list
+ * are built per slice, each thread setting the filter bits in a copy of its
+ * own that are ORed together at the end. The dynamic compact tables are
+ * sharded by bucket instead, see setupCompactTables. Every table comes out
+ * the same as if a single thread had built it.
+ */
+static int sliceStart(int count, int sliceCount, int slice) {
+  return (int)((int64_t)count * slice / sliceCount);
+}
+
+static int chooseCompileThreadCount(int patternCount) {
+  int threadCount = getConfiguredCompileThreadCount();
+  int usefulThreadCount = patternCount / MIN_PATTERNS_PER_COMPILE_THREAD;
+
+  if (usefulThreadCount < threadCount) {
+    threadCount = usefulThreadCount;
+  }
+  return threadCount > 1 ? threadCount : 1;
+}
+
+static void *allocateCompileMemory(size_t size) {
+  void *memory = calloc(1, size > 0 ? size : 1);
+  if (!memory) {
+    fprintf(stderr, "Could not allocate memory to compile the patterns\n");
+    exit(1);
+  }
+
+  return memory;
+}
+
+static int countLargeKeys(DFC_PATTERN *pattern) {
+  if (pattern->n <= SMALL_DF_MAX_PATTERN_SIZE ||
+      pattern->n >= LONG_DF_MIN_PATTERN_SIZE) {
+    return 0;
+  }
+
+  return pattern->is_case_insensitive ? LARGE_FRAGMENT_PERMUTATIONS : 1;
+}
+
+static CompileJob createCompileJob(DFC_PATTERN_INIT *patterns) {
+  CompileJob job;
+  memset(&job, 0, sizeof(job));
+
+  for (DFC_PATTERN *plist = patterns->dfcPatterns; plist != NULL;
+       plist = plist->next) {
+    ++job.patternCount;
+  }
+
+  int count = job.patternCount;
+  job.patterns = allocateCompileMemory(count * sizeof(DFC_PATTERN *));
+  job.largeKeyOffsets = allocateCompileMemory((count + 1) * sizeof(int));
+  job.patternOffsets = allocateCompileMemory((count + 1) * sizeof(uint32_t));
+  job.externalIdOffsets =
+      allocateCompileMemory((count + 1) * sizeof(uint32_t));
+
+  int i = 0;
+  for (DFC_PATTERN *plist = patterns->dfcPatterns; plist != NULL;
+       plist = plist->next, ++i) {
+    job.patterns[i] = plist;
+
+    job.largeKeyOffsets[i + 1] = job.largeKeyOffsets[i] + countLargeKeys(plist);
+    // folded pattern, case mask and original pattern
+    job.patternOffsets[i + 1] = job.patternOffsets[i] + 3 * plist->n;
+    job.externalIdOffsets[i + 1] = job.externalIdOffsets[i] + plist->sids_size;
+  }
+
+  job.largeKeys =
+      allocateCompileMemory(job.largeKeyOffsets[count] * sizeof(uint32_t));
+
+  job.threadCount = chooseCompileThreadCount(count);
+  job.pool = createThreadPool(job.threadCount);
+
+  return job;
+}
+
+static void freeCompileJob(CompileJob *job) {
+  destroyThreadPool(job->pool);
+
+  if (job->threadFilters) {
+    int filterCount = job->threadCount * DIRECT_FILTER_COUNT;
+    for (int i = DIRECT_FILTER_COUNT; i < filterCount; ++i) {
+      free(job->threadFilters[i]);
+    }
+    free(job->threadFilters);
+  }
+
+  if (job->arenas) {
+    for (int i = 0; i < job->threadCount; ++i) {
+      releaseArena(job->arenas + i);
+    }
+    free(job->arenas);
+  }
+
+  free(job->patterns);
+  free(job->largeKeys);
+  free(job->largeKeyOffsets);
+  free(job->patternOffsets);
+  free(job->externalIdOffsets);
+}
+
+static void collectLargeKeysOfSlice(void *argument, int threadIndex) {
+  CompileJob *job = argument;
+
+  int begin = sliceStart(job->patternCount, job->threadCount, threadIndex);
+  int end = sliceStart(job->patternCount, job->threadCount, threadIndex + 1);
+  for (int i = begin; i < end; ++i) {
+    if (countLargeKeys(job->patterns[i])) {
+      collectLargeCompactTableKeys(job->patterns[i],
+                                   job->largeKeys + job->largeKeyOffsets[i]);
+    }
+  }
+}
+
+static void collectLargeKeysInParallel(CompileJob *job) {
+  runOnAllThreads(job->pool, collectLargeKeysOfSlice, job);
+}
+
+static void setupCompactTablesOfShard(void *argument, int threadIndex) {
+  setupCompactTables(argument, threadIndex);
+}
+
+static void setupCompactTablesInParallel(CompileJob *job) {
+  job->arenas = allocateCompileMemory(job->threadCount * sizeof(Arena));
+
+  // the buckets are released with the entries and pids
+  Arena *arena = job->arenas;
+  job->ctSmall = allocateFromArena(
+      arena, COMPACT_TABLE_SIZE_SMALL * sizeof(DynamicCtSmallEntry));
+  job->ctLarge = allocateFromArena(
+      arena, (1 << job->sizes.ctLargeBits) * sizeof(DynamicCtLarge));
+  job->ctLong = allocateFromArena(
+      arena, (1 << job->sizes.ctLongBits) * sizeof(DynamicCtLong));
+
+  runOnAllThreads(job->pool, setupCompactTablesOfShard, job);
+}
+
+static void setupPatternsOfSlice(void *argument, int threadIndex) {
+  setupDirectFilters(argument, threadIndex);
+  setupMatchList(argument, threadIndex);
+}
+
+// ORs the filters of the other threads into those of the structure, each
+// thread merging its share of the bytes
+static void mergeDirectFilters(void *argument, int threadIndex) {
+  CompileJob *job = argument;
+
+  for (int filter = 0; filter < DIRECT_FILTER_COUNT; ++filter) {
+    int byteCount = directFilterBitCount(job->dfc, filter) / 8;
+    int begin = sliceStart(byteCount, job->threadCount, threadIndex);
+    int end = sliceStart(byteCount, job->threadCount, threadIndex + 1);
+
+    uint8_t *df = job->threadFilters[filter];
+    for (int thread = 1; thread < job->threadCount; ++thread) {
+      uint8_t *threadDf =
+          job->threadFilters[thread * DIRECT_FILTER_COUNT + filter];
+      for (int i = begin; i < end; ++i) {
+        df[i] |= threadDf[i];
+      }
+    }
+  }
+}
+
+static void setupPatternsInParallel(CompileJob *job) {
+  job->threadFilters = allocateCompileMemory(
+      job->threadCount * DIRECT_FILTER_COUNT * sizeof(uint8_t *));
+
+  for (int filter = 0; filter < DIRECT_FILTER_COUNT; ++filter) {
+    job->threadFilters[filter] = directFilterOf(job->dfc, filter);
+
+    for (int thread = 1; thread < job->threadCount; ++thread) {
+      job->threadFilters[thread * DIRECT_FILTER_COUNT + filter] =
+          allocateCompileMemory(directFilterBitCount(job->dfc, filter) / 8);
+    }
+  }
+
+  job->dfc->patterns->numPatterns = job->patternCount;
+
+  runOnAllThreads(job->pool, setupPatternsOfSlice, job);
+  if (job->threadCount > 1) {
+    runOnAllThreads(job->pool, mergeDirectFilters, job);
+  }
+}
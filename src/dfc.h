@@ -8,7 +8,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "constants.h"
+#include "pattern-index.h"
+#include "region.h"
 #include "shared.h"
 
 #ifdef __cplusplus
@@ -27,26 +30,79 @@ typedef struct _dfc_pattern {
   PID_TYPE *sids;  // external id (unique)
   PID_TYPE iid;    // internal id (used in DFC library only)
 
+  int fragment_offset;  // see DFC_FIXED_PATTERN
 } DFC_PATTERN;
 
 typedef struct {
   int numPatterns;
-  DFC_PATTERN **init_hash;  // To cull duplicate patterns
+  PatternIndex index;  // To cull duplicate patterns and ids
+  // in the order they were added
   DFC_PATTERN *dfcPatterns;
+  DFC_PATTERN *lastPattern;
+
+  // occurrences of each case folded byte pair in the samples, NULL if none
+  // were added
+  uint32_t *pairFrequencies;
+
+  // of the patterns and samples in the order they were added, see
+  // DFC_LoadStructure
+  uint64_t contentHash;
+
+  // holds the patterns, released with them
+  Arena patternArena;
+
+  unsigned char xlatcase[256];  // upper case of every byte
 } DFC_PATTERN_INIT;
 
 typedef struct {
   int numPatterns;
   DFC_FIXED_PATTERN *dfcMatchList;
+
+  // see DFC_FIXED_PATTERN for the layout
+  uint8_t *patternBytes;
+  PID_TYPE *externalIds;
 } DFC_PATTERNS;
 
+/*
+ * Chosen by DFC_Compile from the patterns, see the bounds in shared.h
+ * The filters are sized for a false positive rate, the tables for about one
+ * entry per bucket.
+ */
+typedef struct {
+  // log2 of the amount of bits in the hash direct filters
+  int dfLargeHashBits;
+  int dfLongHashBits;
+
+  // log2 of the amount of buckets in the compact tables, or of slots in the
+  // cuckoo variant of the large one
+  int ctLargeBits;
+  int ctLongBits;
+
+  // hash of the large compact table, chosen to keep its buckets short
+  uint32_t ctLargeHashMultiplier;
+  int ctLargeHashShift;
+  // second hash of the cuckoo variant, same shift
+  uint32_t ctLargeCuckooMultiplier;
+} DFC_TABLE_SIZES;
+
 typedef struct {
   DFC_PATTERNS *patterns;
 
+  DFC_TABLE_SIZES sizes;
+
+  // largest fragment_offset of all patterns
+  int maxFragmentOffset;
+
+  // contentHash of the patterns compiled, 0 once patterns were added or
+  // removed
+  uint64_t patternHash;
+
   uint8_t *directFilterSmall;
   uint8_t *directFilterLarge;
   // Indexed by hashing more bytes of the input
   uint8_t *directFilterLargeHash;
+  // Indexed by hashing 8 bytes of the input, see LONG_DF_MIN_PATTERN_SIZE
+  uint8_t *directFilterLongHash;
 
   CompactTableSmallEntry *ctSmallEntries;
   PID_TYPE *ctSmallPids;
@@ -54,17 +110,192 @@ typedef struct {
   CompactTableLargeBucket *ctLargeBuckets;
   CompactTableLargeEntry *ctLargeEntries;
   PID_TYPE *ctLargePids;
+
+  CompactTableLongBucket *ctLongBuckets;
+  CompactTableLongEntry *ctLongEntries;
+  PID_TYPE *ctLongPids;
+
+  // holds the tables and patterns if they are not mapped from OpenCL buffers
+  HostRegion tables;
+
+  // references to the structure once it is published, see DFC_Publish
+  struct DfcPublication_ *publication;
+
+  // room left in the tables, and the reference counts of the filters once
+  // patterns are added or removed, see DFC_AddPatternTo
+  struct DfcUpdates_ *updates;
 } DFC_STRUCTURE;
 
 void DFC_AddPattern(DFC_PATTERN_INIT *dfc, unsigned char *pat, int n,
                     int is_case_insensitive, PID_TYPE sid);
 DFC_STRUCTURE *DFC_Compile(DFC_PATTERN_INIT *patterns);
 
+typedef struct {
+  const unsigned char *pattern;
+  int length;
+  int is_case_insensitive;
+  PID_TYPE sid;
+} DFC_PATTERN_DESCRIPTION;
+
+/*
+ * Same as calling DFC_AddPattern for each of the patterns in order, but the
+ * index culling duplicate patterns and ids is grown once for all of them.
+ * Adding takes the same time per pattern however many there are.
+ */
+void DFC_AddPatterns(DFC_PATTERN_INIT *patterns,
+                     const DFC_PATTERN_DESCRIPTION *descriptions, int count);
+
+/*
+ * Adds the patterns of a file with one "<id> [nocase] <pattern>" per line,
+ * where bytes may be written in hex between pipes as in Snort rules:
+ *   1 attack|0d 0a|
+ *   2 nocase GET /admin
+ * Lines starting with # and empty lines are skipped, see pattern-file.c.
+ * Returns the amount of patterns added, -1 if the file could not be read.
+ * Exits on the first malformed line.
+ */
+int DFC_AddPatternFile(DFC_PATTERN_INIT *patterns, const char *path);
+
+/*
+ * Counts the byte pairs of input similar to what is going to be searched.
+ * With RAREST_FRAGMENT, DFC_Compile keys the large and long patterns on their
+ * fragment made of the rarest pairs in these samples, or in the patterns
+ * themselves if there are none.
+ */
+void DFC_AddFragmentSample(DFC_PATTERN_INIT *patterns,
+                           const unsigned char *sample, int length);
+
 typedef void (*MatchFunction)(DFC_FIXED_PATTERN *pattern);
 typedef int (*ReadFunction)(int maxCount, int maxPatternLength,
                             char *inputBuffer);
 
 int DFC_Search(ReadFunction read, MatchFunction onMatch);
+
+typedef struct {
+  // position of the first byte of the match, counted over all bytes returned
+  // by the read function so far
+  uint64_t offset;
+  PID_TYPE pid;  // internal id, see DFC_GetPattern
+} DFC_MATCH;
+
+typedef void (*MatchBatchFunction)(DFC_MATCH *matches, int matchCount,
+                                   void *userData);
+
+/*
+ * Same as DFC_Search, but the matches are collected in matchBuffer and passed
+ * on whenever it is full (and once at the end), in input order.
+ */
+int DFC_SearchBatched(ReadFunction read, DFC_MATCH *matchBuffer,
+                      int matchBufferSize, MatchBatchFunction onMatches,
+                      void *userData);
+DFC_FIXED_PATTERN *DFC_GetPattern(PID_TYPE pid);
+
+// the pattern as it was added, pattern_length bytes
+unsigned char *DFC_GetPatternBytes(DFC_FIXED_PATTERN *pattern);
+// external_id_count ids
+PID_TYPE *DFC_GetExternalIds(DFC_FIXED_PATTERN *pattern);
+
+typedef struct DfcStream_ DFC_STREAM;
+
+/*
+ * Searches input that arrives in pieces of any size, without a ReadFunction.
+ * Matches crossing the boundary between two writes are found exactly once and
+ * their offsets are counted from the start of the stream.
+ * A match is passed on once MAX_PATTERN_LENGTH bytes starting at it have been
+ * written, or when the stream is closed.
+ * The write and close functions return the amount of matches passed on.
+ */
+DFC_STREAM *DFC_StreamOpen(DFC_MATCH *matchBuffer, int matchBufferSize,
+                           MatchBatchFunction onMatches, void *userData);
+int DFC_StreamWrite(DFC_STREAM *stream, const unsigned char *data, int length);
+int DFC_StreamClose(DFC_STREAM *stream);
+
+/*
+ * The functions above work on the structure compiled last. Every structure
+ * returned by DFC_Compile stays valid until it is freed, and is never written
+ * to by a search, so any number of them may be searched at the same time.
+ */
+DFC_FIXED_PATTERN *DFC_GetPatternOf(DFC_STRUCTURE *dfc, PID_TYPE pid);
+unsigned char *DFC_GetPatternBytesOf(DFC_STRUCTURE *dfc,
+                                     DFC_FIXED_PATTERN *pattern);
+PID_TYPE *DFC_GetExternalIdsOf(DFC_STRUCTURE *dfc, DFC_FIXED_PATTERN *pattern);
+void DFC_FreeStructureOf(DFC_STRUCTURE *dfc);
+
+typedef struct DfcScratch_ DFC_SCRATCH;
+
+/*
+ * Memory a thread needs to search, owned by the caller. Threads searching the
+ * same structure at the same time each need their own scratch, which may be
+ * reused for any amount of searches of any structure.
+ */
+DFC_SCRATCH *DFC_AllocateScratch();
+void DFC_FreeScratch(DFC_SCRATCH *scratch);
+
+/*
+ * Searches length bytes of input on the CPU of the calling thread, the
+ * offsets of the matches are counted from the start of input.
+ * The matches are passed on in batches, in input order.
+ */
+int DFC_SearchWithScratch(DFC_STRUCTURE *dfc, DFC_SCRATCH *scratch,
+                          const unsigned char *input, int length,
+                          MatchBatchFunction onMatches, void *userData);
+
+typedef struct DfcPublisher_ DFC_PUBLISHER;
+
+/*
+ * Swaps the structure searched by many threads without stopping them.
+ * A thread acquires the current structure for every search and releases it
+ * afterwards, DFC_Publish replaces it with one compiled in the meantime.
+ * Searches in flight finish on the structure they acquired, which is freed
+ * by whoever releases it last. Publishing never waits for searches.
+ *
+ * A structure is published once, after which it belongs to the publisher and
+ * must not be freed with DFC_FreeStructure. Only structures searched on the
+ * host can be published, with SEARCH_WITH_GPU or HETEROGENEOUS_DESIGN all
+ * searches share the OpenCL buffers of the structure compiled last and the
+ * program exits.
+ */
+DFC_PUBLISHER *DFC_CreatePublisher(DFC_STRUCTURE *dfc);
+void DFC_Publish(DFC_PUBLISHER *publisher, DFC_STRUCTURE *dfc);
+DFC_STRUCTURE *DFC_AcquireStructure(DFC_PUBLISHER *publisher);
+void DFC_ReleaseStructure(DFC_STRUCTURE *dfc);
+// the current structure is freed once its last reader releases it
+void DFC_FreePublisher(DFC_PUBLISHER *publisher);
+
+/*
+ * Adds a pattern to a compiled structure, or removes the external id of one,
+ * the same as DFC_AddPattern would have before compiling. The pattern is gone
+ * once it has no external ids left, removing an unknown one does nothing.
+ * The tables have room for about UPDATE_SLACK_PERCENT more patterns, beyond
+ * that the program exits and the patterns should be compiled again.
+ * The structure must not be searched during an update. If it was compiled
+ * last, its OpenCL buffers are updated as well.
+ */
+void DFC_AddPatternTo(DFC_STRUCTURE *dfc, unsigned char *pat, int n,
+                      int is_case_insensitive, PID_TYPE sid);
+void DFC_RemovePatternFrom(DFC_STRUCTURE *dfc, unsigned char *pat, int n,
+                           PID_TYPE sid);
+
+/*
+ * Writes a compiled structure to a file that DFC_LoadStructure maps back in
+ * place, in this or another process, instead of compiling the patterns
+ * again. Returns false if the file could not be written.
+ */
+bool DFC_SaveStructure(DFC_STRUCTURE *dfc, const char *path);
+/*
+ * Returns NULL if there is no such file or it was saved by a build with
+ * another configuration, or if patterns is not NULL and it was compiled from
+ * other patterns. The structure becomes the one searched by the functions
+ * working on the structure compiled last.
+ * Neither works with MAP_MEMORY.
+ */
+DFC_STRUCTURE *DFC_LoadStructure(const char *path,
+                                 DFC_PATTERN_INIT *patterns);
+// loads the patterns from path if they were saved there, otherwise compiles
+// and saves them
+DFC_STRUCTURE *DFC_CompileCached(DFC_PATTERN_INIT *patterns,
+                                 const char *path);
+
 void DFC_PrintInfo(DFC_STRUCTURE *dfc);
 
 DFC_PATTERN_INIT *DFC_PATTERN_INIT_New();
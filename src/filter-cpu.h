@@ -0,0 +1,23 @@
+#ifndef DFC_FILTER_CPU_H
+#define DFC_FILTER_CPU_H
+
+#include <stdint.h>
+
+// amount of input positions that are filtered by a single call
+#define CPU_FILTER_BLOCK_SIZE 64
+
+/*
+ * Filters CPU_FILTER_BLOCK_SIZE consecutive positions of the input against
+ * the small and large direct filters.
+ * Bit k of the candidate masks is set if position k passed the filter.
+ * input[0] through input[CPU_FILTER_BLOCK_SIZE] must be readable.
+ */
+typedef void (*CpuFilterFunction)(const uint8_t *dfSmall,
+                                  const uint8_t *dfLarge, const uint8_t *input,
+                                  uint64_t *candidatesSmall,
+                                  uint64_t *candidatesLarge);
+
+// vectorized if the CPU supports it (AVX-512/AVX2), otherwise scalar
+CpuFilterFunction getCpuFilter();
+
+#endif
@@ -2,8 +2,10 @@
 
 #include <math.h>
 
+#include "search-cpu.h"
 #include "shared-internal.h"
 #include "timer.h"
+#include "update.h"
 
 DfcHostMemory DFC_HOST_MEMORY;
 DfcMemoryRequirements DFC_MEMORY_REQUIREMENTS;
@@ -89,8 +91,11 @@ cl_program loadAndCreateProgram(cl_context context) {
   return program;
 }
 
-void buildProgram(cl_program *program, cl_device_id device) {
-  char arguments[400];
+// the hash functions of the kernel are specialized for the sizes of the
+// compiled structure, hence the program is built once they are known
+void buildProgram(cl_program *program, cl_device_id device,
+                  DFC_TABLE_SIZES sizes) {
+  char arguments[600];
   sprintf(arguments,
           "-cl-std=CL1.2 "
           "-D THREAD_GRANULARITY=%d "
@@ -98,11 +103,22 @@ void buildProgram(cl_program *program, cl_device_id device) {
           "-D MAX_MATCHES=%d "
           "-D MAX_MATCHES_PER_THREAD=%d "
           "-D CL_DF_MASK=%d "
-          "-D CL_CT_LARGE_MASK=%d "
+          "-D CL_DF_LARGE_HASH_BITS=%d "
+          "-D CL_DF_LONG_HASH_BITS=%d "
+          "-D CL_CT_LARGE_BITS=%d "
+          "-D CL_CT_LONG_BITS=%d "
+          "-D CL_CT_LARGE_MULTIPLIER=%uu "
+          "-D CL_CT_LARGE_SHIFT=%d "
+          "-D CL_CT_LARGE_CUCKOO_MULTIPLIER=%uu "
+          "-D BLOCKED_BLOOM_FILTER=%d "
+          "-D CUCKOO_LARGE_CT=%d "
           "-D DFC_OPENCL "
           "-I ../src",
           THREAD_GRANULARITY, DF_SIZE_REAL / WORK_GROUP_SIZE, MAX_MATCHES,
-          MAX_MATCHES_PER_THREAD, DF_MASK, COMPACT_TABLE_SIZE_LARGE - 1);
+          MAX_MATCHES_PER_THREAD, DF_MASK, sizes.dfLargeHashBits,
+          sizes.dfLongHashBits, sizes.ctLargeBits, sizes.ctLongBits,
+          sizes.ctLargeHashMultiplier, sizes.ctLargeHashShift,
+          sizes.ctLargeCuckooMultiplier, BLOCKED_BLOOM_FILTER, CUCKOO_LARGE_CT);
   cl_int status = clBuildProgram(*program, 1, &device, arguments, NULL, NULL);
 
   if (status != CL_SUCCESS) {
@@ -165,24 +181,42 @@ DfcOpenClEnvironment setupOpenClEnvironment() {
   cl_platform_id platform = getPlatform();
   cl_device_id device = getDevice(platform);
   cl_context context = getContext(device);
-  cl_program program = loadAndCreateProgram(context);
-  buildProgram(&program, device);
-  cl_kernel kernel = createKernel(&program);
   cl_command_queue queue = createCommandQueue(context, device);
 
+  // the program is built by buildOpenClKernel
   DfcOpenClEnvironment env = {.platform = platform,
                               .device = device,
                               .context = context,
-                              .program = program,
-                              .kernel = kernel,
+                              .program = NULL,
+                              .kernel = NULL,
                               .queue = queue};
 
   return env;
 }
 
+void releaseOpenClKernel(DfcOpenClEnvironment *environment) {
+  if (environment->kernel) {
+    clReleaseKernel(environment->kernel);
+    clReleaseProgram(environment->program);
+  }
+
+  environment->kernel = NULL;
+  environment->program = NULL;
+}
+
+void buildOpenClKernel(DfcOpenClEnvironment *environment,
+                       DFC_TABLE_SIZES sizes) {
+  releaseOpenClKernel(environment);
+
+  cl_program program = loadAndCreateProgram(environment->context);
+  buildProgram(&program, environment->device, sizes);
+
+  environment->program = program;
+  environment->kernel = createKernel(&program);
+}
+
 void releaseOpenClEnvironment(DfcOpenClEnvironment *environment) {
-  clReleaseKernel(environment->kernel);
-  clReleaseProgram(environment->program);
+  releaseOpenClKernel(environment);
   clReleaseContext(environment->context);
 }
 
@@ -190,6 +224,8 @@ void setupExecutionEnvironment() {
   startTimer(TIMER_ENVIRONMENT_SETUP);
   if (shouldUseOpenCl()) {
     DFC_OPENCL_ENVIRONMENT = setupOpenClEnvironment();
+  } else {
+    setupParallelCpuSearch();
   }
   stopTimer(TIMER_ENVIRONMENT_SETUP);
 }
@@ -198,6 +234,8 @@ void releaseExecutionEnvironment() {
   freeOpenClBuffers();
   if (shouldUseOpenCl()) {
     releaseOpenClEnvironment(&DFC_OPENCL_ENVIRONMENT);
+  } else {
+    releaseParallelCpuSearch();
   }
   stopTimer(TIMER_ENVIRONMENT_TEARDOWN);
 }
@@ -314,46 +352,79 @@ void createTextureBufferAndMap(cl_context context, cl_command_queue queue,
   memset(*host, 0, size);
 }
 
-void allocateCompactTablesOnHost(DFC_STRUCTURE *dfc,
-                                 DfcMemoryRequirements requirements) {
-  dfc->ctSmallEntries =
-      calloc(1, sizeof(CompactTableSmallEntry) * COMPACT_TABLE_SIZE_SMALL);
-  if (!dfc->ctSmallEntries) {
-    fprintf(stderr, "Could not allocate small CT\n");
-    exit(1);
-  }
-  dfc->ctSmallPids = calloc(1, sizeof(PID_TYPE) * requirements.ctSmallPidCount);
-  if (!dfc->ctSmallPids) {
-    fprintf(stderr, "Could not allocate small CT pids\n");
-    exit(1);
-  }
+static size_t compactTablesSize(DfcMemoryRequirements requirements) {
+  return alignToRegion(sizeof(CompactTableSmallEntry) *
+                       COMPACT_TABLE_SIZE_SMALL) +
+         alignToRegion(sizeof(PID_TYPE) * requirements.ctSmallPidCount) +
+         alignToRegion(sizeof(CompactTableLargeBucket) *
+                       ctLargeBucketCount(requirements.sizes)) +
+         alignToRegion(sizeof(CompactTableLargeEntry) *
+                       requirements.ctLargeEntryCount) +
+         alignToRegion(sizeof(PID_TYPE) * requirements.ctLargePidCount) +
+         alignToRegion(sizeof(CompactTableLongBucket) *
+                       (1 << requirements.sizes.ctLongBits)) +
+         alignToRegion(sizeof(CompactTableLongEntry) *
+                       requirements.ctLongEntryCount) +
+         alignToRegion(sizeof(PID_TYPE) * requirements.ctLongPidCount);
+}
 
-  dfc->ctLargeBuckets =
-      calloc(1, sizeof(CompactTableLargeBucket) * COMPACT_TABLE_SIZE_LARGE);
-  if (!dfc->ctLargeBuckets) {
-    fprintf(stderr, "Could not allocate large CT\n");
-    exit(1);
-  }
+static size_t patternsSize(DfcMemoryRequirements requirements) {
+  return alignToRegion(sizeof(DFC_FIXED_PATTERN) *
+                       requirements.patternCount) +
+         alignToRegion(requirements.patternByteCount) +
+         alignToRegion(sizeof(PID_TYPE) * requirements.externalIdCount);
+}
 
-  dfc->ctLargeEntries = calloc(
-      1, sizeof(CompactTableLargeEntry) * requirements.ctLargeEntryCount);
-  if (!dfc->ctLargeEntries) {
-    fprintf(stderr, "Could not allocate large CT entries\n");
-    exit(1);
+// zeroed memory for a table, taken from the region of the tables if there is
+// one
+static void *allocateTable(DFC_STRUCTURE *dfc, size_t size, const char *name) {
+  if (dfc->tables.memory) {
+    return takeFromHostRegion(&dfc->tables, size);
   }
 
-  dfc->ctLargePids = calloc(1, sizeof(PID_TYPE) * requirements.ctLargePidCount);
-  if (!dfc->ctLargeEntries) {
-    fprintf(stderr, "Could not allocate large CT pids\n");
+  void *table = calloc(1, size);
+  if (!table) {
+    fprintf(stderr, "Could not allocate %s\n", name);
     exit(1);
   }
+
+  return table;
 }
 
-void allocateDfcStructureWithMap(DfcMemoryRequirements requirements) {
+void allocateCompactTablesOnHost(DFC_STRUCTURE *dfc,
+                                 DfcMemoryRequirements requirements) {
+  dfc->ctSmallEntries = allocateTable(
+      dfc, sizeof(CompactTableSmallEntry) * COMPACT_TABLE_SIZE_SMALL,
+      "small CT");
+  dfc->ctSmallPids = allocateTable(
+      dfc, sizeof(PID_TYPE) * requirements.ctSmallPidCount, "small CT pids");
+
+  dfc->ctLargeBuckets = allocateTable(
+      dfc,
+      sizeof(CompactTableLargeBucket) * ctLargeBucketCount(requirements.sizes),
+      "large CT");
+  dfc->ctLargeEntries = allocateTable(
+      dfc, sizeof(CompactTableLargeEntry) * requirements.ctLargeEntryCount,
+      "large CT entries");
+  dfc->ctLargePids = allocateTable(
+      dfc, sizeof(PID_TYPE) * requirements.ctLargePidCount, "large CT pids");
+
+  dfc->ctLongBuckets = allocateTable(
+      dfc,
+      sizeof(CompactTableLongBucket) * (1 << requirements.sizes.ctLongBits),
+      "long CT");
+  dfc->ctLongEntries = allocateTable(
+      dfc, sizeof(CompactTableLongEntry) * requirements.ctLongEntryCount,
+      "long CT entries");
+  dfc->ctLongPids = allocateTable(
+      dfc, sizeof(PID_TYPE) * requirements.ctLongPidCount, "long CT pids");
+}
+
+DFC_STRUCTURE *allocateDfcStructureWithMap(DfcMemoryRequirements requirements) {
   cl_context context = DFC_OPENCL_ENVIRONMENT.context;
   cl_command_queue queue = DFC_OPENCL_ENVIRONMENT.queue;
 
-  DFC_STRUCTURE *dfc = malloc(sizeof(DFC_STRUCTURE));
+  DFC_STRUCTURE *dfc = calloc(1, sizeof(DFC_STRUCTURE));
 
   if (USE_TEXTURE_MEMORY) {
     createTextureBufferAndMap(context, queue, (void *)&dfc->directFilterSmall,
@@ -367,7 +438,11 @@ void allocateDfcStructureWithMap(DfcMemoryRequirements requirements) {
                        &DFC_OPENCL_BUFFERS.dfLarge, DF_SIZE_REAL);
   }
   createBufferAndMap(context, queue, (void *)&dfc->directFilterLargeHash,
-                     &DFC_OPENCL_BUFFERS.dfLargeHash, DF_SIZE_REAL);
+                     &DFC_OPENCL_BUFFERS.dfLargeHash,
+                     DF_HASH_SIZE_REAL(requirements.sizes.dfLargeHashBits));
+  createBufferAndMap(context, queue, (void *)&dfc->directFilterLongHash,
+                     &DFC_OPENCL_BUFFERS.dfLongHash,
+                     DF_HASH_SIZE_REAL(requirements.sizes.dfLongHashBits));
 
   if (HETEROGENEOUS_DESIGN) {
     allocateCompactTablesOnHost(dfc, requirements);
@@ -383,7 +458,8 @@ void allocateDfcStructureWithMap(DfcMemoryRequirements requirements) {
     createBufferAndMap(
         context, queue, (void *)&dfc->ctLargeBuckets,
         &DFC_OPENCL_BUFFERS.ctLargeBuckets,
-        COMPACT_TABLE_SIZE_LARGE * sizeof(CompactTableLargeBucket));
+        ctLargeBucketCount(requirements.sizes) *
+            sizeof(CompactTableLargeBucket));
     createBufferAndMap(
         context, queue, (void *)&dfc->ctLargeEntries,
         &DFC_OPENCL_BUFFERS.ctLargeEntries,
@@ -391,23 +467,43 @@ void allocateDfcStructureWithMap(DfcMemoryRequirements requirements) {
     createBufferAndMap(context, queue, (void *)&dfc->ctLargePids,
                        &DFC_OPENCL_BUFFERS.ctLargePids,
                        requirements.ctLargePidCount * sizeof(PID_TYPE));
+
+    createBufferAndMap(
+        context, queue, (void *)&dfc->ctLongBuckets,
+        &DFC_OPENCL_BUFFERS.ctLongBuckets,
+        (1 << requirements.sizes.ctLongBits) * sizeof(CompactTableLongBucket));
+    createBufferAndMap(
+        context, queue, (void *)&dfc->ctLongEntries,
+        &DFC_OPENCL_BUFFERS.ctLongEntries,
+        requirements.ctLongEntryCount * sizeof(CompactTableLongEntry));
+    createBufferAndMap(context, queue, (void *)&dfc->ctLongPids,
+                       &DFC_OPENCL_BUFFERS.ctLongPids,
+                       requirements.ctLongPidCount * sizeof(PID_TYPE));
   }
 
-  DFC_HOST_MEMORY.dfcStructure = dfc;
+  return dfc;
 }
 
-void allocateDfcPatternsWithMap(int numPatterns) {
+void allocateDfcPatternsWithMap(DFC_STRUCTURE *dfc,
+                                DfcMemoryRequirements requirements) {
   cl_context context = DFC_OPENCL_ENVIRONMENT.context;
   cl_command_queue queue = DFC_OPENCL_ENVIRONMENT.queue;
 
   DFC_PATTERNS *patterns = malloc(sizeof(DFC_PATTERNS));
 
-  patterns->numPatterns = numPatterns;
+  patterns->numPatterns = requirements.patternCount;
   createBufferAndMap(context, queue, (void *)&patterns->dfcMatchList,
                      &DFC_OPENCL_BUFFERS.patterns,
-                     sizeof(DFC_FIXED_PATTERN) * numPatterns);
+                     sizeof(DFC_FIXED_PATTERN) * requirements.patternCount);
+  createBufferAndMap(context, queue, (void *)&patterns->patternBytes,
+                     &DFC_OPENCL_BUFFERS.patternBytes,
+                     requirements.patternByteCount);
+
+  // never used by the device
+  patterns->externalIds =
+      calloc(1, sizeof(PID_TYPE) * requirements.externalIdCount);
 
-  DFC_HOST_MEMORY.dfcStructure->patterns = patterns;
+  dfc->patterns = patterns;
 }
 
 void allocateInputWithMap(int size) {
@@ -443,6 +539,7 @@ void unmapOpenClInputBuffers() {
   unmapOpenClBuffer(queue, dfc->directFilterSmall, buffers->dfSmall);
   unmapOpenClBuffer(queue, dfc->directFilterLarge, buffers->dfLarge);
   unmapOpenClBuffer(queue, dfc->directFilterLargeHash, buffers->dfLargeHash);
+  unmapOpenClBuffer(queue, dfc->directFilterLongHash, buffers->dfLongHash);
 
   if (!HETEROGENEOUS_DESIGN) {
     unmapOpenClBuffer(queue, dfc->ctSmallEntries, buffers->ctSmallEntries);
@@ -452,31 +549,68 @@ void unmapOpenClInputBuffers() {
     unmapOpenClBuffer(queue, dfc->ctLargeEntries, buffers->ctLargeEntries);
     unmapOpenClBuffer(queue, dfc->ctLargePids, buffers->ctLargePids);
 
+    unmapOpenClBuffer(queue, dfc->ctLongBuckets, buffers->ctLongBuckets);
+    unmapOpenClBuffer(queue, dfc->ctLongEntries, buffers->ctLongEntries);
+    unmapOpenClBuffer(queue, dfc->ctLongPids, buffers->ctLongPids);
+
     unmapOpenClBuffer(queue,
                       DFC_HOST_MEMORY.dfcStructure->patterns->dfcMatchList,
                       DFC_OPENCL_BUFFERS.patterns);
+    unmapOpenClBuffer(queue,
+                      DFC_HOST_MEMORY.dfcStructure->patterns->patternBytes,
+                      DFC_OPENCL_BUFFERS.patternBytes);
   }
 }
 
-void allocateDfcStructureOnHost(DfcMemoryRequirements requirements) {
-  DFC_STRUCTURE *dfc = malloc(sizeof(DFC_STRUCTURE));
+size_t hostRegionSize(DfcMemoryRequirements requirements) {
+  return 2 * alignToRegion(DF_SIZE_REAL) +
+         alignToRegion(DF_HASH_SIZE_REAL(requirements.sizes.dfLargeHashBits)) +
+         alignToRegion(DF_HASH_SIZE_REAL(requirements.sizes.dfLongHashBits)) +
+         compactTablesSize(requirements) + patternsSize(requirements);
+}
+
+// takes the filters and compact tables from the start of tables
+static DFC_STRUCTURE *carveDfcStructure(HostRegion tables,
+                                        DfcMemoryRequirements requirements) {
+  DFC_STRUCTURE *dfc = calloc(1, sizeof(DFC_STRUCTURE));
+  dfc->tables = tables;
 
-  dfc->directFilterSmall = calloc(1, DF_SIZE_REAL);
-  dfc->directFilterLarge = calloc(1, DF_SIZE_REAL);
-  dfc->directFilterLargeHash = calloc(1, DF_SIZE_REAL);
+  int dfLargeHashSize = DF_HASH_SIZE_REAL(requirements.sizes.dfLargeHashBits);
+  int dfLongHashSize = DF_HASH_SIZE_REAL(requirements.sizes.dfLongHashBits);
+
+  dfc->directFilterSmall = allocateTable(dfc, DF_SIZE_REAL, "small DF");
+  dfc->directFilterLarge = allocateTable(dfc, DF_SIZE_REAL, "large DF");
+  // every table starts on a cache line, so the blocks of the Bloom filter
+  // do not straddle two of them
+  dfc->directFilterLargeHash =
+      allocateTable(dfc, dfLargeHashSize, "large hash DF");
+  dfc->directFilterLongHash =
+      allocateTable(dfc, dfLongHashSize, "long hash DF");
 
   allocateCompactTablesOnHost(dfc, requirements);
 
-  DFC_HOST_MEMORY.dfcStructure = dfc;
+  return dfc;
 }
 
-void allocateDfcPatternsOnHost(int numPatterns) {
+// the filters, compact tables and patterns share one region
+DFC_STRUCTURE *allocateDfcStructureOnHost(DfcMemoryRequirements requirements) {
+  return carveDfcStructure(createHostRegion(hostRegionSize(requirements)),
+                           requirements);
+}
+
+void allocateDfcPatternsOnHost(DFC_STRUCTURE *dfc,
+                               DfcMemoryRequirements requirements) {
   DFC_PATTERNS *patterns = malloc(sizeof(DFC_PATTERNS));
 
-  patterns->numPatterns = numPatterns;
-  patterns->dfcMatchList = calloc(1, sizeof(DFC_FIXED_PATTERN) * numPatterns);
+  patterns->numPatterns = requirements.patternCount;
+  patterns->dfcMatchList = allocateTable(
+      dfc, sizeof(DFC_FIXED_PATTERN) * requirements.patternCount, "patterns");
+  patterns->patternBytes =
+      allocateTable(dfc, requirements.patternByteCount, "pattern bytes");
+  patterns->externalIds = allocateTable(
+      dfc, sizeof(PID_TYPE) * requirements.externalIdCount, "external ids");
 
-  DFC_HOST_MEMORY.dfcStructure->patterns = patterns;
+  dfc->patterns = patterns;
 }
 
 void allocateInputOnHost(int size) {
@@ -486,28 +620,12 @@ void allocateInputOnHost(int size) {
   }
 }
 
-void freeDfcStructureOnHost() {
-  DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
-
-  free(dfc->directFilterSmall);
-  free(dfc->directFilterLarge);
-  free(dfc->directFilterLargeHash);
-
-  free(dfc->ctSmallEntries);
-  free(dfc->ctSmallPids);
-
-  free(dfc->ctLargeBuckets);
-  free(dfc->ctLargeEntries);
-  free(dfc->ctLargePids);
-
+void freeDfcStructureOnHost(DFC_STRUCTURE *dfc) {
+  freeHostRegion(&dfc->tables);
   free(dfc);
-
-  DFC_HOST_MEMORY.dfcStructure = NULL;
 }
 
-void freeDfcStructureWithMap() {
-  DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
-
+void freeDfcStructureWithMap(DFC_STRUCTURE *dfc) {
   if (HETEROGENEOUS_DESIGN) {
     free(dfc->ctSmallEntries);
     free(dfc->ctSmallPids);
@@ -515,16 +633,28 @@ void freeDfcStructureWithMap() {
     free(dfc->ctLargeBuckets);
     free(dfc->ctLargeEntries);
     free(dfc->ctLargePids);
+
+    free(dfc->ctLongBuckets);
+    free(dfc->ctLongEntries);
+    free(dfc->ctLongPids);
   }
 
   free(dfc);
+}
 
-  DFC_HOST_MEMORY.dfcStructure = NULL;
+void freeDfcPatternsOnHost(DFC_STRUCTURE *dfc) {
+  // the arrays are part of the region of the tables, if there is one
+  if (!dfc->tables.memory) {
+    free(dfc->patterns->dfcMatchList);
+    free(dfc->patterns->patternBytes);
+    free(dfc->patterns->externalIds);
+  }
+  free(dfc->patterns);
 }
 
-void freeDfcPatternsOnHost() {
-  free(DFC_HOST_MEMORY.dfcStructure->patterns->dfcMatchList);
-  free(DFC_HOST_MEMORY.dfcStructure->patterns);
+void freeDfcPatternsWithMap(DFC_STRUCTURE *dfc) {
+  free(dfc->patterns->externalIds);
+  free(dfc->patterns);
 }
 
 void freeDfcInputOnHost() {
@@ -540,24 +670,43 @@ bool shouldMapPatternMemory() {
   return shouldUseMappedMemory() && !HETEROGENEOUS_DESIGN;
 }
 
-void allocateDfcPatterns(int numPatterns) {
+void allocateDfcPatterns(DFC_STRUCTURE *dfc,
+                         DfcMemoryRequirements requirements) {
   if (shouldMapPatternMemory()) {
-    allocateDfcPatternsWithMap(numPatterns);
+    allocateDfcPatternsWithMap(dfc, requirements);
   } else {
-    allocateDfcPatternsOnHost(numPatterns);
+    allocateDfcPatternsOnHost(dfc, requirements);
   }
 }
 
-void allocateDfcStructure(DfcMemoryRequirements requirements) {
-  DFC_MEMORY_REQUIREMENTS = requirements;
+DFC_STRUCTURE *wrapDfcStructure(HostRegion tables,
+                                DfcMemoryRequirements requirements) {
+  if (shouldUseOpenCl()) {
+    DFC_MEMORY_REQUIREMENTS = requirements;
+  }
 
+  DFC_STRUCTURE *dfc = carveDfcStructure(tables, requirements);
+  allocateDfcPatternsOnHost(dfc, requirements);
+
+  return dfc;
+}
+
+DFC_STRUCTURE *allocateDfcStructure(DfcMemoryRequirements requirements) {
+  // the OpenCL buffers only exist for one structure at a time
+  if (shouldUseOpenCl()) {
+    DFC_MEMORY_REQUIREMENTS = requirements;
+  }
+
+  DFC_STRUCTURE *dfc;
   if (shouldUseMappedMemory()) {
-    allocateDfcStructureWithMap(requirements);
+    dfc = allocateDfcStructureWithMap(requirements);
   } else {
-    allocateDfcStructureOnHost(requirements);
+    dfc = allocateDfcStructureOnHost(requirements);
   }
 
-  allocateDfcPatterns(requirements.patternCount);
+  allocateDfcPatterns(dfc, requirements);
+
+  return dfc;
 }
 
 char *allocateInput(int size) {
@@ -574,19 +723,27 @@ char *allocateInput(int size) {
 
 char *getInputPtr() { return DFC_HOST_MEMORY.input; }
 
-void freeDfcPatterns() {
-  if (!shouldMapPatternMemory()) {
-    freeDfcPatternsOnHost();
+void freeDfcPatterns(DFC_STRUCTURE *dfc) {
+  if (shouldMapPatternMemory()) {
+    freeDfcPatternsWithMap(dfc);
+  } else {
+    freeDfcPatternsOnHost(dfc);
   }
 }
 
-void freeDfcStructure() {
-  freeDfcPatterns();
+void freeDfcStructure(DFC_STRUCTURE *dfc) {
+  // published structures are freed by their last reader, on any thread
+  DFC_STRUCTURE *expected = dfc;
+  __atomic_compare_exchange_n(&DFC_HOST_MEMORY.dfcStructure, &expected, NULL,
+                              false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+
+  freeDfcPatterns(dfc);
+  freeUpdates(dfc->updates);
 
   if (shouldUseMappedMemory()) {
-    freeDfcStructureWithMap();
+    freeDfcStructureWithMap(dfc);
   } else {
-    freeDfcStructureOnHost();
+    freeDfcStructureOnHost(dfc);
   }
 }
 
@@ -674,7 +831,6 @@ cl_mem createReadOnlyTextureBuffer(cl_context context, int size) {
 }
 
 DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
-                                     DFC_PATTERNS *dfcPatterns,
                                      DfcMemoryRequirements requirements) {
   cl_context context = environment->context;
 
@@ -687,7 +843,10 @@ DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
     dfSmall = createReadOnlyBuffer(context, DF_SIZE_REAL);
     dfLarge = createReadOnlyBuffer(context, DF_SIZE_REAL);
   }
-  cl_mem dfLargeHash = createReadOnlyBuffer(context, DF_SIZE_REAL);
+  cl_mem dfLargeHash = createReadOnlyBuffer(
+      context, DF_HASH_SIZE_REAL(requirements.sizes.dfLargeHashBits));
+  cl_mem dfLongHash = createReadOnlyBuffer(
+      context, DF_HASH_SIZE_REAL(requirements.sizes.dfLongHashBits));
 
   cl_mem ctSmallEntries = NULL;
   cl_mem ctSmallPids = NULL;
@@ -696,7 +855,12 @@ DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
   cl_mem ctLargeEntries = NULL;
   cl_mem ctLargePids = NULL;
 
+  cl_mem ctLongBuckets = NULL;
+  cl_mem ctLongEntries = NULL;
+  cl_mem ctLongPids = NULL;
+
   cl_mem patterns = NULL;
+  cl_mem patternBytes = NULL;
   if (!HETEROGENEOUS_DESIGN) {
     ctSmallEntries = createReadOnlyBuffer(
         context, sizeof(CompactTableSmallEntry) * COMPACT_TABLE_SIZE_SMALL);
@@ -704,15 +868,27 @@ DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
         context, requirements.ctSmallPidCount * sizeof(PID_TYPE));
 
     ctLargeBuckets = createReadOnlyBuffer(
-        context, sizeof(CompactTableLargeBucket) * COMPACT_TABLE_SIZE_LARGE);
+        context, sizeof(CompactTableLargeBucket) *
+                     ctLargeBucketCount(requirements.sizes));
     ctLargeEntries =
         createReadOnlyBuffer(context, sizeof(CompactTableLargeEntry) *
                                           requirements.ctLargeEntryCount);
     ctLargePids = createReadOnlyBuffer(
         context, sizeof(PID_TYPE) * requirements.ctLargePidCount);
 
+    ctLongBuckets = createReadOnlyBuffer(
+        context, sizeof(CompactTableLongBucket) *
+                     (1 << requirements.sizes.ctLongBits));
+    ctLongEntries = createReadOnlyBuffer(
+        context, sizeof(CompactTableLongEntry) * requirements.ctLongEntryCount);
+    ctLongPids = createReadOnlyBuffer(
+        context, sizeof(PID_TYPE) * requirements.ctLongPidCount);
+
+    // with room for the patterns added later on
     patterns = createReadOnlyBuffer(
-        context, sizeof(DFC_FIXED_PATTERN) * dfcPatterns->numPatterns);
+        context, sizeof(DFC_FIXED_PATTERN) * requirements.patternCount);
+    patternBytes =
+        createReadOnlyBuffer(context, requirements.patternByteCount);
   }
 
   cl_mem input = createReadOnlyBuffer(DFC_OPENCL_ENVIRONMENT.context,
@@ -733,6 +909,7 @@ DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
 
   DfcOpenClBuffers memory = {
       .patterns = patterns,
+      .patternBytes = patternBytes,
 
       .dfSmall = dfSmall,
 
@@ -741,11 +918,16 @@ DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
 
       .dfLarge = dfLarge,
       .dfLargeHash = dfLargeHash,
+      .dfLongHash = dfLongHash,
 
       .ctLargeBuckets = ctLargeBuckets,
       .ctLargeEntries = ctLargeEntries,
       .ctLargePids = ctLargePids,
 
+      .ctLongBuckets = ctLongBuckets,
+      .ctLongEntries = ctLongEntries,
+      .ctLongPids = ctLongPids,
+
       .input = input,
       .result = result,
 
@@ -758,10 +940,16 @@ DfcOpenClBuffers createOpenClBuffers(DfcOpenClEnvironment *environment,
 
 void writeOpenClBuffer(cl_command_queue queue, void *host, cl_mem buffer,
                        size_t size) {
+  writeOpenClBufferRange(queue, host, buffer, 0, size);
+}
+
+void writeOpenClBufferRange(cl_command_queue queue, void *host, cl_mem buffer,
+                            size_t offset, size_t size) {
   startTimer(TIMER_WRITE_TO_DEVICE);
 
-  cl_int errcode = clEnqueueWriteBuffer(queue, buffer, BLOCKING_DEVICE_ACCESS,
-                                        0, size, host, 0, NULL, NULL);
+  cl_int errcode =
+      clEnqueueWriteBuffer(queue, buffer, BLOCKING_DEVICE_ACCESS, offset, size,
+                           (uint8_t *)host + offset, 0, NULL, NULL);
 
   stopTimer(TIMER_WRITE_TO_DEVICE);
 
@@ -808,7 +996,11 @@ void writeOpenClBuffers(DfcOpenClBuffers *deviceMemory, cl_command_queue queue,
   }
 
   writeOpenClBuffer(queue, hostMemory->dfcStructure->directFilterLargeHash,
-                    deviceMemory->dfLargeHash, DF_SIZE_REAL);
+                    deviceMemory->dfLargeHash,
+                    DF_HASH_SIZE_REAL(requirements.sizes.dfLargeHashBits));
+  writeOpenClBuffer(queue, hostMemory->dfcStructure->directFilterLongHash,
+                    deviceMemory->dfLongHash,
+                    DF_HASH_SIZE_REAL(requirements.sizes.dfLongHashBits));
 
   if (!HETEROGENEOUS_DESIGN) {
     writeOpenClBuffer(
@@ -822,7 +1014,8 @@ void writeOpenClBuffers(DfcOpenClBuffers *deviceMemory, cl_command_queue queue,
     writeOpenClBuffer(
         queue, hostMemory->dfcStructure->ctLargeBuckets,
         deviceMemory->ctLargeBuckets,
-        sizeof(CompactTableLargeBucket) * COMPACT_TABLE_SIZE_LARGE);
+        sizeof(CompactTableLargeBucket) *
+            ctLargeBucketCount(requirements.sizes));
     writeOpenClBuffer(
         queue, hostMemory->dfcStructure->ctLargeEntries,
         deviceMemory->ctLargeEntries,
@@ -831,14 +1024,31 @@ void writeOpenClBuffers(DfcOpenClBuffers *deviceMemory, cl_command_queue queue,
                       deviceMemory->ctLargePids,
                       sizeof(PID_TYPE) * requirements.ctLargePidCount);
 
+    writeOpenClBuffer(
+        queue, hostMemory->dfcStructure->ctLongBuckets,
+        deviceMemory->ctLongBuckets,
+        sizeof(CompactTableLongBucket) * (1 << requirements.sizes.ctLongBits));
+    writeOpenClBuffer(
+        queue, hostMemory->dfcStructure->ctLongEntries,
+        deviceMemory->ctLongEntries,
+        sizeof(CompactTableLongEntry) * requirements.ctLongEntryCount);
+    writeOpenClBuffer(queue, hostMemory->dfcStructure->ctLongPids,
+                      deviceMemory->ctLongPids,
+                      sizeof(PID_TYPE) * requirements.ctLongPidCount);
+
     writeOpenClBuffer(queue, hostMemory->dfcStructure->patterns->dfcMatchList,
                       deviceMemory->patterns,
                       hostMemory->dfcStructure->patterns->numPatterns *
                           sizeof(DFC_FIXED_PATTERN));
+    writeOpenClBuffer(queue, hostMemory->dfcStructure->patterns->patternBytes,
+                      deviceMemory->patternBytes,
+                      requirements.patternByteCount);
   }
 }
 
 void prepareOpenClBuffersForSearch() {
+  buildOpenClKernel(&DFC_OPENCL_ENVIRONMENT, DFC_MEMORY_REQUIREMENTS.sizes);
+
   allocateInput(INPUT_READ_CHUNK_BYTES + 8);
 
   if (MAP_MEMORY) {
@@ -850,9 +1060,8 @@ void prepareOpenClBuffersForSearch() {
         createMappedBuffer(DFC_OPENCL_ENVIRONMENT.context,
                            sizeInBytesOfResultVector(INPUT_READ_CHUNK_BYTES));
   } else {
-    DFC_OPENCL_BUFFERS = createOpenClBuffers(
-        &DFC_OPENCL_ENVIRONMENT, DFC_HOST_MEMORY.dfcStructure->patterns,
-        DFC_MEMORY_REQUIREMENTS);
+    DFC_OPENCL_BUFFERS =
+        createOpenClBuffers(&DFC_OPENCL_ENVIRONMENT, DFC_MEMORY_REQUIREMENTS);
     writeOpenClBuffers(&DFC_OPENCL_BUFFERS, DFC_OPENCL_ENVIRONMENT.queue,
                        &DFC_HOST_MEMORY, DFC_MEMORY_REQUIREMENTS);
   }
@@ -864,6 +1073,7 @@ void freeOpenClBuffers() {
   clReleaseMemObject(DFC_OPENCL_BUFFERS.dfSmall);
   clReleaseMemObject(DFC_OPENCL_BUFFERS.dfLarge);
   clReleaseMemObject(DFC_OPENCL_BUFFERS.dfLargeHash);
+  clReleaseMemObject(DFC_OPENCL_BUFFERS.dfLongHash);
 
   if (!HETEROGENEOUS_DESIGN) {
     clReleaseMemObject(DFC_OPENCL_BUFFERS.ctSmallEntries);
@@ -873,7 +1083,12 @@ void freeOpenClBuffers() {
     clReleaseMemObject(DFC_OPENCL_BUFFERS.ctLargeEntries);
     clReleaseMemObject(DFC_OPENCL_BUFFERS.ctLargePids);
 
+    clReleaseMemObject(DFC_OPENCL_BUFFERS.ctLongBuckets);
+    clReleaseMemObject(DFC_OPENCL_BUFFERS.ctLongEntries);
+    clReleaseMemObject(DFC_OPENCL_BUFFERS.ctLongPids);
+
     clReleaseMemObject(DFC_OPENCL_BUFFERS.patterns);
+    clReleaseMemObject(DFC_OPENCL_BUFFERS.patternBytes);
   }
 
   clReleaseMemObject(DFC_OPENCL_BUFFERS.result);
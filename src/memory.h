@@ -13,10 +13,12 @@ typedef struct {
   cl_mem input;
 
   cl_mem patterns;
+  cl_mem patternBytes;
 
   cl_mem dfSmall;
   cl_mem dfLarge;
   cl_mem dfLargeHash;
+  cl_mem dfLongHash;
 
   cl_mem ctSmallEntries;
   cl_mem ctSmallPids;
@@ -25,6 +27,10 @@ typedef struct {
   cl_mem ctLargeEntries;
   cl_mem ctLargePids;
 
+  cl_mem ctLongBuckets;
+  cl_mem ctLongEntries;
+  cl_mem ctLongPids;
+
   cl_mem result;
 
   // only used for overlapping execution between the CPU and GPU
@@ -50,6 +56,7 @@ void unmapOpenClInputBuffers();
 typedef struct {
   char *input;
 
+  // compiled last, used by the searches not given a structure
   DFC_STRUCTURE *dfcStructure;
 
   // only used in overlapping execution
@@ -58,11 +65,18 @@ typedef struct {
 
 typedef struct {
   int patternCount;
+  int patternByteCount;
+  int externalIdCount;
 
   int ctSmallPidCount;
 
   int ctLargeEntryCount;
   int ctLargePidCount;
+
+  int ctLongEntryCount;
+  int ctLongPidCount;
+
+  DFC_TABLE_SIZES sizes;
 } DfcMemoryRequirements;
 
 extern DfcHostMemory DFC_HOST_MEMORY;
@@ -70,7 +84,13 @@ extern DfcHostMemory DFC_HOST_MEMORY;
 void setupExecutionEnvironment();
 void releaseExecutionEnvironment();
 
-void allocateDfcStructure(DfcMemoryRequirements requirements);
+DFC_STRUCTURE *allocateDfcStructure(DfcMemoryRequirements requirements);
+// bytes of the region holding the tables of a structure on the host
+size_t hostRegionSize(DfcMemoryRequirements requirements);
+// a structure whose tables were filled in before, laid out as by
+// allocateDfcStructure on the host, the region is freed along with it
+DFC_STRUCTURE *wrapDfcStructure(HostRegion tables,
+                                DfcMemoryRequirements requirements);
 char *allocateInput(int size);
 char *getInputPtr();
 
@@ -78,14 +98,29 @@ static inline bool shouldUseOpenCl() {
   return SEARCH_WITH_GPU || HETEROGENEOUS_DESIGN;
 }
 
+bool shouldUseMappedMemory();
+
+// the cuckoo variant of the large compact table only has entries, a single
+// bucket is kept so that no buffer is empty
+static inline int ctLargeBucketCount(DFC_TABLE_SIZES sizes) {
+  return CUCKOO_LARGE_CT ? 1 : 1 << sizes.ctLargeBits;
+}
+
 static inline bool shouldUseOverlappingExecution() {
   return shouldUseOpenCl() && OVERLAPPING_EXECUTION;
 }
 
-void freeDfcStructure();
+void freeDfcStructure(DFC_STRUCTURE *dfc);
 void freeDfcInput();
 
 void prepareOpenClBuffersForSearch();
+void writeOpenClBuffer(cl_command_queue queue, void *host, cl_mem buffer,
+                       size_t size);
+// writes size bytes starting at offset, both in host and in buffer
+void writeOpenClBufferRange(cl_command_queue queue, void *host, cl_mem buffer,
+                            size_t offset, size_t size);
+void writeOpenClTextureBuffer(cl_command_queue queue, void *host, cl_mem buffer,
+                              int size);
 void freeOpenClBuffers();
 
 int sizeInBytesOfResultVector(int inputLength);
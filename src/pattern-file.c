@@ -0,0 +1,192 @@
+#include "pattern-file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * File format, one pattern per line
+ *
+ *   # comments and empty lines are skipped
+ *   <id> [nocase] <pattern>
+ *
+ * The pattern is the rest of the line, spaces included. Bytes between two
+ * pipes are written in hex as in Snort rules, "|0d 0a|", a pipe itself is
+ * "|7c|". Lines may end in "\r\n".
+ *
+ * The file is mapped and the patterns without hex escapes are added straight
+ * from it, the others are decoded on the stack.
+ */
+typedef struct {
+  const char *path;
+  int lineNumber;
+} PatternFilePosition;
+
+static void exitOnInvalidLine(PatternFilePosition *position,
+                              const char *reason) {
+  fprintf(stderr, "%s:%d: %s\n", position->path, position->lineNumber, reason);
+  exit(INVALID_PATTERN_FILE_EXIT_CODE);
+}
+
+static int hexValue(char character) {
+  if (character >= '0' && character <= '9') {
+    return character - '0';
+  }
+  if (character >= 'a' && character <= 'f') {
+    return character - 'a' + 10;
+  }
+  if (character >= 'A' && character <= 'F') {
+    return character - 'A' + 10;
+  }
+  return -1;
+}
+
+static int decodePattern(PatternFilePosition *position, const char *text,
+                         const char *end, uint8_t *pattern) {
+  int length = 0;
+  bool isHex = false;
+
+  while (text < end) {
+    if (*text == '|') {
+      isHex = !isHex;
+      ++text;
+      continue;
+    }
+    if (length == MAX_PATTERN_LENGTH) {
+      exitOnInvalidLine(position, "pattern is longer than MAX_PATTERN_LENGTH");
+    }
+
+    if (!isHex) {
+      pattern[length++] = *text++;
+    } else if (*text == ' ') {
+      ++text;
+    } else {
+      int high = hexValue(text[0]);
+      int low = text + 1 < end ? hexValue(text[1]) : -1;
+      if (high < 0 || low < 0) {
+        exitOnInvalidLine(position, "hex escape is not made of byte pairs");
+      }
+
+      pattern[length++] = high << 4 | low;
+      text += 2;
+    }
+  }
+
+  if (isHex) {
+    exitOnInvalidLine(position, "hex escape is not closed");
+  }
+
+  return length;
+}
+
+static bool startsWith(const char *text, const char *end, const char *prefix) {
+  size_t length = strlen(prefix);
+  return (size_t)(end - text) >= length && memcmp(text, prefix, length) == 0;
+}
+
+static void addPatternLine(DFC_PATTERN_INIT *patterns,
+                           PatternFilePosition *position, const char *text,
+                           const char *end) {
+  uint32_t id = 0;
+  const char *idStart = text;
+  while (text < end && *text >= '0' && *text <= '9') {
+    uint32_t digit = *text++ - '0';
+    if (id > ((PID_TYPE)-1 - digit) / 10) {
+      exitOnInvalidLine(position, "id does not fit PID_TYPE");
+    }
+    id = id * 10 + digit;
+  }
+  if (text == idStart || text == end || *text != ' ') {
+    exitOnInvalidLine(position, "line does not start with an id and a space");
+  }
+  ++text;
+
+  int isCaseInsensitive = startsWith(text, end, "nocase ");
+  if (isCaseInsensitive) {
+    text += strlen("nocase ");
+  }
+  if (text == end) {
+    exitOnInvalidLine(position, "pattern is empty");
+  }
+
+  if (!memchr(text, '|', end - text)) {
+    DFC_AddPattern(patterns, (unsigned char *)text, end - text,
+                   isCaseInsensitive, id);
+    return;
+  }
+
+  uint8_t pattern[MAX_PATTERN_LENGTH];
+  int length = decodePattern(position, text, end, pattern);
+  if (!length) {
+    exitOnInvalidLine(position, "pattern is empty");
+  }
+
+  DFC_AddPattern(patterns, pattern, length, isCaseInsensitive, id);
+}
+
+static int addPatternLines(DFC_PATTERN_INIT *patterns, const char *path,
+                           const char *text, size_t size) {
+  const char *end = text + size;
+
+  int lineCount = 1;
+  for (const char *line = text; (line = memchr(line, '\n', end - line));
+       ++line) {
+    ++lineCount;
+  }
+  reservePatternIndex(&patterns->index, lineCount);
+
+  PatternFilePosition position = {.path = path, .lineNumber = 0};
+  int patternCount = 0;
+  for (const char *line = text; line < end;) {
+    const char *lineEnd = memchr(line, '\n', end - line);
+    const char *next = lineEnd ? lineEnd + 1 : end;
+    if (!lineEnd) {
+      lineEnd = end;
+    }
+    if (lineEnd > line && lineEnd[-1] == '\r') {
+      --lineEnd;
+    }
+    ++position.lineNumber;
+
+    if (lineEnd > line && *line != '#') {
+      addPatternLine(patterns, &position, line, lineEnd);
+      ++patternCount;
+    }
+
+    line = next;
+  }
+
+  return patternCount;
+}
+
+int addPatternFile(DFC_PATTERN_INIT *patterns, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (status.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  void *text = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED) {
+    return -1;
+  }
+
+  // read once from start to end
+  madvise(text, status.st_size, MADV_SEQUENTIAL);
+
+  int patternCount = addPatternLines(patterns, path, text, status.st_size);
+  munmap(text, status.st_size);
+
+  return patternCount;
+}
@@ -0,0 +1,9 @@
+#ifndef DFC_PATTERN_FILE_H
+#define DFC_PATTERN_FILE_H
+
+#include "dfc.h"
+
+// the amount of patterns added, -1 if the file could not be read
+int addPatternFile(DFC_PATTERN_INIT *patterns, const char *path);
+
+#endif
@@ -0,0 +1,163 @@
+#include "pattern-index.h"
+
+#include "dfc.h"
+
+#define PATTERN_INDEX_MIN_SLOTS 1024
+#define EMPTY_ID_SLOT UINT64_MAX
+
+uint64_t hashPatternKey(const uint8_t *pattern, int length) {
+  uint64_t hash = 14695981039346656037u;
+  for (int i = 0; i < length; ++i) {
+    hash = (hash ^ pattern[i]) * 1099511628211u;
+  }
+
+  // spreads the last bytes over the low bits the slots are picked by
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdu;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+static uint64_t hashId(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53u;
+  key ^= key >> 33;
+
+  return key;
+}
+
+static void *allocateSlots(uint32_t count, size_t slotSize) {
+  void *slots = malloc(count * slotSize);
+  if (!slots) {
+    fprintf(stderr, "Could not allocate the index of the patterns\n");
+    exit(1);
+  }
+
+  return slots;
+}
+
+// a power of two of slots, at most half of them used by count entries
+static uint32_t slotCountFor(uint32_t count) {
+  uint32_t slotCount = PATTERN_INDEX_MIN_SLOTS;
+  while (slotCount / 2 < count) {
+    slotCount *= 2;
+  }
+
+  return slotCount;
+}
+
+static void placePattern(PatternIndexSlot *slots, uint32_t slotCount,
+                         PatternIndexSlot slot) {
+  uint32_t i = slot.hash & (slotCount - 1);
+  while (slots[i].pattern) {
+    i = (i + 1) & (slotCount - 1);
+  }
+
+  slots[i] = slot;
+}
+
+static void resizePatternSlots(PatternIndex *index, uint32_t slotCount) {
+  PatternIndexSlot *slots = allocateSlots(slotCount, sizeof(PatternIndexSlot));
+  memset(slots, 0, slotCount * sizeof(PatternIndexSlot));
+
+  for (uint32_t i = 0; i < index->patternSlotCount; ++i) {
+    if (index->patternSlots[i].pattern) {
+      placePattern(slots, slotCount, index->patternSlots[i]);
+    }
+  }
+
+  free(index->patternSlots);
+  index->patternSlots = slots;
+  index->patternSlotCount = slotCount;
+}
+
+static bool placeId(uint64_t *slots, uint32_t slotCount, uint64_t key) {
+  uint32_t i = hashId(key) & (slotCount - 1);
+  while (slots[i] != EMPTY_ID_SLOT) {
+    if (slots[i] == key) {
+      return false;
+    }
+    i = (i + 1) & (slotCount - 1);
+  }
+
+  slots[i] = key;
+  return true;
+}
+
+static void resizeIdSlots(PatternIndex *index, uint32_t slotCount) {
+  uint64_t *slots = allocateSlots(slotCount, sizeof(uint64_t));
+  memset(slots, 0xff, slotCount * sizeof(uint64_t));
+
+  for (uint32_t i = 0; i < index->idSlotCount; ++i) {
+    if (index->idSlots[i] != EMPTY_ID_SLOT) {
+      placeId(slots, slotCount, index->idSlots[i]);
+    }
+  }
+
+  free(index->idSlots);
+  index->idSlots = slots;
+  index->idSlotCount = slotCount;
+}
+
+DFC_PATTERN *findIndexedPattern(PatternIndex *index, const uint8_t *pattern,
+                                int length, uint64_t hash) {
+  if (!index->patternSlotCount) {
+    return NULL;
+  }
+
+  uint32_t mask = index->patternSlotCount - 1;
+  for (uint32_t i = hash & mask; index->patternSlots[i].pattern;
+       i = (i + 1) & mask) {
+    PatternIndexSlot *slot = index->patternSlots + i;
+    if (slot->hash == hash && slot->pattern->n == length &&
+        memcmp(slot->pattern->casepatrn, pattern, length) == 0) {
+      return slot->pattern;
+    }
+  }
+
+  return NULL;
+}
+
+void addIndexedPattern(PatternIndex *index, DFC_PATTERN *pattern,
+                       uint64_t hash) {
+  if (index->patternSlotCount / 2 <= index->patternCount) {
+    resizePatternSlots(index, slotCountFor(index->patternCount + 1));
+  }
+
+  PatternIndexSlot slot = {.hash = hash, .pattern = pattern};
+  placePattern(index->patternSlots, index->patternSlotCount, slot);
+  ++index->patternCount;
+}
+
+bool addIndexedExternalId(PatternIndex *index, uint32_t iid, uint32_t sid) {
+  if (index->idSlotCount / 2 <= index->idCount) {
+    resizeIdSlots(index, slotCountFor(index->idCount + 1));
+  }
+
+  if (!placeId(index->idSlots, index->idSlotCount,
+               (uint64_t)iid << 32 | sid)) {
+    return false;
+  }
+
+  ++index->idCount;
+  return true;
+}
+
+void reservePatternIndex(PatternIndex *index, int count) {
+  uint32_t patternSlotCount = slotCountFor(index->patternCount + count);
+  if (patternSlotCount > index->patternSlotCount) {
+    resizePatternSlots(index, patternSlotCount);
+  }
+
+  uint32_t idSlotCount = slotCountFor(index->idCount + count);
+  if (idSlotCount > index->idSlotCount) {
+    resizeIdSlots(index, idSlotCount);
+  }
+}
+
+void freePatternIndex(PatternIndex *index) {
+  free(index->patternSlots);
+  free(index->idSlots);
+  memset(index, 0, sizeof(*index));
+}
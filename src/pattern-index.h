@@ -0,0 +1,48 @@
+#ifndef DFC_PATTERN_INDEX_H
+#define DFC_PATTERN_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct _dfc_pattern;
+
+typedef struct {
+  uint64_t hash;
+  struct _dfc_pattern *pattern;  // NULL if the slot is empty
+} PatternIndexSlot;
+
+/*
+ * Finds the patterns added before compiling by all of their bytes, and the
+ * external ids added to each of them. Both tables are open addressed with
+ * linear probing and grow before they are half full, so adding is O(1) no
+ * matter how similar the patterns are.
+ * An index of zeroes is empty.
+ */
+typedef struct {
+  PatternIndexSlot *patternSlots;
+  uint32_t patternSlotCount;
+  uint32_t patternCount;
+
+  // internal id in the upper, external id in the lower half
+  uint64_t *idSlots;
+  uint32_t idSlotCount;
+  uint32_t idCount;
+} PatternIndex;
+
+uint64_t hashPatternKey(const uint8_t *pattern, int length);
+
+// NULL if no pattern with these bytes was added, hash is its hashPatternKey
+struct _dfc_pattern *findIndexedPattern(PatternIndex *index,
+                                        const uint8_t *pattern, int length,
+                                        uint64_t hash);
+void addIndexedPattern(PatternIndex *index, struct _dfc_pattern *pattern,
+                       uint64_t hash);
+
+// false if the pattern has the external id already
+bool addIndexedExternalId(PatternIndex *index, uint32_t iid, uint32_t sid);
+
+// makes room for count more patterns and ids without growing in between
+void reservePatternIndex(PatternIndex *index, int count);
+void freePatternIndex(PatternIndex *index);
+
+#endif
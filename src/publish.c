@@ -0,0 +1,122 @@
+#include "publish.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "memory.h"
+#include "ring.h"
+
+/*
+ * Read-copy-update of the structure searched by many threads.
+ *
+ * Every published structure counts its references, one held by the publisher
+ * while it is current and one per reader. The last one to let go frees it, so
+ * searches in flight finish on the structure they started with.
+ *
+ * Between loading the current structure and counting its reference, a reader
+ * is pinned. A publisher waits for the pinned readers after swapping, as they
+ * may have loaded the old structure. The pins are split by the parity of an
+ * epoch, which is flipped before waiting for each parity, so new readers can
+ * not keep a publisher waiting.
+ */
+typedef struct DfcPublication_ {
+  atomic_int references;
+} DfcPublication;
+
+struct DfcPublisher_ {
+  _Atomic(DFC_STRUCTURE *) current;
+
+  atomic_uint epoch;
+  atomic_int pinned[2];
+
+  // publishers wait for the pins one after another
+  pthread_mutex_t publishing;
+};
+
+static void attachPublication(DFC_STRUCTURE *dfc) {
+  // the OpenCL buffers and kernel are shared by all structures
+  if (shouldUseOpenCl()) {
+    fprintf(stderr, "Structures can only be published when searched on the "
+                    "host\n");
+    exit(PUBLISHING_NEEDS_HOST_SEARCH_EXIT_CODE);
+  }
+
+  if (dfc->publication) {
+    fprintf(stderr, "A structure may only be published once\n");
+    exit(STRUCTURE_PUBLISHED_TWICE_EXIT_CODE);
+  }
+
+  dfc->publication = malloc(sizeof(DfcPublication));
+  if (!dfc->publication) {
+    fprintf(stderr, "Could not allocate publication\n");
+    exit(1);
+  }
+
+  atomic_init(&dfc->publication->references, 1);
+}
+
+DFC_PUBLISHER *createPublisher(DFC_STRUCTURE *dfc) {
+  DFC_PUBLISHER *publisher = malloc(sizeof(DFC_PUBLISHER));
+  if (!publisher) {
+    fprintf(stderr, "Could not allocate publisher\n");
+    exit(1);
+  }
+
+  attachPublication(dfc);
+
+  atomic_init(&publisher->current, dfc);
+  atomic_init(&publisher->epoch, 0);
+  atomic_init(&publisher->pinned[0], 0);
+  atomic_init(&publisher->pinned[1], 0);
+  pthread_mutex_init(&publisher->publishing, NULL);
+
+  return publisher;
+}
+
+void freePublisher(DFC_PUBLISHER *publisher) {
+  releaseStructure(atomic_load(&publisher->current));
+
+  pthread_mutex_destroy(&publisher->publishing);
+  free(publisher);
+}
+
+static void waitForPinnedReaders(DFC_PUBLISHER *publisher) {
+  for (int i = 0; i < 2; ++i) {
+    unsigned int parity = atomic_fetch_add(&publisher->epoch, 1) & 1;
+
+    int attempt = 0;
+    while (atomic_load(&publisher->pinned[parity])) {
+      backOff(&attempt);
+    }
+  }
+}
+
+void publishStructure(DFC_PUBLISHER *publisher, DFC_STRUCTURE *dfc) {
+  attachPublication(dfc);
+
+  pthread_mutex_lock(&publisher->publishing);
+  DFC_STRUCTURE *old = atomic_exchange(&publisher->current, dfc);
+  waitForPinnedReaders(publisher);
+  pthread_mutex_unlock(&publisher->publishing);
+
+  releaseStructure(old);
+}
+
+DFC_STRUCTURE *acquireStructure(DFC_PUBLISHER *publisher) {
+  unsigned int parity = atomic_load(&publisher->epoch) & 1;
+  atomic_fetch_add(&publisher->pinned[parity], 1);
+
+  DFC_STRUCTURE *dfc = atomic_load(&publisher->current);
+  atomic_fetch_add(&dfc->publication->references, 1);
+
+  atomic_fetch_sub(&publisher->pinned[parity], 1);
+
+  return dfc;
+}
+
+void releaseStructure(DFC_STRUCTURE *dfc) {
+  if (atomic_fetch_sub(&dfc->publication->references, 1) == 1) {
+    free(dfc->publication);
+    freeDfcStructure(dfc);
+  }
+}
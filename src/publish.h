@@ -0,0 +1,13 @@
+#ifndef DFC_PUBLISH_H
+#define DFC_PUBLISH_H
+
+#include "dfc.h"
+
+DFC_PUBLISHER *createPublisher(DFC_STRUCTURE *dfc);
+void freePublisher(DFC_PUBLISHER *publisher);
+
+void publishStructure(DFC_PUBLISHER *publisher, DFC_STRUCTURE *dfc);
+DFC_STRUCTURE *acquireStructure(DFC_PUBLISHER *publisher);
+void releaseStructure(DFC_STRUCTURE *dfc);
+
+#endif
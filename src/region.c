@@ -0,0 +1,90 @@
+#include "region.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static size_t roundUpToHugePage(size_t size) {
+  return (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+static void *mapAnonymous(size_t size, int flags) {
+  return mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+// explicit huge pages are only available if the administrator reserved them
+static uint8_t *mapExplicitHugePages(size_t size) {
+#ifdef MAP_HUGETLB
+  void *memory = mapAnonymous(size, MAP_HUGETLB);
+  if (memory != MAP_FAILED) {
+    return memory;
+  }
+#else
+  (void)(size);
+#endif
+
+  return NULL;
+}
+
+// transparent huge pages are only used for ranges aligned to a huge page,
+// which is why one more is mapped and the unaligned ends are given back
+static uint8_t *mapTransparentHugePages(size_t size) {
+  uint8_t *memory = mapAnonymous(size + HUGE_PAGE_SIZE, 0);
+  if (memory == MAP_FAILED) {
+    fprintf(stderr, "Could not map %zu bytes for the DFC tables\n", size);
+    exit(1);
+  }
+
+  uint8_t *aligned = (uint8_t *)roundUpToHugePage((uintptr_t)memory);
+  size_t head = aligned - memory;
+  if (head) {
+    munmap(memory, head);
+  }
+  munmap(aligned + size, HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+  // merely a hint, normal pages are used if it is not followed
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+  return aligned;
+}
+
+HostRegion createHostRegion(size_t size) {
+  size_t mappedSize = roundUpToHugePage(size ? size : 1);
+
+  uint8_t *memory = mapExplicitHugePages(mappedSize);
+  if (!memory) {
+    memory = mapTransparentHugePages(mappedSize);
+  }
+
+  HostRegion region = {.memory = memory, .mappedSize = mappedSize, .used = 0};
+  return region;
+}
+
+void freeHostRegion(HostRegion *region) {
+  if (region->memory) {
+    munmap(region->memory, region->mappedSize);
+  }
+
+  region->memory = NULL;
+  region->mappedSize = 0;
+  region->used = 0;
+}
+
+void *takeFromHostRegion(HostRegion *region, size_t size) {
+  size = alignToRegion(size);
+  if (region->used + size > region->mappedSize) {
+    fprintf(stderr, "Region of %zu bytes is too small for a table of %zu\n",
+            region->mappedSize, size);
+    exit(1);
+  }
+
+  void *table = region->memory + region->used;
+  region->used += size;
+
+  return table;
+}
@@ -0,0 +1,31 @@
+#ifndef DFC_REGION_H
+#define DFC_REGION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REGION_ALIGNMENT 64
+
+/*
+ * One contiguous, zeroed block of memory which tables are carved out of.
+ * It is backed by huge pages when the system has them, so that random
+ * lookups spread over all tables need only a few TLB entries.
+ */
+typedef struct {
+  uint8_t *memory;
+  size_t mappedSize;
+  size_t used;
+} HostRegion;
+
+// rounds size up to the alignment of the tables in a region
+static inline size_t alignToRegion(size_t size) {
+  return (size + REGION_ALIGNMENT - 1) & ~(size_t)(REGION_ALIGNMENT - 1);
+}
+
+HostRegion createHostRegion(size_t size);
+void freeHostRegion(HostRegion *region);
+
+// every table starts on its own cache line
+void *takeFromHostRegion(HostRegion *region, size_t size);
+
+#endif
@@ -0,0 +1,140 @@
+#include "ring.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// spins before the waiting thread starts yielding its time slice
+#define RING_SPIN_ATTEMPTS 64
+
+typedef struct {
+  atomic_size_t sequence;
+  void *data;
+} RingCell;
+
+struct Ring_ {
+  RingCell *cells;
+  size_t mask;
+
+  // on separate cache lines to keep producers and consumers from contending
+  _Alignas(64) atomic_size_t enqueuePosition;
+  _Alignas(64) atomic_size_t dequeuePosition;
+};
+
+Ring *createRing(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  Ring *ring = aligned_alloc(64, sizeof(Ring));
+  if (!ring) {
+    fprintf(stderr, "Could not allocate ring\n");
+    exit(1);
+  }
+
+  ring->cells = malloc(size * sizeof(RingCell));
+  if (!ring->cells) {
+    fprintf(stderr, "Could not allocate ring cells\n");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < size; ++i) {
+    atomic_init(&ring->cells[i].sequence, i);
+    ring->cells[i].data = NULL;
+  }
+
+  ring->mask = size - 1;
+  atomic_init(&ring->enqueuePosition, 0);
+  atomic_init(&ring->dequeuePosition, 0);
+
+  return ring;
+}
+
+void destroyRing(Ring *ring) {
+  free(ring->cells);
+  free(ring);
+}
+
+bool tryPushToRing(Ring *ring, void *data) {
+  size_t position =
+      atomic_load_explicit(&ring->enqueuePosition, memory_order_relaxed);
+
+  for (;;) {
+    RingCell *cell = &ring->cells[position & ring->mask];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &ring->enqueuePosition, &position, position + 1,
+              memory_order_relaxed, memory_order_relaxed)) {
+        cell->data = data;
+        atomic_store_explicit(&cell->sequence, position + 1,
+                              memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      return false;  // full
+    } else {
+      position =
+          atomic_load_explicit(&ring->enqueuePosition, memory_order_relaxed);
+    }
+  }
+}
+
+bool tryPopFromRing(Ring *ring, void **data) {
+  size_t position =
+      atomic_load_explicit(&ring->dequeuePosition, memory_order_relaxed);
+
+  for (;;) {
+    RingCell *cell = &ring->cells[position & ring->mask];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &ring->dequeuePosition, &position, position + 1,
+              memory_order_relaxed, memory_order_relaxed)) {
+        *data = cell->data;
+        atomic_store_explicit(&cell->sequence, position + ring->mask + 1,
+                              memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      return false;  // empty
+    } else {
+      position =
+          atomic_load_explicit(&ring->dequeuePosition, memory_order_relaxed);
+    }
+  }
+}
+
+void backOff(int *attempt) {
+  if (*attempt < RING_SPIN_ATTEMPTS) {
+    ++*attempt;
+  } else {
+    sched_yield();
+  }
+}
+
+void pushToRing(Ring *ring, void *data) {
+  int attempt = 0;
+  while (!tryPushToRing(ring, data)) {
+    backOff(&attempt);
+  }
+}
+
+void *popFromRing(Ring *ring) {
+  void *data;
+  int attempt = 0;
+  while (!tryPopFromRing(ring, &data)) {
+    backOff(&attempt);
+  }
+
+  return data;
+}
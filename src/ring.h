@@ -0,0 +1,35 @@
+#ifndef DFC_RING_H
+#define DFC_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free multi-producer multi-consumer queue of pointers
+ * (Dmitry Vyukov's array based queue).
+ * The capacity is rounded up to a power of two.
+ */
+typedef struct Ring_ Ring;
+
+Ring *createRing(size_t capacity);
+void destroyRing(Ring *ring);
+
+// return false instead of blocking if the ring is full or empty
+bool tryPushToRing(Ring *ring, void *data);
+bool tryPopFromRing(Ring *ring, void **data);
+
+// block until there is space or data, which applies backpressure
+void pushToRing(Ring *ring, void *data);
+void *popFromRing(Ring *ring);
+
+void backOff(int *attempt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef DFC_SEARCH_CPU_H
+#define DFC_SEARCH_CPU_H
+
+#include <stdio.h>
+
+#include "dfc.h"
+#include "filter-cpu.h"
+#include "search.h"
+
+typedef struct {
+  int position;
+  PID_TYPE pid;
+} CpuMatch;
+
+/*
+ * Destination of the matches found by the CPU search.
+ * If batch is set every match is passed on immediately, otherwise the
+ * matches are buffered so that they may be delivered later on.
+ */
+typedef struct {
+  MatchBatch *batch;
+
+  CpuMatch *matches;
+  int capacity;
+
+  int matchCount;
+} MatchSink;
+
+static inline MatchSink createDirectMatchSink(MatchBatch *batch) {
+  MatchSink sink = {
+      .batch = batch, .matches = NULL, .capacity = 0, .matchCount = 0};
+  return sink;
+}
+
+static inline MatchSink createBufferedMatchSink() {
+  return createDirectMatchSink(NULL);
+}
+
+static inline void emitMatch(MatchSink *sink, int position, PID_TYPE pid) {
+  if (sink->batch) {
+    addToMatchBatch(sink->batch, position, pid);
+  } else {
+    if (sink->matchCount == sink->capacity) {
+      sink->capacity = sink->capacity ? sink->capacity * 2 : 64;
+      sink->matches =
+          realloc(sink->matches, sink->capacity * sizeof(CpuMatch));
+      if (!sink->matches) {
+        fprintf(stderr, "Could not allocate match buffer\n");
+        exit(1);
+      }
+    }
+
+    sink->matches[sink->matchCount].position = position;
+    sink->matches[sink->matchCount].pid = pid;
+  }
+
+  ++sink->matchCount;
+}
+
+static inline void deliverBufferedMatches(MatchSink *sink, MatchBatch *batch) {
+  for (int i = 0; i < sink->matchCount; ++i) {
+    addToMatchBatch(batch, sink->matches[i].position, sink->matches[i].pid);
+  }
+}
+
+/*
+ * Searches the positions [start, end) of the input.
+ * Patterns may extend past end, but never past inputLength.
+ */
+void searchCpuRange(DFC_STRUCTURE *dfc, CpuFilterFunction filter,
+                    uint8_t *input, int start, int end, int inputLength,
+                    MatchSink *sink);
+
+/*
+ * Passes the buffered matches starting in [start, end) on to the sink, in
+ * input order, and frees the buffer. Patterns keyed on their rarest fragment
+ * are found behind their start, so their matches may be out of order.
+ */
+void deliverMatchesInOrder(MatchSink *found, int start, int end,
+                           MatchSink *sink);
+
+void setupParallelCpuSearch();
+void releaseParallelCpuSearch();
+
+// searches the positions [0, end) of the input, like searchCpuRange
+bool shouldSearchInParallel(int end);
+int searchChunkInParallel(DFC_STRUCTURE *dfc, CpuFilterFunction filter,
+                          uint8_t *input, int end, int inputLength,
+                          MatchBatch *batch);
+
+#endif
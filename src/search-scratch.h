@@ -0,0 +1,11 @@
+#ifndef DFC_SEARCH_SCRATCH_H
+#define DFC_SEARCH_SCRATCH_H
+
+#include "dfc.h"
+
+DFC_SCRATCH *allocateScratch();
+int searchWithScratch(DFC_STRUCTURE *dfc, DFC_SCRATCH *scratch,
+                      const uint8_t *input, int length,
+                      MatchBatchFunction onMatches, void *userData);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef DFC_SEARCH_STREAM_H
+#define DFC_SEARCH_STREAM_H
+
+#include "dfc.h"
+#include "search.h"
+
+DFC_STREAM *openStream(DFC_STRUCTURE *dfc, MatchBatch batch);
+int writeToStream(DFC_STREAM *stream, const uint8_t *data, int length);
+int closeStream(DFC_STREAM *stream);
+
+#endif
@@ -3,6 +3,37 @@
 
 #include "dfc.h"
 
-int search(ReadFunction read, MatchFunction onMatch);
+typedef struct {
+  DFC_MATCH *matches;
+  int capacity;
+  int matchCount;
+
+  MatchBatchFunction onMatches;
+  void *userData;
+
+  // offset of the chunk whose matches are currently delivered
+  uint64_t chunkOffset;
+} MatchBatch;
+
+static inline void flushMatchBatch(MatchBatch *batch) {
+  if (batch->matchCount) {
+    batch->onMatches(batch->matches, batch->matchCount, batch->userData);
+    batch->matchCount = 0;
+  }
+}
+
+// position is relative to the current chunk
+static inline void addToMatchBatch(MatchBatch *batch, int position,
+                                   PID_TYPE pid) {
+  DFC_MATCH *match = &batch->matches[batch->matchCount];
+  match->offset = batch->chunkOffset + position;
+  match->pid = pid;
+
+  if (++batch->matchCount == batch->capacity) {
+    flushMatchBatch(batch);
+  }
+}
+
+int search(ReadFunction read, MatchBatch *batch);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <stddef.h>
+
+#include "filter-cpu.h"
+#include "shared.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_X86_VECTOR_FILTER 1
+#include <immintrin.h>
+#else
+#define HAS_X86_VECTOR_FILTER 0
+#endif
+
+#if HAS_X86_VECTOR_FILTER
+
+/*
+ * The direct filters are bit arrays indexed by the 16 bit fragment
+ * (input[1] << 8 | input[0]). Bit (fragment & 7) of byte (fragment >> 3) is
+ * the same as bit (fragment & 31) of the little endian 32 bit word
+ * (fragment >> 5), which lets us gather whole words without reading past the
+ * end of the filter.
+ */
+#define DF_WORD_SHIFT 5
+#define DF_BIT_IN_WORD_MASK 31
+
+__attribute__((target("avx2"))) static inline __m256i fragmentsAvx2(
+    const uint8_t *input) {
+  __m256i first = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)input));
+  __m256i second =
+      _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(input + 1)));
+
+  return _mm256_or_si256(first, _mm256_slli_epi32(second, 8));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t probeAvx2(
+    const uint8_t *df, __m256i fragments) {
+  __m256i wordIndices = _mm256_srli_epi32(fragments, DF_WORD_SHIFT);
+  __m256i bitIndices =
+      _mm256_and_si256(fragments, _mm256_set1_epi32(DF_BIT_IN_WORD_MASK));
+
+  __m256i words = _mm256_i32gather_epi32((const int *)df, wordIndices, 4);
+  __m256i bits = _mm256_slli_epi32(_mm256_srlv_epi32(words, bitIndices), 31);
+
+  return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(bits));
+}
+
+__attribute__((target("avx2"))) static void filterAvx2(
+    const uint8_t *dfSmall, const uint8_t *dfLarge, const uint8_t *input,
+    uint64_t *candidatesSmall, uint64_t *candidatesLarge) {
+  uint64_t small = 0;
+  uint64_t large = 0;
+
+  for (int i = 0; i < CPU_FILTER_BLOCK_SIZE; i += 8) {
+    __m256i fragments = fragmentsAvx2(input + i);
+
+    small |= (uint64_t)probeAvx2(dfSmall, fragments) << i;
+    large |= (uint64_t)probeAvx2(dfLarge, fragments) << i;
+  }
+
+  *candidatesSmall = small;
+  *candidatesLarge = large;
+}
+
+__attribute__((target("avx512f"))) static inline __m512i fragmentsAvx512(
+    const uint8_t *input) {
+  __m512i first = _mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *)input));
+  __m512i second =
+      _mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *)(input + 1)));
+
+  return _mm512_or_si512(first, _mm512_slli_epi32(second, 8));
+}
+
+__attribute__((target("avx512f"))) static inline uint32_t probeAvx512(
+    const uint8_t *df, __m512i fragments) {
+  __m512i wordIndices = _mm512_srli_epi32(fragments, DF_WORD_SHIFT);
+  __m512i bitIndices =
+      _mm512_and_si512(fragments, _mm512_set1_epi32(DF_BIT_IN_WORD_MASK));
+
+  __m512i words = _mm512_i32gather_epi32(wordIndices, df, 4);
+  __m512i bits = _mm512_srlv_epi32(words, bitIndices);
+
+  return _mm512_test_epi32_mask(bits, _mm512_set1_epi32(1));
+}
+
+__attribute__((target("avx512f"))) static void filterAvx512(
+    const uint8_t *dfSmall, const uint8_t *dfLarge, const uint8_t *input,
+    uint64_t *candidatesSmall, uint64_t *candidatesLarge) {
+  uint64_t small = 0;
+  uint64_t large = 0;
+
+  for (int i = 0; i < CPU_FILTER_BLOCK_SIZE; i += 16) {
+    __m512i fragments = fragmentsAvx512(input + i);
+
+    small |= (uint64_t)probeAvx512(dfSmall, fragments) << i;
+    large |= (uint64_t)probeAvx512(dfLarge, fragments) << i;
+  }
+
+  *candidatesSmall = small;
+  *candidatesLarge = large;
+}
+
+#endif
+
+/*
+ * Collects the filter bits without branching on them, so that the positions
+ * without candidates cost the same as the others
+ */
+static void filterScalar(const uint8_t *dfSmall, const uint8_t *dfLarge,
+                         const uint8_t *input, uint64_t *candidatesSmall,
+                         uint64_t *candidatesLarge) {
+  uint64_t small = 0;
+  uint64_t large = 0;
+
+  for (int i = 0; i < CPU_FILTER_BLOCK_SIZE; ++i) {
+    uint16_t fragment = input[i + 1] << 8 | input[i];
+    int byteIndex = BINDEX(fragment);
+    int bitIndex = fragment & 0x7;
+
+    small |= (uint64_t)((dfSmall[byteIndex] >> bitIndex) & 1) << i;
+    large |= (uint64_t)((dfLarge[byteIndex] >> bitIndex) & 1) << i;
+  }
+
+  *candidatesSmall = small;
+  *candidatesLarge = large;
+}
+
+CpuFilterFunction getCpuFilter() {
+#if HAS_X86_VECTOR_FILTER
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f")) {
+    return filterAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return filterAvx2;
+  }
+#endif
+
+  return filterScalar;
+}
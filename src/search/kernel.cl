@@ -1,61 +1,121 @@
 #include "shared-functions.h"
 
+// the sizes of the compiled structure are passed when building the program
 uint hashForLargeCompactTableCL(const uint32_t input) {
-  return (input * 8389) & (CL_CT_LARGE_MASK);
+  return hashForLargeCompactTable(input, CL_CT_LARGE_MULTIPLIER,
+                                  CL_CT_LARGE_SHIFT, CL_CT_LARGE_BITS);
 }
 
-ushort directFilterHashCL(const int32_t val) {
-  return BINDEX((val * 8387) & CL_DF_MASK);
+uint cuckooHashForLargeCompactTableCL(const uint32_t input) {
+  return hashForLargeCompactTable(input, CL_CT_LARGE_CUCKOO_MULTIPLIER,
+                                  CL_CT_LARGE_SHIFT, CL_CT_LARGE_BITS);
 }
 
-int my_strncmp(__global const unsigned char *a, __global const unsigned char *b,
-               const int n) {
-  for (int i = 0; i < n; ++i) {
-    if (a[i] != b[i]) return -1;
-  }
-  return 0;
+uint directFilterHashCL(const uint32_t val) {
+  return directFilterHash(val, CL_DF_LARGE_HASH_BITS);
+}
+
+uint hashForLongCompactTableCL(const ulong fragment) {
+  return hashForLongCompactTable(fragment, CL_CT_LONG_BITS);
+}
+
+uint directFilterLongHashCL(const ulong fragment) {
+  return directFilterLongHash(fragment, CL_DF_LONG_HASH_BITS);
+}
+
+// see the verification in search-cpu.c
+bool equalAt(__global const uchar *input, __global const uchar *folded,
+             const int length, const int offset) {
+  return (as_ulong(vload8(0, input + offset)) |
+          as_ulong(vload8(0, folded + length + offset))) ==
+         as_ulong(vload8(0, folded + offset));
+}
+
+bool equal32At(__global const uchar *input, __global const uchar *folded,
+               const int length, const int offset) {
+  return (as_uint(vload4(0, input + offset)) |
+          as_uint(vload4(0, folded + length + offset))) ==
+         as_uint(vload4(0, folded + offset));
+}
+
+bool equal16At(__global const uchar *input, __global const uchar *folded,
+               const int length, const int offset) {
+  return (as_ushort(vload2(0, input + offset)) |
+          as_ushort(vload2(0, folded + length + offset))) ==
+         as_ushort(vload2(0, folded + offset));
 }
 
-uchar tolower(const uchar c) {
-  if (c >= 65 && c <= 90) {
-    return c + 32;
+bool verifyUpTo8(__global const uchar *input, __global const uchar *folded,
+                 const int length) {
+  if (length >= 4) {
+    return equal32At(input, folded, length, 0) &&
+           equal32At(input, folded, length, length - 4);
   }
-  return c;
+  if (length >= 2) {
+    return equal16At(input, folded, length, 0) &&
+           equal16At(input, folded, length, length - 2);
+  }
+  return (input[0] | folded[length]) == folded[0];
+}
+
+bool verifyUpTo16(__global const uchar *input, __global const uchar *folded,
+                  const int length) {
+  return equalAt(input, folded, length, 0) &&
+         equalAt(input, folded, length, length - 8);
+}
+
+bool verifyUpTo32(__global const uchar *input, __global const uchar *folded,
+                  const int length) {
+  return equalAt(input, folded, length, 0) &&
+         equalAt(input, folded, length, 8) &&
+         equalAt(input, folded, length, length - 16) &&
+         equalAt(input, folded, length, length - 8);
 }
 
-int my_strncasecmp(__global const unsigned char *a,
-                   __global const unsigned char *b, const int n) {
-  for (int i = 0; i < n; ++i) {
-    if (tolower(a[i]) != tolower(b[i])) return -1;
+bool verifyLonger(__global const uchar *input, __global const uchar *folded,
+                  const int length) {
+  for (int i = 0; i < length - 8; i += 8) {
+    if (!equalAt(input, folded, length, i)) {
+      return false;
+    }
   }
-  return 0;
+  return equalAt(input, folded, length, length - 8);
 }
 
 bool doesPatternMatch(__global const uchar *start,
-                      __global const uchar *pattern, const int length,
-                      const bool isCaseInsensitive) {
-  if (isCaseInsensitive) {
-    return !my_strncasecmp(start, pattern, length);
+                      __global const DFC_FIXED_PATTERN *pattern,
+                      __global const uchar *patternBytes) {
+  __global const uchar *folded = patternBytes + pattern->pattern_offset;
+  const int length = pattern->pattern_length;
+
+  switch (pattern->verifier) {
+    case VERIFY_UP_TO_8:
+      return verifyUpTo8(start, folded, length);
+    case VERIFY_UP_TO_16:
+      return verifyUpTo16(start, folded, length);
+    case VERIFY_UP_TO_32:
+      return verifyUpTo32(start, folded, length);
+    default:
+      return verifyLonger(start, folded, length);
   }
-  return !my_strncmp(start, pattern, length);
 }
 
 void verifySmall(__global const CompactTableSmallEntry *ct,
                  __global const PID_TYPE *pids,
                  __global const DFC_FIXED_PATTERN *patterns,
+                 __global const uchar *patternBytes,
                  __global uchar *input, const int currentPos,
                  const int inputLength, __global VerifyResult *result) {
   ct += input[0];  // input[0] is the "hash"
 
-  for (ushort i = 0; i < ct->pidCount; ++i) {
+  for (uint i = 0; i < ct->pidCount; ++i) {
     PID_TYPE pid = (pids + ct->offset)[i];
 
     if (inputLength - currentPos >= (patterns + pid)->pattern_length &&
-        doesPatternMatch(input, (patterns + pid)->original_pattern,
-                         (patterns + pid)->pattern_length,
-                         (patterns + pid)->is_case_insensitive)) {
+        doesPatternMatch(input, patterns + pid, patternBytes)) {
       if (result->matchCount < MAX_MATCHES_PER_THREAD) {
         result->matches[result->matchCount] = pid;
+        result->positions[result->matchCount] = currentPos % THREAD_GRANULARITY;
       }
 
       ++result->matchCount;
@@ -63,33 +123,124 @@ void verifySmall(__global const CompactTableSmallEntry *ct,
   }
 }
 
+// see matchAtFragment in search-cpu.c
+bool matchesAtFragment(__global const uchar *fragment, const int fragmentPos,
+                       const int inputLength,
+                       __global const DFC_FIXED_PATTERN *pattern,
+                       __global const uchar *patternBytes) {
+  const int position = fragmentPos - pattern->fragment_offset;
+
+  return position >= 0 && inputLength - position >= pattern->pattern_length &&
+         doesPatternMatch(fragment - pattern->fragment_offset, pattern,
+                          patternBytes);
+}
+
+// the entry of the fragment or -1, the cuckoo variant holds it in one of two
+// slots while the chained one has to scan a bucket
+int findLargeCtEntry(__global const CompactTableLargeBucket *buckets,
+                     __global const CompactTableLargeEntry *entries,
+                     const uint bytePattern) {
+  if (CUCKOO_LARGE_CT) {
+    // empty slots have no pids and would otherwise match a zero fragment
+    uint slot = hashForLargeCompactTableCL(bytePattern);
+    if (entries[slot].pidCount && entries[slot].pattern == bytePattern) {
+      return slot;
+    }
+
+    slot = cuckooHashForLargeCompactTableCL(bytePattern);
+    if (entries[slot].pidCount && entries[slot].pattern == bytePattern) {
+      return slot;
+    }
+
+    return -1;
+  }
+
+  buckets += hashForLargeCompactTableCL(bytePattern);
+  for (uint i = 0; i < buckets->entryCount; ++i) {
+    if ((entries + buckets->entryOffset + i)->pattern == bytePattern) {
+      return buckets->entryOffset + i;
+    }
+  }
+
+  return -1;
+}
+
 void verifyLarge(__global const CompactTableLargeBucket *buckets,
                  __global const CompactTableLargeEntry *entries,
                  __global const PID_TYPE *pids,
                  __global const DFC_FIXED_PATTERN *patterns,
+                 __global const uchar *patternBytes,
                  const uint bytePattern, __global const uchar *input,
                  const int currentPos, const int inputLength,
                  __global VerifyResult *result) {
-  buckets += hashForLargeCompactTable(bytePattern);
-  ushort entryOffset = buckets->entryOffset;
+  int entryIndex = findLargeCtEntry(buckets, entries, bytePattern);
+  if (entryIndex < 0) {
+    return;
+  }
 
-  for (ushort i = 0; i < buckets->entryCount; ++i) {
-    if ((entries + entryOffset + i)->pattern == bytePattern) {
-      ushort pidOffset = (entries + entryOffset + i)->pidOffset;
+  __global const CompactTableLargeEntry *entry = entries + entryIndex;
+  for (uint j = 0; j < entry->pidCount; ++j) {
+    PID_TYPE pid = pids[entry->pidOffset + j];
 
-      for (ushort j = 0; j < (entries + entryOffset + i)->pidCount; ++j) {
-        PID_TYPE pid = pids[pidOffset + j];
+    // the host moves the position back to the start of the pattern
+    if (matchesAtFragment(input, currentPos, inputLength, patterns + pid,
+                          patternBytes)) {
+      if (result->matchCount < MAX_MATCHES_PER_THREAD) {
+        result->matches[result->matchCount] = pid;
+        result->positions[result->matchCount] =
+            currentPos % THREAD_GRANULARITY;
+      }
 
-        if (inputLength - currentPos >= (patterns + pid)->pattern_length) {
-          if (doesPatternMatch(input, (patterns + pid)->original_pattern,
-                               (patterns + pid)->pattern_length,
-                               (patterns + pid)->is_case_insensitive)) {
-            if (result->matchCount < MAX_MATCHES_PER_THREAD) {
-              result->matches[result->matchCount] = pid;
-            }
+      ++result->matchCount;
+    }
+  }
+}
 
-            ++result->matchCount;
+ulong longFragmentAt(__global const uchar *input) {
+  return foldLongFragment(as_ulong(vload8(0, input)));
+}
+
+bool isInLongHashDf(__global const uchar *df, const ulong fragment) {
+  const uint bit = directFilterLongHashCL(fragment);
+  return df[BINDEX(bit)] & BMASK(bit);
+}
+
+// the 2 byte direct filter is shared with the large patterns, the long hash
+// direct filter is checked here
+void verifyLong(__global const uchar *dfLongHash,
+                __global const CompactTableLongBucket *buckets,
+                __global const CompactTableLongEntry *entries,
+                __global const PID_TYPE *pids,
+                __global const DFC_FIXED_PATTERN *patterns,
+                __global const uchar *patternBytes,
+                __global const uchar *input, const int currentPos,
+                const int inputLength, __global VerifyResult *result) {
+  if (inputLength - currentPos < LONG_DF_MIN_PATTERN_SIZE) {
+    return;
+  }
+
+  const ulong fragment = longFragmentAt(input);
+  if (!isInLongHashDf(dfLongHash, fragment)) {
+    return;
+  }
+
+  buckets += hashForLongCompactTableCL(fragment);
+  entries += buckets->entryOffset;
+
+  for (uint i = 0; i < buckets->entryCount; ++i) {
+    if (entries[i].pattern == fragment) {
+      for (uint j = 0; j < entries[i].pidCount; ++j) {
+        PID_TYPE pid = pids[entries[i].pidOffset + j];
+
+        if (matchesAtFragment(input, currentPos, inputLength, patterns + pid,
+                              patternBytes)) {
+          if (result->matchCount < MAX_MATCHES_PER_THREAD) {
+            result->matches[result->matchCount] = pid;
+            result->positions[result->matchCount] =
+                currentPos % THREAD_GRANULARITY;
           }
+
+          ++result->matchCount;
         }
       }
 
@@ -98,24 +249,64 @@ void verifyLarge(__global const CompactTableLargeBucket *buckets,
   }
 }
 
+// see isInBloomFilter in search-cpu.c
+bool isInBloomFilter(__global const uchar *df, const uint data) {
+  const ulong hash = bloomFilterHash(data);
+  df += bloomFilterBlockOffset(hash, CL_DF_LARGE_HASH_BITS);
+
+  uchar isIn = 1;
+  for (int j = 0; j < BLOOM_FILTER_HASH_COUNT; ++j) {
+    const uint bit = bloomFilterBit(hash, j);
+    isIn &= df[BINDEX(bit)] >> (bit & 0x7);
+  }
+
+  return isIn;
+}
+
+bool isInBloomFilterLocal(__local const uchar *df, const uint data) {
+  const ulong hash = bloomFilterHash(data);
+  df += bloomFilterBlockOffset(hash, CL_DF_LARGE_HASH_BITS);
+
+  uchar isIn = 1;
+  for (int j = 0; j < BLOOM_FILTER_HASH_COUNT; ++j) {
+    const uint bit = bloomFilterBit(hash, j);
+    isIn &= df[BINDEX(bit)] >> (bit & 0x7);
+  }
+
+  return isIn;
+}
+
 bool isInHashDf(__global const uchar *df, const uint data) {
+  if (BLOCKED_BLOOM_FILTER) {
+    return isInBloomFilter(df, data);
+  }
+
   return df[directFilterHashCL(data)] & BMASK(data & CL_DF_MASK);
 }
 
 bool isInHashDfLocal(__local const uchar *df, const uint data) {
+  if (BLOCKED_BLOOM_FILTER) {
+    return isInBloomFilterLocal(df, data);
+  }
+
   return df[directFilterHashCL(data)] & BMASK(data & CL_DF_MASK);
 }
 
 __kernel void search(const int inputLength, __global const uchar *input,
                      __global const DFC_FIXED_PATTERN *patterns,
+                     __global const uchar *patternBytes,
                      __global const uchar *const dfSmall,
                      __global const uchar *const dfLarge,
                      __global const uchar *const dfLargeHash,
+                     __global const uchar *const dfLongHash,
                      __global const CompactTableSmallEntry *ctSmallEntries,
                      __global const PID_TYPE *ctSmallPids,
                      __global const CompactTableLargeBucket *ctLargeBuckets,
                      __global const CompactTableLargeEntry *ctLargeEntries,
                      __global const PID_TYPE *ctLargePids,
+                     __global const CompactTableLongBucket *ctLongBuckets,
+                     __global const CompactTableLongEntry *ctLongEntries,
+                     __global const PID_TYPE *ctLongPids,
                      __global VerifyResult *result) {
   int i;
   {
@@ -142,15 +333,20 @@ __kernel void search(const int inputLength, __global const uchar *input,
     const short bitMask = BMASK(data & CL_DF_MASK);
 
     if (dfSmall[byteIndex] & bitMask) {
-      verifySmall(ctSmallEntries, ctSmallPids, patterns, input, i, inputLength,
-                  result);
+      verifySmall(ctSmallEntries, ctSmallPids, patterns, patternBytes, input, i,
+                  inputLength, result);
     }
 
     const uint dataLong =
         input[3] << 24 | input[2] << 16 | input[1] << 8 | input[0];
     if ((dfLarge[byteIndex] & bitMask) && isInHashDf(dfLargeHash, dataLong)) {
       verifyLarge(ctLargeBuckets, ctLargeEntries, ctLargePids, patterns,
-                  dataLong, input, i, inputLength, result);
+                  patternBytes, dataLong, input, i, inputLength, result);
+    }
+
+    if (dfLarge[byteIndex] & bitMask) {
+      verifyLong(dfLongHash, ctLongBuckets, ctLongEntries, ctLongPids, patterns,
+                 patternBytes, input, i, inputLength, result);
     }
   }
 }
@@ -164,13 +360,18 @@ typedef union {
 __kernel void search_with_image(
     const int inputLength, __global const uchar *input,
     __global const DFC_FIXED_PATTERN *patterns,
+    __global const uchar *patternBytes,
     __read_only const image1d_t dfSmall, __read_only const image1d_t dfLarge,
     __global const uchar *dfLargeHash,
+    __global const uchar *const dfLongHash,
     __global const CompactTableSmallEntry *ctSmallEntries,
     __global const PID_TYPE *ctSmallPids,
     __global const CompactTableLargeBucket *ctLargeBuckets,
     __global const CompactTableLargeEntry *ctLargeEntries,
-    __global const PID_TYPE *ctLargePids, __global VerifyResult *result) {
+    __global const PID_TYPE *ctLargePids,
+    __global const CompactTableLongBucket *ctLongBuckets,
+    __global const CompactTableLongEntry *ctLongEntries,
+    __global const PID_TYPE *ctLongPids, __global VerifyResult *result) {
   int i;
   {
     const uint threadId =
@@ -201,8 +402,8 @@ __kernel void search_with_image(
       const img_read df =
           (img_read)read_imageui(dfSmall, SHIFT_BY_CHANNEL_SIZE(byteIndex));
       if (df.scalar[byteIndex % TEXTURE_CHANNEL_BYTE_SIZE] & bitMask) {
-        verifySmall(ctSmallEntries, ctSmallPids, patterns, input, i,
-                    inputLength, result);
+        verifySmall(ctSmallEntries, ctSmallPids, patterns, patternBytes, input,
+                    i, inputLength, result);
       }
     }
 
@@ -214,7 +415,12 @@ __kernel void search_with_image(
       if ((df.scalar[byteIndex % TEXTURE_CHANNEL_BYTE_SIZE] & bitMask) &&
           isInHashDf(dfLargeHash, dataLong)) {
         verifyLarge(ctLargeBuckets, ctLargeEntries, ctLargePids, patterns,
-                    dataLong, input, i, inputLength, result);
+                    patternBytes, dataLong, input, i, inputLength, result);
+      }
+
+      if (df.scalar[byteIndex % TEXTURE_CHANNEL_BYTE_SIZE] & bitMask) {
+        verifyLong(dfLongHash, ctLongBuckets, ctLongEntries, ctLongPids,
+                   patterns, patternBytes, input, i, inputLength, result);
       }
     }
   }
@@ -223,15 +429,22 @@ __kernel void search_with_image(
 __kernel void search_with_local(
     const int inputLength, __global const uchar *input,
     __global const DFC_FIXED_PATTERN *patterns,
+    __global const uchar *patternBytes,
     __global const uchar *const dfSmall, __global const uchar *const dfLarge,
     __global const uchar *const dfLargeHash,
+    __global const uchar *const dfLongHash,
     __global const CompactTableSmallEntry *ctSmallEntries,
     __global const PID_TYPE *ctSmallPids,
     __global const CompactTableLargeBucket *ctLargeBuckets,
     __global const CompactTableLargeEntry *ctLargeEntries,
-    __global const PID_TYPE *ctLargePids, __global VerifyResult *result) {
+    __global const PID_TYPE *ctLargePids,
+    __global const CompactTableLongBucket *ctLongBuckets,
+    __global const CompactTableLongEntry *ctLongEntries,
+    __global const PID_TYPE *ctLongPids, __global VerifyResult *result) {
   __local uchar dfSmallLocal[DF_SIZE_REAL];
   __local uchar dfLargeLocal[DF_SIZE_REAL];
+  // the large hash direct filter keeps its smallest size if local memory is
+  // used, see chooseTableSizes
   __local uchar dfLargeHashLocal[DF_SIZE_REAL];
 
   for (int j = LOCAL_MEMORY_LOAD_PER_ITEM * get_local_id(0);
@@ -267,8 +480,8 @@ __kernel void search_with_local(
     const short bitMask = BMASK(data & CL_DF_MASK);
 
     if (dfSmallLocal[byteIndex] & bitMask) {
-      verifySmall(ctSmallEntries, ctSmallPids, patterns, input, i, inputLength,
-                  result);
+      verifySmall(ctSmallEntries, ctSmallPids, patterns, patternBytes, input, i,
+                  inputLength, result);
     }
 
     const uint dataLong =
@@ -276,7 +489,13 @@ __kernel void search_with_local(
     if ((dfLargeLocal[byteIndex] & bitMask) &&
         isInHashDfLocal(dfLargeHashLocal, dataLong)) {
       verifyLarge(ctLargeBuckets, ctLargeEntries, ctLargePids, patterns,
-                  dataLong, input, i, inputLength, result);
+                  patternBytes, dataLong, input, i, inputLength, result);
+    }
+
+    // the long hash direct filter is not copied, local memory is scarce
+    if (dfLargeLocal[byteIndex] & bitMask) {
+      verifyLong(dfLongHash, ctLongBuckets, ctLongEntries, ctLongPids, patterns,
+                 patternBytes, input, i, inputLength, result);
     }
   }
 }
@@ -292,14 +511,19 @@ typedef union {
 
 __kernel void search_vec(const int inputLength, __global const uchar *input,
                          __global const DFC_FIXED_PATTERN *patterns,
+                         __global const uchar *patternBytes,
                          __global const uchar *const dfSmall,
                          __global const uchar *const dfLarge,
                          __global const uchar *const dfLargeHash,
+                         __global const uchar *const dfLongHash,
                          __global const CompactTableSmallEntry *ctSmallEntries,
                          __global const PID_TYPE *ctSmallPids,
                          __global const CompactTableLargeBucket *ctLargeBuckets,
                          __global const CompactTableLargeEntry *ctLargeEntries,
                          __global const PID_TYPE *ctLargePids,
+                         __global const CompactTableLongBucket *ctLongBuckets,
+                         __global const CompactTableLongEntry *ctLongEntries,
+                         __global const PID_TYPE *ctLongPids,
                          __global VerifyResult *result) {
   uint threadId = (get_group_id(0) * get_local_size(0) + get_local_id(0));
   int i = threadId * THREAD_GRANULARITY;
@@ -344,8 +568,8 @@ __kernel void search_vec(const int inputLength, __global const uchar *input,
   i = threadId * THREAD_GRANULARITY;
   for (uchar k = 0; i < end; ++k, ++i, ++input) {
     if (matchesSmall[k >> 3].scalar[k % 8]) {
-      verifySmall(ctSmallEntries, ctSmallPids, patterns, input, i, inputLength,
-                  result);
+      verifySmall(ctSmallEntries, ctSmallPids, patterns, patternBytes, input, i,
+                  inputLength, result);
     }
 
     const uint dataLong =
@@ -353,14 +577,20 @@ __kernel void search_vec(const int inputLength, __global const uchar *input,
     if (matchesLarge[k >> 3].scalar[k % 8] &&
         isInHashDf(dfLargeHash, dataLong)) {
       verifyLarge(ctLargeBuckets, ctLargeEntries, ctLargePids, patterns,
-                  dataLong, input, i, inputLength, result);
+                  patternBytes, dataLong, input, i, inputLength, result);
+    }
+
+    if (matchesLarge[k >> 3].scalar[k % 8]) {
+      verifyLong(dfLongHash, ctLongBuckets, ctLongEntries, ctLongPids, patterns,
+                 patternBytes, input, i, inputLength, result);
     }
   }
 }
 
 __kernel void filter(int inputLength, __global uchar *input,
                      __global uchar *dfSmall, __global uchar *dfLarge,
-                     __global uchar *dfLargeHash, __global uchar *result) {
+                     __global uchar *dfLargeHash, __global uchar *dfLongHash,
+                     __global uchar *result) {
   uint i = (get_group_id(0) * get_local_size(0) + get_local_id(0)) *
            THREAD_GRANULARITY;
 
@@ -380,6 +610,11 @@ __kernel void filter(int inputLength, __global uchar *input,
          isInHashDf(dfLargeHash, (input[3 + i] << 24 | input[2 + i] << 16 |
                                   input[1 + i] << 8 | input[i])))
         << 1;
+
+    // set the third bit
+    result[i] |= ((dfLarge[byteIndex] & bitMask) && i < inputLength - 7 &&
+                  isInLongHashDf(dfLongHash, longFragmentAt(input + i)))
+                 << 2;
   }
 }
 
@@ -387,6 +622,7 @@ __kernel void filter_with_image(int inputLength, __global uchar *input,
                                 __read_only image1d_t dfSmall,
                                 __read_only image1d_t dfLarge,
                                 __global uchar *dfLargeHash,
+                                __global uchar *dfLongHash,
                                 __global uchar *result) {
   uint i = (get_group_id(0) * get_local_size(0) + get_local_id(0)) *
            THREAD_GRANULARITY;
@@ -409,18 +645,26 @@ __kernel void filter_with_image(int inputLength, __global uchar *input,
          isInHashDf(dfLargeHash, (input[3 + i] << 24 | input[2 + i] << 16 |
                                   input[1 + i] << 8 | input[i])))
         << 1;
+    result[i] |=
+        ((df.scalar[byteIndex % TEXTURE_CHANNEL_BYTE_SIZE] & bitMask) &&
+         i < inputLength - 7 &&
+         isInLongHashDf(dfLongHash, longFragmentAt(input + i)))
+        << 2;
   }
 }
 __kernel void filter_with_local(int inputLength, __global uchar *input,
                                 __global uchar *dfSmall,
                                 __global uchar *dfLarge,
                                 __global uchar *dfLargeHash,
+                                __global uchar *dfLongHash,
                                 __global uchar *result) {
   uint i = (get_group_id(0) * get_local_size(0) + get_local_id(0)) *
            THREAD_GRANULARITY;
 
   __local uchar dfSmallLocal[DF_SIZE_REAL];
   __local uchar dfLargeLocal[DF_SIZE_REAL];
+  // the large hash direct filter keeps its smallest size if local memory is
+  // used, see chooseTableSizes
   __local uchar dfLargeHashLocal[DF_SIZE_REAL];
 
   for (int j = LOCAL_MEMORY_LOAD_PER_ITEM * get_local_id(0);
@@ -448,6 +692,11 @@ __kernel void filter_with_local(int inputLength, __global uchar *input,
                                   (input[3 + i] << 24 | input[2 + i] << 16 |
                                    input[1 + i] << 8 | input[i])))
                  << 1;
+
+    // set the third bit, the long hash direct filter stays in global memory
+    result[i] |= ((dfLargeLocal[byteIndex] & bitMask) && i < inputLength - 7 &&
+                  isInLongHashDf(dfLongHash, longFragmentAt(input + i)))
+                 << 2;
   }
 }
 
@@ -458,7 +707,8 @@ typedef union {
 
 __kernel void filter_vec(int inputLength, __global uchar *input,
                          __global uchar *dfSmall, __global uchar *dfLarge,
-                         __global uchar *dfLargeHash, __global uchar *result) {
+                         __global uchar *dfLargeHash,
+                         __global uchar *dfLongHash, __global uchar *result) {
   uint i = (get_group_id(0) * get_local_size(0) + get_local_id(0)) *
            THREAD_GRANULARITY;
 
@@ -497,6 +747,10 @@ __kernel void filter_vec(int inputLength, __global uchar *input,
                       (input[3 + i + k] << 24 | input[2 + i + k] << 16 |
                        input[1 + i + k] << 8 | input[i + k])))
           << 1;
+      resultVector.scalar[k] |=
+          (filterResultLarge.scalar[k] && i + k < inputLength - 7 &&
+           isInLongHashDf(dfLongHash, longFragmentAt(input + i + k)))
+          << 2;
     }
 
     vstore8(resultVector.vector, i >> 3, result);
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+
+#include "search-cpu.h"
+#include "thread-pool.h"
+
+// below this amount of positions per thread, splitting a chunk is not worth it
+#define MIN_POSITIONS_PER_THREAD 0x4000
+
+static ThreadPool *threadPool = NULL;
+
+// one per thread, the buffers are kept between chunks to avoid reallocations
+static MatchSink *threadSinks = NULL;
+
+typedef struct {
+  DFC_STRUCTURE *dfc;
+  CpuFilterFunction filter;
+
+  uint8_t *input;
+  int end;
+  int inputLength;
+
+  int rangeCount;
+  int rangeSize;
+} ParallelSearch;
+
+void setupParallelCpuSearch() {
+  // the pipeline has workers of its own
+  int threadCount = getConfiguredThreadCount();
+  if (threadCount < 2 || PIPELINE_SEARCH) {
+    return;
+  }
+
+  threadPool = createThreadPool(threadCount);
+
+  threadSinks = calloc(threadCount, sizeof(MatchSink));
+  if (!threadSinks) {
+    fprintf(stderr, "Could not allocate match buffers for threads\n");
+    exit(1);
+  }
+}
+
+void releaseParallelCpuSearch() {
+  if (!threadPool) {
+    return;
+  }
+
+  for (int i = 0; i < getThreadPoolSize(threadPool); ++i) {
+    free(threadSinks[i].matches);
+  }
+  free(threadSinks);
+  threadSinks = NULL;
+
+  destroyThreadPool(threadPool);
+  threadPool = NULL;
+}
+
+bool shouldSearchInParallel(int end) {
+  return threadPool && end >= 2 * MIN_POSITIONS_PER_THREAD;
+}
+
+static void searchRange(void *argument, int threadIndex) {
+  ParallelSearch *search = (ParallelSearch *)argument;
+  MatchSink *sink = &threadSinks[threadIndex];
+
+  sink->matchCount = 0;
+
+  if (threadIndex >= search->rangeCount) {
+    return;
+  }
+
+  int start = threadIndex * search->rangeSize;
+  int end = start + search->rangeSize;
+  if (end > search->end) {
+    end = search->end;
+  }
+
+  // the range owns the positions, the patterns may extend into the next range
+  searchCpuRange(search->dfc, search->filter, search->input, start, end,
+                 search->inputLength, sink);
+}
+
+int searchChunkInParallel(DFC_STRUCTURE *dfc, CpuFilterFunction filter,
+                          uint8_t *input, int end, int inputLength,
+                          MatchBatch *batch) {
+  int rangeCount = end / MIN_POSITIONS_PER_THREAD;
+  if (rangeCount > getThreadPoolSize(threadPool)) {
+    rangeCount = getThreadPoolSize(threadPool);
+  }
+
+  // keep the ranges aligned to whole filter blocks
+  int rangeSize = (end + rangeCount - 1) / rangeCount;
+  rangeSize = (rangeSize + CPU_FILTER_BLOCK_SIZE - 1) / CPU_FILTER_BLOCK_SIZE *
+              CPU_FILTER_BLOCK_SIZE;
+
+  ParallelSearch search = {.dfc = dfc,
+                           .filter = filter,
+                           .input = input,
+                           .end = end,
+                           .inputLength = inputLength,
+                           .rangeCount = rangeCount,
+                           .rangeSize = rangeSize};
+
+  runOnAllThreads(threadPool, searchRange, &search);
+
+  // the ranges are ordered, so delivering them one after another keeps the
+  // matches in input order
+  int matches = 0;
+  for (int i = 0; i < rangeCount; ++i) {
+    deliverBufferedMatches(&threadSinks[i], batch);
+    matches += threadSinks[i].matchCount;
+  }
+
+  return matches;
+}
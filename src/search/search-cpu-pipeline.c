@@ -0,0 +1,203 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "constants.h"
+#include "memory.h"
+#include "ring.h"
+#include "search-cpu.h"
+#include "thread-pool.h"
+
+/*
+ * Staged version of searchCpu
+ *
+ * reader thread -> filled ring -> worker threads -> searched ring -> caller
+ *
+ * The reader fills the chunks, the workers filter and verify whole chunks
+ * and the calling thread delivers the matches in input order. Chunks are
+ * recycled through the free ring, so at most PIPELINE_DEPTH chunks are in
+ * flight and a slow stage blocks the stages in front of it.
+ */
+
+typedef struct {
+  uint8_t *input;
+  int inputLength;
+
+  long sequence;
+  MatchSink sink;
+} PipelineChunk;
+
+typedef struct {
+  DFC_STRUCTURE *dfc;
+  CpuFilterFunction filter;
+  ReadFunction read;
+
+  int workerCount;
+
+  Ring *freeChunks;
+  Ring *filledChunks;
+  Ring *searchedChunks;
+
+  // -1 until the reader has reached the end of the input
+  atomic_long chunkCount;
+} Pipeline;
+
+static void *readStage(void *argument) {
+  Pipeline *pipeline = (Pipeline *)argument;
+
+  long sequence = 0;
+  for (;;) {
+    PipelineChunk *chunk = (PipelineChunk *)popFromRing(pipeline->freeChunks);
+
+    // read 1 byte less to allow matching of 1-byte patterns without accessing
+    // invalid memory at the very last character
+    int readCount = pipeline->read(INPUT_READ_CHUNK_BYTES - 1,
+                                   MAX_PATTERN_LENGTH, (char *)chunk->input);
+    if (!readCount) {
+      pushToRing(pipeline->freeChunks, chunk);
+      break;
+    }
+
+    chunk->inputLength = readCount;
+    chunk->sequence = sequence++;
+    pushToRing(pipeline->filledChunks, chunk);
+  }
+
+  atomic_store(&pipeline->chunkCount, sequence);
+
+  // one stop signal per worker
+  for (int i = 0; i < pipeline->workerCount; ++i) {
+    pushToRing(pipeline->filledChunks, NULL);
+  }
+
+  return NULL;
+}
+
+static void *searchStage(void *argument) {
+  Pipeline *pipeline = (Pipeline *)argument;
+
+  PipelineChunk *chunk;
+  while ((chunk = (PipelineChunk *)popFromRing(pipeline->filledChunks))) {
+    chunk->sink.matchCount = 0;
+    searchCpuRange(pipeline->dfc, pipeline->filter, chunk->input, 0,
+                   chunk->inputLength, chunk->inputLength, &chunk->sink);
+
+    pushToRing(pipeline->searchedChunks, chunk);
+  }
+
+  return NULL;
+}
+
+static PipelineChunk *allocatePipelineChunks() {
+  PipelineChunk *chunks = calloc(PIPELINE_DEPTH, sizeof(PipelineChunk));
+  if (!chunks) {
+    fprintf(stderr, "Could not allocate pipeline chunks\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < PIPELINE_DEPTH; ++i) {
+    chunks[i].input = calloc(1, INPUT_READ_CHUNK_BYTES);
+    if (!chunks[i].input) {
+      fprintf(stderr, "Could not allocate input for pipeline chunk\n");
+      exit(1);
+    }
+
+    // the matches are buffered until they are delivered in order
+    chunks[i].sink = createBufferedMatchSink();
+  }
+
+  return chunks;
+}
+
+static void freePipelineChunks(PipelineChunk *chunks) {
+  for (int i = 0; i < PIPELINE_DEPTH; ++i) {
+    free(chunks[i].input);
+    free(chunks[i].sink.matches);
+  }
+  free(chunks);
+}
+
+static void startStage(pthread_t *thread, void *(*stage)(void *),
+                       Pipeline *pipeline) {
+  if (pthread_create(thread, NULL, stage, pipeline)) {
+    fprintf(stderr, "Could not start pipeline thread\n");
+    exit(COULD_NOT_START_THREAD_EXIT_CODE);
+  }
+}
+
+int searchCpuPipelined(ReadFunction read, MatchBatch *batch) {
+  DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
+
+  Pipeline pipeline = {.dfc = dfc,
+                       .filter = getCpuFilter(),
+                       .read = read,
+                       .workerCount = getConfiguredThreadCount()};
+  atomic_init(&pipeline.chunkCount, -1);
+
+  // the filled ring also has to hold the stop signals of the workers
+  pipeline.freeChunks = createRing(PIPELINE_DEPTH);
+  pipeline.filledChunks = createRing(PIPELINE_DEPTH + pipeline.workerCount);
+  pipeline.searchedChunks = createRing(PIPELINE_DEPTH);
+
+  PipelineChunk *chunks = allocatePipelineChunks();
+  for (int i = 0; i < PIPELINE_DEPTH; ++i) {
+    pushToRing(pipeline.freeChunks, &chunks[i]);
+  }
+
+  pthread_t reader;
+  pthread_t *workers = calloc(pipeline.workerCount, sizeof(pthread_t));
+  if (!workers) {
+    fprintf(stderr, "Could not allocate pipeline workers\n");
+    exit(1);
+  }
+
+  startStage(&reader, readStage, &pipeline);
+  for (int i = 0; i < pipeline.workerCount; ++i) {
+    startStage(&workers[i], searchStage, &pipeline);
+  }
+
+  // the workers may finish out of order, park the chunks until it is their
+  // turn. The sequence numbers in flight never differ by PIPELINE_DEPTH or
+  // more, hence they map to distinct slots
+  PipelineChunk *pending[PIPELINE_DEPTH] = {NULL};
+
+  int matches = 0;
+  long nextSequence = 0;
+  int attempt = 0;
+  while (nextSequence != atomic_load(&pipeline.chunkCount)) {
+    void *searched;
+    if (!tryPopFromRing(pipeline.searchedChunks, &searched)) {
+      backOff(&attempt);
+      continue;
+    }
+    attempt = 0;
+
+    PipelineChunk *chunk = (PipelineChunk *)searched;
+    pending[chunk->sequence % PIPELINE_DEPTH] = chunk;
+
+    while ((chunk = pending[nextSequence % PIPELINE_DEPTH]) &&
+           chunk->sequence == nextSequence) {
+      pending[nextSequence % PIPELINE_DEPTH] = NULL;
+
+      deliverBufferedMatches(&chunk->sink, batch);
+      matches += chunk->sink.matchCount;
+      batch->chunkOffset += chunk->inputLength;
+
+      ++nextSequence;
+      pushToRing(pipeline.freeChunks, chunk);
+    }
+  }
+
+  pthread_join(reader, NULL);
+  for (int i = 0; i < pipeline.workerCount; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  freePipelineChunks(chunks);
+  destroyRing(pipeline.freeChunks);
+  destroyRing(pipeline.filledChunks);
+  destroyRing(pipeline.searchedChunks);
+
+  return matches;
+}
@@ -1,60 +1,145 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "memory.h"
+#include "search-cpu.h"
 #include "search.h"
 #include "shared-functions.h"
 #include "utility.h"
 
-static int my_strncmp(unsigned char *a, unsigned char *b, int n) {
-  int i;
-  for (i = 0; i < n; i++) {
-    if (a[i] != b[i]) return -1;
+/*
+ * Verification specialized by pattern length (see VERIFY_* in shared.h)
+ *
+ * The patterns are compared a word at a time. The last word is loaded so
+ * that it ends with the pattern, overlapping the previous one, so that no
+ * byte past the pattern is ever read.
+ * The case mask folds the letters of the input for case insensitive patterns
+ * and is zero otherwise, so both kinds are compared the same way. It follows
+ * the folded pattern in the pattern bytes.
+ */
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+  uint32_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static inline uint16_t load16(const uint8_t *p) {
+  uint16_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static inline bool equalAt(const uint8_t *input, const uint8_t *folded,
+                           int length, int offset) {
+  return (load64(input + offset) | load64(folded + length + offset)) ==
+         load64(folded + offset);
+}
+
+static inline bool equal32At(const uint8_t *input, const uint8_t *folded,
+                             int length, int offset) {
+  return (load32(input + offset) | load32(folded + length + offset)) ==
+         load32(folded + offset);
+}
+
+static inline bool equal16At(const uint8_t *input, const uint8_t *folded,
+                             int length, int offset) {
+  return (load16(input + offset) | load16(folded + length + offset)) ==
+         load16(folded + offset);
+}
+
+static bool verifyUpTo8(const uint8_t *input, const uint8_t *folded,
+                        int length) {
+  if (length >= 4) {
+    return equal32At(input, folded, length, 0) &&
+           equal32At(input, folded, length, length - 4);
   }
-  return 0;
+  if (length >= 2) {
+    return equal16At(input, folded, length, 0) &&
+           equal16At(input, folded, length, length - 2);
+  }
+  return (input[0] | folded[length]) == folded[0];
+}
+
+static bool verifyUpTo16(const uint8_t *input, const uint8_t *folded,
+                         int length) {
+  return equalAt(input, folded, length, 0) &&
+         equalAt(input, folded, length, length - 8);
 }
 
-unsigned char my_tolower(unsigned char c) {
-  if (c >= 65 && c <= 90) {
-    return c + 32;
+static bool verifyUpTo32(const uint8_t *input, const uint8_t *folded,
+                         int length) {
+  return equalAt(input, folded, length, 0) &&
+         equalAt(input, folded, length, 8) &&
+         equalAt(input, folded, length, length - 16) &&
+         equalAt(input, folded, length, length - 8);
+}
+
+static bool verifyLonger(const uint8_t *input, const uint8_t *folded,
+                         int length) {
+  for (int i = 0; i < length - 8; i += 8) {
+    if (!equalAt(input, folded, length, i)) {
+      return false;
+    }
   }
-  return c;
+  return equalAt(input, folded, length, length - 8);
 }
 
-static int my_strncasecmp(unsigned char *a, unsigned char *b, int n) {
-  int i;
-  for (i = 0; i < n; i++) {
-    if (my_tolower(a[i]) != my_tolower(b[i])) return -1;
+static bool doesPatternMatch(uint8_t *start, DFC_PATTERNS *patterns,
+                             PID_TYPE pid) {
+  DFC_FIXED_PATTERN *pattern = patterns->dfcMatchList + pid;
+  const uint8_t *folded = patterns->patternBytes + pattern->pattern_offset;
+  int length = pattern->pattern_length;
+
+  switch (pattern->verifier) {
+    case VERIFY_UP_TO_8:
+      return verifyUpTo8(start, folded, length);
+    case VERIFY_UP_TO_16:
+      return verifyUpTo16(start, folded, length);
+    case VERIFY_UP_TO_32:
+      return verifyUpTo32(start, folded, length);
+    default:
+      return verifyLonger(start, folded, length);
   }
-  return 0;
 }
 
-static bool doesPatternMatch(uint8_t *start, uint8_t *pattern, int length,
-                             bool isCaseInsensitive) {
-  if (isCaseInsensitive) {
-    return !my_strncasecmp(start, pattern, length);
+// the large and long patterns are found at their fragment, fragment_offset
+// bytes after their start, returns the start or -1 if the pattern does not match
+static int matchAtFragment(uint8_t *fragment, int fragmentPos, int inputLength,
+                           DFC_PATTERNS *patterns, PID_TYPE pid) {
+  DFC_FIXED_PATTERN *pattern = patterns->dfcMatchList + pid;
+  int position = fragmentPos - pattern->fragment_offset;
+
+  if (position < 0 || inputLength - position < pattern->pattern_length ||
+      !doesPatternMatch(fragment - pattern->fragment_offset, patterns, pid)) {
+    return -1;
   }
-  return !my_strncmp(start, pattern, length);
+
+  return position;
 }
 
 static void verifySmall(CompactTableSmallEntry *ct, PID_TYPE *pids,
-                        DFC_FIXED_PATTERN *patterns, uint8_t *input,
+                        DFC_PATTERNS *patterns, uint8_t *input,
                         int currentPos, int inputLength, VerifyResult *result) {
   uint8_t hash = input[0];
 
   int offset = (ct + hash)->offset;
   pids += offset;
 
-  for (int i = 0; i < (ct + hash)->pidCount; ++i) {
+  for (uint32_t i = 0; i < (ct + hash)->pidCount; ++i) {
     PID_TYPE pid = pids[i];
 
-    int patternLength = (patterns + pid)->pattern_length;
+    int patternLength = patterns->dfcMatchList[pid].pattern_length;
 
     if (inputLength - currentPos >= patternLength &&
-        doesPatternMatch(input, (patterns + pid)->original_pattern,
-                         patternLength,
-                         (patterns + pid)->is_case_insensitive)) {
+        doesPatternMatch(input, patterns, pid)) {
       if (result->matchCount < MAX_MATCHES) {
         result->matches[result->matchCount] = pid;
       }
@@ -63,54 +148,145 @@ static void verifySmall(CompactTableSmallEntry *ct, PID_TYPE *pids,
   }
 }
 
+static uint32_t hashForLargeCt(DFC_TABLE_SIZES *sizes, uint32_t bytePattern) {
+  return hashForLargeCompactTable(bytePattern, sizes->ctLargeHashMultiplier,
+                                  sizes->ctLargeHashShift, sizes->ctLargeBits);
+}
+
+static uint32_t cuckooHashForLargeCt(DFC_TABLE_SIZES *sizes,
+                                     uint32_t bytePattern) {
+  return hashForLargeCompactTable(bytePattern, sizes->ctLargeCuckooMultiplier,
+                                  sizes->ctLargeHashShift, sizes->ctLargeBits);
+}
+
+static bool isLargeCuckooSlotOf(CompactTableLargeEntry *slot,
+                                uint32_t bytePattern) {
+  // empty slots have no pids and would otherwise match a zero fragment
+  return slot->pidCount && slot->pattern == bytePattern;
+}
+
+// the entry of the fragment or NULL, the cuckoo variant holds it in one of
+// two slots while the chained one has to scan a bucket
+static CompactTableLargeEntry *findLargeCtEntry(
+    CompactTableLargeBucket *buckets, DFC_TABLE_SIZES *sizes,
+    CompactTableLargeEntry *entries, uint32_t bytePattern) {
+  if (CUCKOO_LARGE_CT) {
+    CompactTableLargeEntry *slot = entries + hashForLargeCt(sizes, bytePattern);
+    if (isLargeCuckooSlotOf(slot, bytePattern)) {
+      return slot;
+    }
+
+    slot = entries + cuckooHashForLargeCt(sizes, bytePattern);
+    return isLargeCuckooSlotOf(slot, bytePattern) ? slot : NULL;
+  }
+
+  CompactTableLargeBucket *bucket =
+      buckets + hashForLargeCt(sizes, bytePattern);
+  for (uint32_t i = 0; i < bucket->entryCount; ++i) {
+    CompactTableLargeEntry *entry = entries + bucket->entryOffset + i;
+    if (entry->pattern == bytePattern) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
 static void verifyLarge(CompactTableLargeBucket *buckets,
-                        CompactTableLargeEntry *entries, PID_TYPE *pids,
-                        DFC_FIXED_PATTERN *patterns, uint8_t *input,
+                        DFC_TABLE_SIZES *sizes, CompactTableLargeEntry *entries,
+                        PID_TYPE *pids, DFC_PATTERNS *patterns, uint8_t *input,
                         int currentPos, int inputLength, VerifyResult *result) {
   uint32_t bytePattern =
       input[3] << 24 | input[2] << 16 | input[1] << 8 | input[0];
-  uint32_t hash = hashForLargeCompactTable(bytePattern);
-
-  int32_t entryOffset = (buckets + hash)->entryOffset;
-
-  for (int i = 0; i < (buckets + hash)->entryCount; ++i) {
-    if ((entries + entryOffset + i)->pattern == bytePattern) {
-      int32_t pidOffset = (entries + entryOffset + i)->pidOffset;
-
-      for (int j = 0; j < (entries + entryOffset + i)->pidCount; ++j) {
-        PID_TYPE pid = pids[pidOffset + j];
-
-        int patternLength = (patterns + pid)->pattern_length;
-        if (inputLength - currentPos >= patternLength) {
-          if (doesPatternMatch(input, (patterns + pid)->original_pattern,
-                               patternLength,
-                               (patterns + pid)->is_case_insensitive)) {
-            if (result->matchCount < MAX_MATCHES) {
-              result->matches[result->matchCount] = pid;
-            }
-            ++result->matchCount;
-          }
-        }
-      }
+  CompactTableLargeEntry *entry =
+      findLargeCtEntry(buckets, sizes, entries, bytePattern);
+  if (!entry) {
+    return;
+  }
 
-      break;
+  for (uint32_t j = 0; j < entry->pidCount; ++j) {
+    PID_TYPE pid = pids[entry->pidOffset + j];
+
+    if (matchAtFragment(input, currentPos, inputLength, patterns, pid) >= 0) {
+      if (result->matchCount < MAX_MATCHES) {
+        result->matches[result->matchCount] = pid;
+      }
+      ++result->matchCount;
     }
   }
 }
 
-static bool isInHashDf(uint8_t *df, uint8_t *input) {
+// all bits are in one cache line, hence they are tested without branches
+static bool isInBloomFilter(uint8_t *df, int bits, uint32_t data) {
+  uint64_t hash = bloomFilterHash(data);
+  uint8_t *block = df + bloomFilterBlockOffset(hash, bits);
+
+  uint8_t isIn = 1;
+  for (int j = 0; j < BLOOM_FILTER_HASH_COUNT; ++j) {
+    uint32_t bit = bloomFilterBit(hash, j);
+    isIn &= block[BINDEX(bit)] >> (bit & 0x7);
+  }
+
+  return isIn;
+}
+
+static bool isInHashDf(uint8_t *df, int bits, uint8_t *input) {
   /*
    the last two bytes are used to match,
    hence we are now at least 2 bytes into the pattern
    */
   uint32_t data = input[3] << 24 | input[2] << 16 | input[1] << 8 | input[0];
-  uint16_t byteIndex = directFilterHash(data);
+
+  if (BLOCKED_BLOOM_FILTER) {
+    return isInBloomFilter(df, bits, data);
+  }
+
+  uint32_t byteIndex = directFilterHash(data, bits);
   uint16_t bitMask = BMASK(data & DF_MASK);
 
   return df[byteIndex] & bitMask;
 }
 
-int searchCpuEmulateGpu(ReadFunction read, MatchFunction onMatch) {
+static uint64_t getLongFragment(uint8_t *input) {
+  return foldLongFragment(load64(input));
+}
+
+static bool isInLongHashDf(uint8_t *df, int bits, uint8_t *input) {
+  uint32_t bit = directFilterLongHash(getLongFragment(input), bits);
+
+  return df[BINDEX(bit)] & BMASK(bit);
+}
+
+static void verifyLong(CompactTableLongBucket *buckets, int bucketBits,
+                       CompactTableLongEntry *entries, PID_TYPE *pids,
+                       DFC_PATTERNS *patterns, uint8_t *input, int currentPos,
+                       int inputLength, VerifyResult *result) {
+  uint64_t fragment = getLongFragment(input);
+  CompactTableLongBucket *bucket =
+      buckets + hashForLongCompactTable(fragment, bucketBits);
+
+  for (uint32_t i = 0; i < bucket->entryCount; ++i) {
+    CompactTableLongEntry *entry = entries + bucket->entryOffset + i;
+
+    if (entry->pattern == fragment) {
+      for (uint32_t j = 0; j < entry->pidCount; ++j) {
+        PID_TYPE pid = pids[entry->pidOffset + j];
+
+        if (matchAtFragment(input, currentPos, inputLength, patterns, pid) >=
+            0) {
+          if (result->matchCount < MAX_MATCHES) {
+            result->matches[result->matchCount] = pid;
+          }
+          ++result->matchCount;
+        }
+      }
+
+      break;
+    }
+  }
+}
+
+int searchCpuEmulateGpu(ReadFunction read, MatchBatch *batch) {
   DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
   DFC_PATTERNS *patterns = dfc->patterns;
 
@@ -137,24 +313,36 @@ int searchCpuEmulateGpu(ReadFunction read, MatchFunction onMatch) {
       result[i].matchCount = 0;
 
       if (dfc->directFilterSmall[byteIndex] & bitMask) {
-        verifySmall(dfc->ctSmallEntries, dfc->ctSmallPids,
-                    patterns->dfcMatchList, input + i, i, readCount,
-                    result + i);
+        verifySmall(dfc->ctSmallEntries, dfc->ctSmallPids, patterns,
+                    input + i, i, readCount, result + i);
       }
 
       if (i < readCount - 3 && (dfc->directFilterLarge[byteIndex] & bitMask) &&
-          isInHashDf(dfc->directFilterLargeHash, input + i)) {
-        verifyLarge(dfc->ctLargeBuckets, dfc->ctLargeEntries, dfc->ctLargePids,
-                    patterns->dfcMatchList, input + i, i, readCount,
-                    result + i);
+          isInHashDf(dfc->directFilterLargeHash, dfc->sizes.dfLargeHashBits,
+                     input + i)) {
+        verifyLarge(dfc->ctLargeBuckets, &dfc->sizes,
+                    dfc->ctLargeEntries, dfc->ctLargePids, patterns, input + i,
+                    i, readCount, result + i);
+      }
+
+      if (i < readCount - 7 && (dfc->directFilterLarge[byteIndex] & bitMask) &&
+          isInLongHashDf(dfc->directFilterLongHash, dfc->sizes.dfLongHashBits,
+                         input + i)) {
+        verifyLong(dfc->ctLongBuckets, dfc->sizes.ctLongBits,
+                   dfc->ctLongEntries, dfc->ctLongPids, patterns, input + i, i,
+                   readCount, result + i);
       }
     }
+    MatchSink direct = createDirectMatchSink(batch);
+    MatchSink sink =
+        dfc->maxFragmentOffset ? createBufferedMatchSink() : direct;
+
     for (int i = 0; i < readCount; ++i) {
       VerifyResult *res = &result[i];
 
       for (int j = 0; j < res->matchCount && j < MAX_MATCHES; ++j) {
-        onMatch(&patterns->dfcMatchList[res->matches[j]]);
-        ++matches;
+        PID_TYPE pid = res->matches[j];
+        emitMatch(&sink, i - patterns->dfcMatchList[pid].fragment_offset, pid);
       }
 
       if (res->matchCount >= MAX_MATCHES) {
@@ -164,6 +352,14 @@ int searchCpuEmulateGpu(ReadFunction read, MatchFunction onMatch) {
             res->matchCount, i, MAX_MATCHES);
       }
     }
+
+    if (dfc->maxFragmentOffset) {
+      deliverMatchesInOrder(&sink, 0, readCount, &direct);
+      sink = direct;
+    }
+    matches += sink.matchCount;
+
+    batch->chunkOffset += readCount;
   }
 
   free(result);
@@ -172,73 +368,437 @@ int searchCpuEmulateGpu(ReadFunction read, MatchFunction onMatch) {
   return matches;
 }
 
-static int verifySmallRet(CompactTableSmallEntry *ct, PID_TYPE *pids,
-                          DFC_FIXED_PATTERN *patterns, uint8_t *input,
-                          int currentPos, int inputLength,
-                          MatchFunction onMatch) {
+static void verifySmallRet(CompactTableSmallEntry *ct, PID_TYPE *pids,
+                           DFC_PATTERNS *patterns, uint8_t *input,
+                           int currentPos, int inputLength, MatchSink *sink) {
   uint8_t hash = input[0];
 
   int offset = (ct + hash)->offset;
   pids += offset;
 
-  int matches = 0;
-  for (int i = 0; i < (ct + hash)->pidCount; ++i) {
+  for (uint32_t i = 0; i < (ct + hash)->pidCount; ++i) {
     PID_TYPE pid = pids[i];
 
-    int patternLength = (patterns + pid)->pattern_length;
+    int patternLength = patterns->dfcMatchList[pid].pattern_length;
 
     if (inputLength - currentPos >= patternLength &&
-        doesPatternMatch(input, (patterns + pid)->original_pattern,
-                         patternLength,
-                         (patterns + pid)->is_case_insensitive)) {
-      onMatch(&patterns[pid]);
-      ++matches;
+        doesPatternMatch(input, patterns, pid)) {
+      emitMatch(sink, currentPos, pid);
     }
   }
+}
 
-  return matches;
+// the fragment is at position fragmentPos of the input
+static void verifyPids(DFC_PATTERNS *patterns, uint8_t *fragment,
+                       int fragmentPos, int inputLength, PID_TYPE *pids,
+                       int pidCount, MatchSink *sink) {
+  for (int j = 0; j < pidCount; ++j) {
+    int position = matchAtFragment(fragment, fragmentPos, inputLength,
+                                   patterns, pids[j]);
+    if (position >= 0) {
+      emitMatch(sink, position, pids[j]);
+    }
+  }
 }
 
-static int verifyLargeRet(CompactTableLargeBucket *buckets,
-                          CompactTableLargeEntry *entries, PID_TYPE *pids,
-                          DFC_FIXED_PATTERN *patterns, uint8_t *input,
-                          int currentPos, int inputLength,
-                          MatchFunction onMatch) {
+static void verifyLargeRet(CompactTableLargeBucket *buckets,
+                           DFC_TABLE_SIZES *sizes,
+                           CompactTableLargeEntry *entries, PID_TYPE *pids,
+                           DFC_PATTERNS *patterns, uint8_t *input,
+                           int currentPos, int inputLength, MatchSink *sink) {
   uint32_t bytePattern =
       input[3] << 24 | input[2] << 16 | input[1] << 8 | input[0];
-  uint32_t hash = hashForLargeCompactTable(bytePattern);
-  int32_t entryOffset = (buckets + hash)->entryOffset;
+  CompactTableLargeEntry *entry =
+      findLargeCtEntry(buckets, sizes, entries, bytePattern);
+  if (!entry) {
+    return;
+  }
 
-  int matches = 0;
-  for (int i = 0; i < (buckets + hash)->entryCount; ++i) {
-    if ((entries + entryOffset + i)->pattern == bytePattern) {
-      int32_t pidOffset = (entries + entryOffset + i)->pidOffset;
-
-      for (int j = 0; j < (entries + entryOffset + i)->pidCount; ++j) {
-        PID_TYPE pid = pids[pidOffset + j];
-
-        int patternLength = (patterns + pid)->pattern_length;
-        if (inputLength - currentPos >= patternLength) {
-          if (doesPatternMatch(input, (patterns + pid)->original_pattern,
-                               patternLength,
-                               (patterns + pid)->is_case_insensitive)) {
-            onMatch(&patterns[pid]);
-            ++matches;
-          }
-        }
-      }
+  verifyPids(patterns, input, currentPos, inputLength,
+             pids + entry->pidOffset, entry->pidCount, sink);
+}
+
+static void verifyLongRet(CompactTableLongBucket *buckets, int bucketBits,
+                          CompactTableLongEntry *entries, PID_TYPE *pids,
+                          DFC_PATTERNS *patterns, uint8_t *input,
+                          int currentPos, int inputLength, MatchSink *sink) {
+  uint64_t fragment = getLongFragment(input);
+  CompactTableLongBucket *bucket =
+      buckets + hashForLongCompactTable(fragment, bucketBits);
 
+  for (uint32_t i = 0; i < bucket->entryCount; ++i) {
+    CompactTableLongEntry *entry = entries + bucket->entryOffset + i;
+
+    if (entry->pattern == fragment) {
+      verifyPids(patterns, input, currentPos, inputLength,
+                 pids + entry->pidOffset, entry->pidCount, sink);
       break;
     }
   }
+}
 
-  return matches;
+// the large and the long patterns share the 2 byte direct filter
+static void verifyLargeAndLongRet(DFC_STRUCTURE *dfc, uint8_t *input, int i,
+                                  int inputLength, MatchSink *sink) {
+  if (i < inputLength - 3 &&
+      isInHashDf(dfc->directFilterLargeHash, dfc->sizes.dfLargeHashBits,
+                 input + i)) {
+    verifyLargeRet(dfc->ctLargeBuckets, &dfc->sizes,
+                   dfc->ctLargeEntries, dfc->ctLargePids, dfc->patterns,
+                   input + i, i, inputLength, sink);
+  }
+
+  if (i < inputLength - 7 &&
+      isInLongHashDf(dfc->directFilterLongHash, dfc->sizes.dfLongHashBits,
+                     input + i)) {
+    verifyLongRet(dfc->ctLongBuckets, dfc->sizes.ctLongBits,
+                  dfc->ctLongEntries, dfc->ctLongPids, dfc->patterns,
+                  input + i, i, inputLength, sink);
+  }
 }
 
-int searchCpu(ReadFunction read, MatchFunction onMatch) {
-  DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
+static void verifyCandidates(DFC_STRUCTURE *dfc, uint8_t *input,
+                             int blockStart, int inputLength,
+                             uint64_t candidatesSmall, uint64_t candidatesLarge,
+                             MatchSink *sink) {
   DFC_PATTERNS *patterns = dfc->patterns;
 
+  // only the set bits are visited, most blocks have none at all
+  uint64_t candidates = candidatesSmall | candidatesLarge;
+  while (candidates) {
+    int k = __builtin_ctzll(candidates);
+    candidates &= candidates - 1;
+
+    int i = blockStart + k;
+
+    if ((candidatesSmall >> k) & 1) {
+      verifySmallRet(dfc->ctSmallEntries, dfc->ctSmallPids,
+                     patterns, input + i, i, inputLength, sink);
+    }
+
+    if ((candidatesLarge >> k) & 1) {
+      verifyLargeAndLongRet(dfc, input, i, inputLength, sink);
+    }
+  }
+}
+
+static int searchBlocks(DFC_STRUCTURE *dfc, CpuFilterFunction filter,
+                        uint8_t *input, int start, int end, int inputLength,
+                        MatchSink *sink) {
+  int i = start;
+
+  // the filter reads one byte past the block, hence the strict comparison
+  for (; i + CPU_FILTER_BLOCK_SIZE <= end &&
+         i + CPU_FILTER_BLOCK_SIZE < inputLength;
+       i += CPU_FILTER_BLOCK_SIZE) {
+    uint64_t candidatesSmall;
+    uint64_t candidatesLarge;
+    filter(dfc->directFilterSmall, dfc->directFilterLarge, input + i,
+           &candidatesSmall, &candidatesLarge);
+
+    verifyCandidates(dfc, input, i, inputLength, candidatesSmall,
+                     candidatesLarge, sink);
+  }
+
+  return i;
+}
+
+/*
+ * Two phase search (TWO_PHASE_CPU_SEARCH)
+ *
+ * Verifying the candidates in input order means one cache miss after
+ * another in the large and long compact tables and the patterns. Instead the
+ * candidates of several blocks are collected first, and the tables are
+ * prefetched a few candidates ahead of the verification.
+ *
+ * Each table access depends on the previous one (bucket -> entry ->
+ * pattern), so they are prefetched at decreasing distances.
+ */
+#define CANDIDATES_PER_PHASE 1024
+#define BUCKET_PREFETCH_DISTANCE 12
+#define ENTRY_PREFETCH_DISTANCE 8
+#define PATTERN_PREFETCH_DISTANCE 4
+
+#define NO_CT_ENTRY -1
+
+typedef enum _candidateKind {
+  SMALL_CANDIDATE,
+  LARGE_CANDIDATE,
+  LONG_CANDIDATE,
+} CandidateKind;
+
+typedef struct {
+  int position;
+  CandidateKind kind;
+
+  // only used for large and long candidates
+  uint64_t fragment;
+  uint32_t hash;
+  int32_t entry;
+} Candidate;
+
+static int collectCandidates(DFC_STRUCTURE *dfc, uint8_t *input,
+                             int blockStart, int inputLength,
+                             uint64_t candidatesSmall, uint64_t candidatesLarge,
+                             Candidate *candidates) {
+  int count = 0;
+
+  uint64_t bits = candidatesSmall | candidatesLarge;
+  while (bits) {
+    int k = __builtin_ctzll(bits);
+    bits &= bits - 1;
+
+    int i = blockStart + k;
+    uint8_t *start = input + i;
+
+    if ((candidatesSmall >> k) & 1) {
+      candidates[count].position = i;
+      candidates[count].kind = SMALL_CANDIDATE;
+      ++count;
+    }
+
+    if (!((candidatesLarge >> k) & 1)) {
+      continue;
+    }
+
+    if (i < inputLength - 3 &&
+        isInHashDf(dfc->directFilterLargeHash, dfc->sizes.dfLargeHashBits,
+                   start)) {
+      uint32_t bytePattern =
+          start[3] << 24 | start[2] << 16 | start[1] << 8 | start[0];
+
+      candidates[count].position = i;
+      candidates[count].kind = LARGE_CANDIDATE;
+      candidates[count].fragment = bytePattern;
+      candidates[count].hash = hashForLargeCt(&dfc->sizes, bytePattern);
+      candidates[count].entry = NO_CT_ENTRY;
+      ++count;
+    }
+
+    if (i < inputLength - 7 &&
+        isInLongHashDf(dfc->directFilterLongHash, dfc->sizes.dfLongHashBits,
+                       start)) {
+      uint64_t fragment = getLongFragment(start);
+
+      candidates[count].position = i;
+      candidates[count].kind = LONG_CANDIDATE;
+      candidates[count].fragment = fragment;
+      candidates[count].hash =
+          hashForLongCompactTable(fragment, dfc->sizes.ctLongBits);
+      candidates[count].entry = NO_CT_ENTRY;
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+static void prefetchBucket(DFC_STRUCTURE *dfc, Candidate *candidate) {
+  if (candidate->kind == LARGE_CANDIDATE && CUCKOO_LARGE_CT) {
+    // the slots are the entries, both are fetched right away
+    __builtin_prefetch(dfc->ctLargeEntries + candidate->hash);
+    __builtin_prefetch(dfc->ctLargeEntries +
+                       cuckooHashForLargeCt(&dfc->sizes, candidate->fragment));
+  } else if (candidate->kind == LARGE_CANDIDATE) {
+    __builtin_prefetch(dfc->ctLargeBuckets + candidate->hash);
+  } else if (candidate->kind == LONG_CANDIDATE) {
+    __builtin_prefetch(dfc->ctLongBuckets + candidate->hash);
+  }
+}
+
+static void prefetchEntries(DFC_STRUCTURE *dfc, Candidate *candidate) {
+  if (candidate->kind == LARGE_CANDIDATE && !CUCKOO_LARGE_CT) {
+    CompactTableLargeBucket *bucket = dfc->ctLargeBuckets + candidate->hash;
+    __builtin_prefetch(dfc->ctLargeEntries + bucket->entryOffset);
+  } else if (candidate->kind == LONG_CANDIDATE) {
+    CompactTableLongBucket *bucket = dfc->ctLongBuckets + candidate->hash;
+    __builtin_prefetch(dfc->ctLongEntries + bucket->entryOffset);
+  }
+}
+
+static void prefetchPattern(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  DFC_FIXED_PATTERN *pattern = dfc->patterns->dfcMatchList + pid;
+  __builtin_prefetch(dfc->patterns->patternBytes + pattern->pattern_offset);
+}
+
+// looks up the entry of the candidate and prefetches its first pattern
+static void resolveEntry(DFC_STRUCTURE *dfc, Candidate *candidate) {
+  if (candidate->kind == LARGE_CANDIDATE) {
+    CompactTableLargeEntry *entry =
+        findLargeCtEntry(dfc->ctLargeBuckets, &dfc->sizes, dfc->ctLargeEntries,
+                         candidate->fragment);
+
+    if (entry) {
+      candidate->entry = entry - dfc->ctLargeEntries;
+      prefetchPattern(dfc, dfc->ctLargePids[entry->pidOffset]);
+    }
+  } else if (candidate->kind == LONG_CANDIDATE) {
+    CompactTableLongBucket *bucket = dfc->ctLongBuckets + candidate->hash;
+    CompactTableLongEntry *entries = dfc->ctLongEntries + bucket->entryOffset;
+
+    for (uint32_t i = 0; i < bucket->entryCount; ++i) {
+      if (entries[i].pattern == candidate->fragment) {
+        candidate->entry = bucket->entryOffset + i;
+        prefetchPattern(dfc, dfc->ctLongPids[entries[i].pidOffset]);
+        return;
+      }
+    }
+  }
+}
+
+static void verifyCollectedCandidates(DFC_STRUCTURE *dfc, uint8_t *input,
+                                      int inputLength, Candidate *candidates,
+                                      int count, MatchSink *sink) {
+  for (int j = 0; j < count && j < PATTERN_PREFETCH_DISTANCE; ++j) {
+    resolveEntry(dfc, &candidates[j]);
+  }
+
+  for (int j = 0; j < count; ++j) {
+    if (j + BUCKET_PREFETCH_DISTANCE < count) {
+      prefetchBucket(dfc, &candidates[j + BUCKET_PREFETCH_DISTANCE]);
+    }
+    if (j + ENTRY_PREFETCH_DISTANCE < count) {
+      prefetchEntries(dfc, &candidates[j + ENTRY_PREFETCH_DISTANCE]);
+    }
+    if (j + PATTERN_PREFETCH_DISTANCE < count) {
+      resolveEntry(dfc, &candidates[j + PATTERN_PREFETCH_DISTANCE]);
+    }
+
+    Candidate *candidate = &candidates[j];
+    int i = candidate->position;
+
+    if (candidate->kind == SMALL_CANDIDATE) {
+      verifySmallRet(dfc->ctSmallEntries, dfc->ctSmallPids, dfc->patterns,
+                     input + i, i, inputLength, sink);
+    } else if (candidate->entry == NO_CT_ENTRY) {
+      continue;
+    } else if (candidate->kind == LARGE_CANDIDATE) {
+      CompactTableLargeEntry *entry = dfc->ctLargeEntries + candidate->entry;
+      verifyPids(dfc->patterns, input + i, i, inputLength,
+                 dfc->ctLargePids + entry->pidOffset, entry->pidCount, sink);
+    } else {
+      CompactTableLongEntry *entry = dfc->ctLongEntries + candidate->entry;
+      verifyPids(dfc->patterns, input + i, i, inputLength,
+                 dfc->ctLongPids + entry->pidOffset, entry->pidCount, sink);
+    }
+  }
+}
+
+static int searchBlocksInTwoPhases(DFC_STRUCTURE *dfc,
+                                   CpuFilterFunction filter, uint8_t *input,
+                                   int start, int end, int inputLength,
+                                   MatchSink *sink) {
+  Candidate candidates[CANDIDATES_PER_PHASE];
+  int count = 0;
+
+  int i = start;
+  for (; i + CPU_FILTER_BLOCK_SIZE <= end &&
+         i + CPU_FILTER_BLOCK_SIZE < inputLength;
+       i += CPU_FILTER_BLOCK_SIZE) {
+    uint64_t candidatesSmall;
+    uint64_t candidatesLarge;
+    filter(dfc->directFilterSmall, dfc->directFilterLarge, input + i,
+           &candidatesSmall, &candidatesLarge);
+
+    count += collectCandidates(dfc, input, i, inputLength, candidatesSmall,
+                               candidatesLarge, candidates + count);
+
+    // a block adds at most three candidates per position
+    if (count > CANDIDATES_PER_PHASE - 3 * CPU_FILTER_BLOCK_SIZE) {
+      verifyCollectedCandidates(dfc, input, inputLength, candidates, count,
+                                sink);
+      count = 0;
+    }
+  }
+
+  verifyCollectedCandidates(dfc, input, inputLength, candidates, count, sink);
+
+  return i;
+}
+
+static void searchPositions(DFC_STRUCTURE *dfc, CpuFilterFunction filter,
+                            uint8_t *input, int start, int end,
+                            int inputLength, MatchSink *sink) {
+  DFC_PATTERNS *patterns = dfc->patterns;
+
+  int i;
+  if (TWO_PHASE_CPU_SEARCH) {
+    i = searchBlocksInTwoPhases(dfc, filter, input, start, end, inputLength,
+                                sink);
+  } else {
+    i = searchBlocks(dfc, filter, input, start, end, inputLength, sink);
+  }
+
+  // the positions not filling a whole block
+  for (; i < end; ++i) {
+    int16_t data = input[i + 1] << 8 | input[i];
+    int16_t byteIndex = BINDEX(data & DF_MASK);
+    int16_t bitMask = BMASK(data & DF_MASK);
+
+    if (dfc->directFilterSmall[byteIndex] & bitMask) {
+      verifySmallRet(dfc->ctSmallEntries, dfc->ctSmallPids,
+                     patterns, input + i, i, inputLength, sink);
+    }
+
+    if (dfc->directFilterLarge[byteIndex] & bitMask) {
+      verifyLargeAndLongRet(dfc, input, i, inputLength, sink);
+    }
+  }
+
+  // a pattern starting before end may have its fragment after end
+  int fragmentEnd = end + dfc->maxFragmentOffset;
+  fragmentEnd = fragmentEnd < inputLength ? fragmentEnd : inputLength;
+  for (; i < fragmentEnd; ++i) {
+    int16_t data = input[i + 1] << 8 | input[i];
+    if (dfc->directFilterLarge[BINDEX(data & DF_MASK)] &
+        BMASK(data & DF_MASK)) {
+      verifyLargeAndLongRet(dfc, input, i, inputLength, sink);
+    }
+  }
+}
+
+void searchCpuRange(DFC_STRUCTURE *dfc, CpuFilterFunction filter,
+                    uint8_t *input, int start, int end, int inputLength,
+                    MatchSink *sink) {
+  if (!dfc->maxFragmentOffset) {
+    searchPositions(dfc, filter, input, start, end, inputLength, sink);
+    return;
+  }
+
+  MatchSink found = createBufferedMatchSink();
+  searchPositions(dfc, filter, input, start, end, inputLength, &found);
+  deliverMatchesInOrder(&found, start, end, sink);
+}
+
+void deliverMatchesInOrder(MatchSink *found, int start, int end,
+                           MatchSink *sink) {
+  CpuMatch *matches = found->matches;
+
+  // the matches are at most maxFragmentOffset positions out of order
+  for (int i = 1; i < found->matchCount; ++i) {
+    CpuMatch match = matches[i];
+
+    int j = i;
+    for (; j > 0 && matches[j - 1].position > match.position; --j) {
+      matches[j] = matches[j - 1];
+    }
+    matches[j] = match;
+  }
+
+  for (int i = 0; i < found->matchCount; ++i) {
+    if (matches[i].position >= start && matches[i].position < end) {
+      emitMatch(sink, matches[i].position, matches[i].pid);
+    }
+  }
+
+  free(matches);
+}
+
+int searchCpu(ReadFunction read, MatchBatch *batch) {
+  DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
+
+  CpuFilterFunction filter = getCpuFilter();
+
   uint8_t *input = (uint8_t *)allocateInput(INPUT_READ_CHUNK_BYTES);
 
   int matches = 0;
@@ -247,24 +807,16 @@ int searchCpu(ReadFunction read, MatchFunction onMatch) {
   // invalid memory at the very last character
   while ((readCount = read(INPUT_READ_CHUNK_BYTES - 1, MAX_PATTERN_LENGTH,
                            (char *)input))) {
-    for (int i = 0; i < readCount; ++i) {
-      int16_t data = input[i + 1] << 8 | input[i];
-      int16_t byteIndex = BINDEX(data & DF_MASK);
-      int16_t bitMask = BMASK(data & DF_MASK);
-
-      if (dfc->directFilterSmall[byteIndex] & bitMask) {
-        matches += verifySmallRet(dfc->ctSmallEntries, dfc->ctSmallPids,
-                                  patterns->dfcMatchList, input + i, i,
-                                  readCount, onMatch);
-      }
-
-      if (i < readCount - 3 && (dfc->directFilterLarge[byteIndex] & bitMask) &&
-          isInHashDf(dfc->directFilterLargeHash, input + i)) {
-        matches += verifyLargeRet(dfc->ctLargeBuckets, dfc->ctLargeEntries,
-                                  dfc->ctLargePids, patterns->dfcMatchList,
-                                  input + i, i, readCount, onMatch);
-      }
+    if (shouldSearchInParallel(readCount)) {
+      matches += searchChunkInParallel(dfc, filter, input, readCount,
+                                       readCount, batch);
+    } else {
+      MatchSink sink = createDirectMatchSink(batch);
+      searchCpuRange(dfc, filter, input, 0, readCount, readCount, &sink);
+      matches += sink.matchCount;
     }
+
+    batch->chunkOffset += readCount;
   }
 
   freeDfcInput();
@@ -273,24 +825,35 @@ int searchCpu(ReadFunction read, MatchFunction onMatch) {
 }
 
 int exactMatchingUponFiltering(uint8_t *input, uint8_t *result, int length,
-                               DFC_PATTERNS *patterns, MatchFunction onMatch) {
+                               DFC_PATTERNS *patterns, MatchBatch *batch) {
   DFC_STRUCTURE *dfc = DFC_HOST_MEMORY.dfcStructure;
 
-  int matches = 0;
+  MatchSink direct = createDirectMatchSink(batch);
+  MatchSink sink = dfc->maxFragmentOffset ? createBufferedMatchSink() : direct;
 
   for (int i = 0; i < length; ++i) {
     if (result[i] & 0x01) {
-      matches +=
-          verifySmallRet(dfc->ctSmallEntries, dfc->ctSmallPids,
-                         patterns->dfcMatchList, input + i, i, length, onMatch);
+      verifySmallRet(dfc->ctSmallEntries, dfc->ctSmallPids,
+                     patterns, input + i, i, length, &sink);
     }
 
     if (result[i] & 0x02) {
-      matches += verifyLargeRet(dfc->ctLargeBuckets, dfc->ctLargeEntries,
-                                dfc->ctLargePids, patterns->dfcMatchList,
-                                input + i, i, length, onMatch);
+      verifyLargeRet(dfc->ctLargeBuckets, &dfc->sizes,
+                     dfc->ctLargeEntries, dfc->ctLargePids, patterns, input + i,
+                     i, length, &sink);
+    }
+
+    if (result[i] & 0x04) {
+      verifyLongRet(dfc->ctLongBuckets, dfc->sizes.ctLongBits,
+                    dfc->ctLongEntries, dfc->ctLongPids, patterns, input + i, i,
+                    length, &sink);
     }
   }
 
-  return matches;
+  if (dfc->maxFragmentOffset) {
+    deliverMatchesInOrder(&sink, 0, length, &direct);
+    return direct.matchCount;
+  }
+
+  return sink.matchCount;
 }
@@ -9,6 +9,7 @@
 #include "stdlib.h"
 
 #include "memory.h"
+#include "search-cpu.h"
 #include "search.h"
 #include "shared-internal.h"
 #include "timer.h"
@@ -20,7 +21,7 @@ cl_event inputEvent;
 
 extern int exactMatchingUponFiltering(uint8_t *input, uint8_t *result,
                                       int length, DFC_PATTERNS *patterns,
-                                      MatchFunction);
+                                      MatchBatch *);
 int getThreadCountForBytes(int size) {
   return ceil(size / (float)(THREAD_GRANULARITY));
 }
@@ -31,19 +32,25 @@ void setKernelArgsNormalDesign(cl_kernel kernel, DfcOpenClBuffers *mem,
   clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem->input);
 
   clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem->patterns);
+  clSetKernelArg(kernel, 3, sizeof(cl_mem), &mem->patternBytes);
 
-  clSetKernelArg(kernel, 3, sizeof(cl_mem), &mem->dfSmall);
-  clSetKernelArg(kernel, 4, sizeof(cl_mem), &mem->dfLarge);
-  clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem->dfLargeHash);
+  clSetKernelArg(kernel, 4, sizeof(cl_mem), &mem->dfSmall);
+  clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem->dfLarge);
+  clSetKernelArg(kernel, 6, sizeof(cl_mem), &mem->dfLargeHash);
+  clSetKernelArg(kernel, 7, sizeof(cl_mem), &mem->dfLongHash);
 
-  clSetKernelArg(kernel, 6, sizeof(cl_mem), &mem->ctSmallEntries);
-  clSetKernelArg(kernel, 7, sizeof(cl_mem), &mem->ctSmallPids);
+  clSetKernelArg(kernel, 8, sizeof(cl_mem), &mem->ctSmallEntries);
+  clSetKernelArg(kernel, 9, sizeof(cl_mem), &mem->ctSmallPids);
 
-  clSetKernelArg(kernel, 8, sizeof(cl_mem), &mem->ctLargeBuckets);
-  clSetKernelArg(kernel, 9, sizeof(cl_mem), &mem->ctLargeEntries);
-  clSetKernelArg(kernel, 10, sizeof(cl_mem), &mem->ctLargePids);
+  clSetKernelArg(kernel, 10, sizeof(cl_mem), &mem->ctLargeBuckets);
+  clSetKernelArg(kernel, 11, sizeof(cl_mem), &mem->ctLargeEntries);
+  clSetKernelArg(kernel, 12, sizeof(cl_mem), &mem->ctLargePids);
 
-  clSetKernelArg(kernel, 11, sizeof(cl_mem), &mem->result);
+  clSetKernelArg(kernel, 13, sizeof(cl_mem), &mem->ctLongBuckets);
+  clSetKernelArg(kernel, 14, sizeof(cl_mem), &mem->ctLongEntries);
+  clSetKernelArg(kernel, 15, sizeof(cl_mem), &mem->ctLongPids);
+
+  clSetKernelArg(kernel, 16, sizeof(cl_mem), &mem->result);
 }
 
 void setKernelArgsHetDesign(cl_kernel kernel, DfcOpenClBuffers *mem,
@@ -54,8 +61,9 @@ void setKernelArgsHetDesign(cl_kernel kernel, DfcOpenClBuffers *mem,
   clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem->dfSmall);
   clSetKernelArg(kernel, 3, sizeof(cl_mem), &mem->dfLarge);
   clSetKernelArg(kernel, 4, sizeof(cl_mem), &mem->dfLargeHash);
+  clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem->dfLongHash);
 
-  clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem->result);
+  clSetKernelArg(kernel, 6, sizeof(cl_mem), &mem->result);
 }
 
 void setKernelArgs(cl_kernel kernel, DfcOpenClBuffers *mem, int readCount) {
@@ -96,17 +104,24 @@ void startKernelForQueue(cl_kernel kernel, cl_command_queue queue,
 }
 
 int handleMatches(uint8_t *result, int inputLength, DFC_PATTERNS *patterns,
-                  MatchFunction onMatch) {
+                  MatchBatch *batch) {
   VerifyResult *pidCounts = (VerifyResult *)result;
+  int maxFragmentOffset = DFC_HOST_MEMORY.dfcStructure->maxFragmentOffset;
+
+  // the kernel reports large and long patterns at their fragment
+  MatchSink direct = createDirectMatchSink(batch);
+  MatchSink sink = maxFragmentOffset ? createBufferedMatchSink() : direct;
 
-  int matches = 0;
   for (int i = 0; i < getThreadCountForBytes(inputLength); ++i) {
     VerifyResult *res = &pidCounts[i];
 
     for (uint8_t j = 0; j < res->matchCount && j < MAX_MATCHES_PER_THREAD;
          ++j) {
-      onMatch(&patterns->dfcMatchList[res->matches[j]]);
-      ++matches;
+      PID_TYPE pid = res->matches[j];
+      emitMatch(&sink,
+                i * THREAD_GRANULARITY + res->positions[j] -
+                    patterns->dfcMatchList[pid].fragment_offset,
+                pid);
     }
 
     if (res->matchCount > MAX_MATCHES_PER_THREAD) {
@@ -116,23 +131,31 @@ int handleMatches(uint8_t *result, int inputLength, DFC_PATTERNS *patterns,
           res->matchCount, i, MAX_MATCHES_PER_THREAD);
     }
   }
-  return matches;
+
+  if (maxFragmentOffset) {
+    deliverMatchesInOrder(&sink, 0, inputLength, &direct);
+    return direct.matchCount;
+  }
+
+  return sink.matchCount;
 }
 
 int handleResultsFromGpu(uint8_t *input, uint8_t *result, int inputLength,
-                         DFC_PATTERNS *patterns, MatchFunction onMatch) {
+                         DFC_PATTERNS *patterns, MatchBatch *batch) {
   int matches;
   if (HETEROGENEOUS_DESIGN) {
     startTimer(TIMER_EXECUTE_HETEROGENEOUS);
     matches = exactMatchingUponFiltering(input, result, inputLength, patterns,
-                                         onMatch);
+                                         batch);
     stopTimer(TIMER_EXECUTE_HETEROGENEOUS);
   } else {
     startTimer(TIMER_PROCESS_MATCHES);
-    matches = handleMatches(result, inputLength, patterns, onMatch);
+    matches = handleMatches(result, inputLength, patterns, batch);
     stopTimer(TIMER_PROCESS_MATCHES);
   }
 
+  batch->chunkOffset += inputLength;
+
   return matches;
 }
 
@@ -196,11 +219,11 @@ void cleanResult(cl_mem result, cl_command_queue queue, uint8_t **output) {
 
 int readResultAndCountMatches(uint8_t *input, DfcOpenClBuffers *mem,
                               cl_command_queue queue, DFC_PATTERNS *patterns,
-                              int readCount, MatchFunction onMatch) {
+                              int readCount, MatchBatch *batch) {
   uint8_t *output = NULL;
   readResult(mem, queue, readCount, &output);
   int matches =
-      handleResultsFromGpu(input, output, readCount, patterns, onMatch);
+      handleResultsFromGpu(input, output, readCount, patterns, batch);
   cleanResult(mem->result, queue, &output);
 
   return matches;
@@ -226,7 +249,7 @@ void waitForWriteEvent(cl_event e) {
   stopTimer(TIMER_WRITE_TO_DEVICE);
 }
 
-int performSearch(ReadFunction read, MatchFunction onMatch) {
+int performSearch(ReadFunction read, MatchBatch *batch) {
   char *input = getInputPtr();
 
   uint8_t *output = NULL;
@@ -254,7 +277,7 @@ int performSearch(ReadFunction read, MatchFunction onMatch) {
         waitForReadEvent(getPrevReadEvent());
         matches += handleResultsFromGpu(
             (uint8_t *)prev_input, output, prev_readCount,
-            DFC_HOST_MEMORY.dfcStructure->patterns, onMatch);
+            DFC_HOST_MEMORY.dfcStructure->patterns, batch);
         cleanResult(DFC_OPENCL_BUFFERS.result2, DFC_OPENCL_ENVIRONMENT.queue,
                     &output);
       }
@@ -274,7 +297,7 @@ int performSearch(ReadFunction read, MatchFunction onMatch) {
     } else {
       matches += readResultAndCountMatches(
           (uint8_t *)input, &DFC_OPENCL_BUFFERS, DFC_OPENCL_ENVIRONMENT.queue,
-          DFC_HOST_MEMORY.dfcStructure->patterns, readCount, onMatch);
+          DFC_HOST_MEMORY.dfcStructure->patterns, readCount, batch);
       input = getOwnershipOfInputBuffer();
     }
   }
@@ -284,7 +307,7 @@ int performSearch(ReadFunction read, MatchFunction onMatch) {
     if (prev_input && prev_output) {
       matches +=
           handleResultsFromGpu((uint8_t *)prev_input, output, prev_readCount,
-                               DFC_HOST_MEMORY.dfcStructure->patterns, onMatch);
+                               DFC_HOST_MEMORY.dfcStructure->patterns, batch);
       cleanResult(DFC_OPENCL_BUFFERS.result2, DFC_OPENCL_ENVIRONMENT.queue,
                   &output);
     }
@@ -295,6 +318,6 @@ int performSearch(ReadFunction read, MatchFunction onMatch) {
   return matches;
 }
 
-int searchGpu(ReadFunction read, MatchFunction onMatch) {
-  return performSearch(read, onMatch);
+int searchGpu(ReadFunction read, MatchBatch *batch) {
+  return performSearch(read, batch);
 }
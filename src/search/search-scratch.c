@@ -0,0 +1,73 @@
+#include <string.h>
+
+#include "memory.h"
+#include "search-cpu.h"
+#include "search-scratch.h"
+
+#define SCRATCH_MATCH_COUNT 256
+
+// the last positions whose patterns may reach the end of the input
+#define SCRATCH_TAIL_LENGTH (MAX_PATTERN_LENGTH - 1)
+
+/*
+ * Everything a search writes to. The compiled structure is only read, so
+ * threads with their own scratch never share any written memory.
+ */
+struct DfcScratch_ {
+  DFC_MATCH matches[SCRATCH_MATCH_COUNT];
+  CpuFilterFunction filter;
+
+  // one spare byte as the direct filters look at the next byte too
+  uint8_t tail[SCRATCH_TAIL_LENGTH + 1];
+};
+
+DFC_SCRATCH *allocateScratch() {
+  DFC_SCRATCH *scratch = calloc(1, sizeof(DFC_SCRATCH));
+  if (!scratch) {
+    fprintf(stderr, "Could not allocate scratch\n");
+    exit(1);
+  }
+
+  scratch->filter = getCpuFilter();
+
+  return scratch;
+}
+
+int searchWithScratch(DFC_STRUCTURE *dfc, DFC_SCRATCH *scratch,
+                      const uint8_t *input, int length,
+                      MatchBatchFunction onMatches, void *userData) {
+  // the direct filters are not accessible from the host if they are mapped
+  if (MAP_MEMORY && shouldUseOpenCl()) {
+    fprintf(stderr, "Searching with a scratch requires the host filters\n");
+    exit(STREAM_NEEDS_HOST_FILTERS_EXIT_CODE);
+  }
+
+  MatchBatch batch = {.matches = scratch->matches,
+                      .capacity = SCRATCH_MATCH_COUNT,
+                      .matchCount = 0,
+                      .onMatches = onMatches,
+                      .userData = userData,
+                      .chunkOffset = 0};
+  MatchSink sink = createDirectMatchSink(&batch);
+
+  // the filters read one byte past every position, so the caller's input is
+  // searched up to where the remaining patterns are known to fit into it
+  int end = length - SCRATCH_TAIL_LENGTH;
+  if (end > 0) {
+    searchCpuRange(dfc, scratch->filter, (uint8_t *)input, 0, end, length,
+                   &sink);
+  } else {
+    end = 0;
+  }
+
+  int tailLength = length - end;
+  memcpy(scratch->tail, input + end, tailLength);
+  scratch->tail[tailLength] = 0;
+
+  batch.chunkOffset = end;
+  searchCpuRange(dfc, scratch->filter, scratch->tail, 0, tailLength,
+                 tailLength, &sink);
+  flushMatchBatch(&batch);
+
+  return sink.matchCount;
+}
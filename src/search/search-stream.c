@@ -0,0 +1,114 @@
+#include <string.h>
+
+#include "memory.h"
+#include "search-cpu.h"
+#include "search-stream.h"
+
+/*
+ * A position is only searched once MAX_PATTERN_LENGTH bytes starting at it
+ * are known, so the end of every write is kept until the next one arrives.
+ *
+ * The window holds these bytes followed by the start of the next write,
+ * which is all that is needed to search them. The rest of a write is
+ * searched where the caller keeps it, so only the window is ever copied.
+ */
+#define STREAM_LOOKAHEAD (MAX_PATTERN_LENGTH - 1)
+
+struct DfcStream_ {
+  DFC_STRUCTURE *dfc;
+  MatchBatch batch;
+  CpuFilterFunction filter;
+
+  // amount of bytes written so far
+  uint64_t offset;
+
+  int tailLength;
+  // one spare byte as the direct filters look at the next byte too
+  uint8_t window[2 * STREAM_LOOKAHEAD + 1];
+};
+
+DFC_STREAM *openStream(DFC_STRUCTURE *dfc, MatchBatch batch) {
+  // the direct filters are not accessible from the host if they are mapped
+  if (MAP_MEMORY && shouldUseOpenCl()) {
+    fprintf(stderr, "Streams require the direct filters on the host\n");
+    exit(STREAM_NEEDS_HOST_FILTERS_EXIT_CODE);
+  }
+
+  DFC_STREAM *stream = calloc(1, sizeof(DFC_STREAM));
+  if (!stream) {
+    fprintf(stderr, "Could not allocate stream\n");
+    exit(1);
+  }
+
+  stream->dfc = dfc;
+  stream->batch = batch;
+  stream->filter = getCpuFilter();
+
+  return stream;
+}
+
+int writeToStream(DFC_STREAM *stream, const uint8_t *data, int length) {
+  DFC_STRUCTURE *dfc = stream->dfc;
+  MatchBatch *batch = &stream->batch;
+  MatchSink sink = createDirectMatchSink(batch);
+
+  int matches = 0;
+
+  // the kept positions become searchable with the first bytes of the write
+  int copyLength = length < STREAM_LOOKAHEAD ? length : STREAM_LOOKAHEAD;
+  memcpy(stream->window + stream->tailLength, data, copyLength);
+
+  int windowLength = stream->tailLength + copyLength;
+  int windowEnd = windowLength - STREAM_LOOKAHEAD;
+  if (windowEnd > 0) {
+    batch->chunkOffset = stream->offset - stream->tailLength;
+    searchCpuRange(dfc, stream->filter, stream->window, 0, windowEnd,
+                   windowLength, &sink);
+  }
+
+  if (length >= STREAM_LOOKAHEAD) {
+    // every kept position was searched, continue in the data of the caller
+    uint8_t *input = (uint8_t *)data;
+    int end = length - STREAM_LOOKAHEAD;
+
+    batch->chunkOffset = stream->offset;
+    if (shouldSearchInParallel(end)) {
+      matches +=
+          searchChunkInParallel(dfc, stream->filter, input, end, length, batch);
+    } else {
+      searchCpuRange(dfc, stream->filter, input, 0, end, length, &sink);
+    }
+
+    memcpy(stream->window, data + end, STREAM_LOOKAHEAD);
+    stream->tailLength = STREAM_LOOKAHEAD;
+  } else {
+    int searched = windowEnd > 0 ? windowEnd : 0;
+
+    memmove(stream->window, stream->window + searched,
+            windowLength - searched);
+    stream->tailLength = windowLength - searched;
+  }
+
+  stream->offset += length;
+  flushMatchBatch(batch);
+
+  return matches + sink.matchCount;
+}
+
+int closeStream(DFC_STREAM *stream) {
+  DFC_STRUCTURE *dfc = stream->dfc;
+  MatchBatch *batch = &stream->batch;
+  MatchSink sink = createDirectMatchSink(batch);
+
+  // nothing follows, the remaining patterns have to fit into the tail
+  stream->window[stream->tailLength] = 0;
+
+  batch->chunkOffset = stream->offset - stream->tailLength;
+  searchCpuRange(dfc, stream->filter, stream->window, 0, stream->tailLength,
+                 stream->tailLength, &sink);
+  flushMatchBatch(batch);
+
+  free(stream);
+
+  return sink.matchCount;
+}
@@ -1,12 +1,16 @@
 #include "search.h"
 
-extern int searchCpu(ReadFunction, MatchFunction);
-extern int searchCpuEmulateGpu(ReadFunction, MatchFunction);
-extern int searchGpu(ReadFunction, MatchFunction);
+extern int searchCpu(ReadFunction, MatchBatch *);
+extern int searchCpuPipelined(ReadFunction, MatchBatch *);
+extern int searchCpuEmulateGpu(ReadFunction, MatchBatch *);
+extern int searchGpu(ReadFunction, MatchBatch *);
 
-int search(ReadFunction read, MatchFunction onMatch) {
+int search(ReadFunction read, MatchBatch *batch) {
   if (SEARCH_WITH_GPU || HETEROGENEOUS_DESIGN) {
-    return searchGpu(read, onMatch);
+    return searchGpu(read, batch);
   }
-  return searchCpu(read, onMatch);
+  if (PIPELINE_SEARCH) {
+    return searchCpuPipelined(read, batch);
+  }
+  return searchCpu(read, batch);
 }
\ No newline at end of file
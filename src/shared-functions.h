@@ -3,12 +3,74 @@
 
 #include "shared-internal.h"
 
-static uint32_t hashForLargeCompactTable(uint32_t input) {
-  return (input * 8389) & (COMPACT_TABLE_SIZE_LARGE - 1);
+// see ctLargeHashMultiplier in DFC_TABLE_SIZES
+static inline uint32_t hashForLargeCompactTable(uint32_t input,
+                                                uint32_t multiplier, int shift,
+                                                int bucketBits) {
+  return ((input * multiplier) >> shift) & ((1u << bucketBits) - 1);
 }
 
-static uint16_t directFilterHash(int32_t val) {
-  return BINDEX((val * 8387) & DF_MASK);
+// byte of the large hash direct filter with 2^bits bits
+static inline uint32_t directFilterHash(uint32_t val, int bits) {
+  return BINDEX((val * 8387) & ((1u << bits) - 1));
+}
+
+/*
+ * The long tier is keyed on 8 bytes. Trying every case permutation of them
+ * like the large tier does would add up to 256 entries per case insensitive
+ * pattern, so the ASCII letters of the fragment are lowered instead, both in
+ * the patterns and the input. The verification still compares the case.
+ */
+#define LONG_FRAGMENT_ONES 0x0101010101010101UL
+#define LONG_FRAGMENT_HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+static inline uint64_t foldLongFragment(uint64_t fragment) {
+  uint64_t heptets = fragment & (0x7f * LONG_FRAGMENT_ONES);
+  uint64_t aboveA = heptets + (0x80 - 'A') * LONG_FRAGMENT_ONES;
+  uint64_t aboveZ = heptets + (0x80 - 'Z' - 1) * LONG_FRAGMENT_ONES;
+  uint64_t isUpper =
+      aboveA & ~aboveZ & ~fragment & (0x80 * LONG_FRAGMENT_ONES);
+
+  return fragment | (isUpper >> 2);
+}
+
+// the low bits of the fragment are its first bytes, hence the high bits of
+// the product are used, which depend on all of them
+static inline uint32_t hashForLongCompactTable(uint64_t fragment,
+                                               int bucketBits) {
+  return (fragment * LONG_FRAGMENT_HASH_MULTIPLIER) >> (64 - bucketBits);
+}
+
+// bit of the long hash direct filter with 2^bits bits
+static inline uint32_t directFilterLongHash(uint64_t fragment, int bits) {
+  return (fragment * LONG_FRAGMENT_HASH_MULTIPLIER) >> (64 - bits);
+}
+
+/*
+ * Blocked Bloom filter, see BLOOM_FILTER_BLOCK_BITS
+ * The high bits of the product select the block, the bits within the block
+ * are taken from right below them. The lowest bits of the product only depend
+ * on the lowest bits of the key and are not used.
+ */
+#define BLOOM_FILTER_FIRST_BIT_SHIFT                    \
+  (64 - (DF_HASH_MAX_BITS - BLOOM_FILTER_BLOCK_BITS) - \
+   BLOOM_FILTER_HASH_COUNT * BLOOM_FILTER_BLOCK_BITS)
+
+static inline uint64_t bloomFilterHash(uint32_t key) {
+  return (uint64_t)key * LONG_FRAGMENT_HASH_MULTIPLIER;
+}
+
+// offset in bytes of the block of a filter with 2^bits bits
+static inline uint32_t bloomFilterBlockOffset(uint64_t hash, int bits) {
+  return (hash >> (64 - (bits - BLOOM_FILTER_BLOCK_BITS)))
+         << (BLOOM_FILTER_BLOCK_BITS - 3);
+}
+
+// index of the j-th bit within the block
+static inline uint32_t bloomFilterBit(uint64_t hash, int j) {
+  return (hash >> (BLOOM_FILTER_FIRST_BIT_SHIFT +
+                   j * BLOOM_FILTER_BLOCK_BITS)) &
+         ((1 << BLOOM_FILTER_BLOCK_BITS) - 1);
 }
 
 #endif
\ No newline at end of file
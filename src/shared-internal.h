@@ -6,6 +6,8 @@
 typedef struct VerifyResult_ {
   uint8_t matchCount;
   PID_TYPE matches[MAX_MATCHES_PER_THREAD];
+  // position of each match, relative to the first position of the thread
+  uint8_t positions[MAX_MATCHES_PER_THREAD];
 } VerifyResult;
 
 #endif
\ No newline at end of file
@@ -8,24 +8,45 @@
 #define int16_t short
 #define uint32_t uint
 #define int32_t int
+#define uint64_t ulong
 #else
 #include <stdint.h>
 #endif
 
-#define PID_TYPE uint16_t
+#define PID_TYPE uint32_t
 
 #define DF_SIZE 0x10000
 #define DF_SIZE_REAL 0x2000
 
-#define INIT_HASH_SIZE 65536
-
 #define DIRECT_FILTER_SIZE_SMALL DF_SIZE_REAL
 
 #define SMALL_DF_MIN_PATTERN_SIZE 1
 #define SMALL_DF_MAX_PATTERN_SIZE 3
 
+// patterns of at least this length are keyed on their first 8 bytes instead
+// of their first 4 bytes
+#define LONG_DF_MIN_PATTERN_SIZE 8
+
 #define COMPACT_TABLE_SIZE_SMALL 0x100
-#define COMPACT_TABLE_SIZE_LARGE 0x20000
+
+/*
+ * The hash direct filters and the large and long compact tables are sized by
+ * DFC_Compile from the patterns, see DFC_TABLE_SIZES. Their sizes are powers
+ * of two within these bounds, given as log2 of the amount of bits in a filter
+ * and of the amount of buckets in a table.
+ */
+#define DF_HASH_MIN_BITS 16
+#define DF_HASH_MAX_BITS 24
+#define COMPACT_TABLE_MIN_BITS 17
+#define COMPACT_TABLE_MAX_BITS 22
+
+// size in bytes of a hash direct filter with 2^bits bits
+#define DF_HASH_SIZE_REAL(bits) (1 << ((bits)-3))
+
+// if BLOCKED_BLOOM_FILTER is set, each key of the large hash direct filter
+// sets BLOOM_FILTER_HASH_COUNT bits within a single block of 2^BLOCK_BITS bits
+#define BLOOM_FILTER_BLOCK_BITS 9  // 64 bytes, a cache line
+#define BLOOM_FILTER_HASH_COUNT 4
 
 #define MAX_EQUAL_PATTERNS 220
 #define MAX_PATTERN_LENGTH 64
@@ -39,32 +60,66 @@
 
 #define TEXTURE_CHANNEL_BYTE_SIZE 16
 
+// verification routine used for a pattern, depends on the pattern length
+#define VERIFY_UP_TO_8 0
+#define VERIFY_UP_TO_16 1
+#define VERIFY_UP_TO_32 2
+#define VERIFY_LONGER 3
+
+// the counts and offsets are 32 bit, since the tables of large pattern sets
+// hold more than 65536 entries and pids
 typedef struct CompactTableSmallEntry_ {
   uint8_t pattern;
-  uint16_t pidCount;
-  uint16_t offset;
+  uint32_t pidCount;
+  uint32_t offset;
 } CompactTableSmallEntry;
 
 typedef struct CompactTableLargeEntry_ {
   uint32_t pattern;
-  uint16_t pidCount;
-  uint16_t pidOffset;
+  uint32_t pidCount;
+  uint32_t pidOffset;
 } CompactTableLargeEntry;
 
 typedef struct CompactTableLargeBucket_ {
-  uint16_t entryCount;
-  uint16_t entryOffset;
+  uint32_t entryCount;
+  uint32_t entryOffset;
 } CompactTableLargeBucket;
 
+typedef struct CompactTableLongEntry_ {
+  uint64_t pattern;  // first 8 bytes of the pattern, case folded
+  uint32_t pidCount;
+  uint32_t pidOffset;
+} CompactTableLongEntry;
+
+typedef struct CompactTableLongBucket_ {
+  uint32_t entryCount;
+  uint32_t entryOffset;
+} CompactTableLongBucket;
+
+/*
+ * The bytes of the patterns are packed one after another, see patternBytes in
+ * DFC_PATTERNS. Starting at pattern_offset, each pattern has pattern_length
+ * bytes of:
+ *  - the folded pattern
+ *  - the case mask
+ *  - the original pattern
+ *
+ * A position matches if (input[i] | mask[i]) == folded[i] for every byte
+ * case insensitive: lower case pattern, 0x20 at every letter
+ * case sensitive: original pattern, no mask
+ */
 typedef struct _dfc_fixed_pattern {
   uint8_t pattern_length;
   uint8_t is_case_insensitive;
   uint8_t external_id_count;
+  uint8_t verifier;  // VERIFY_*
 
-  uint8_t upper_case_pattern[MAX_PATTERN_LENGTH];
-  uint8_t original_pattern[MAX_PATTERN_LENGTH];
+  // start of the fragment the large and long patterns are filtered and looked
+  // up by, a match is found this many bytes after its first byte
+  uint8_t fragment_offset;
 
-  PID_TYPE external_ids[MAX_EQUAL_PATTERNS];
+  uint32_t pattern_offset;      // into patternBytes
+  uint32_t external_id_offset;  // into externalIds, only on the host
 } DFC_FIXED_PATTERN;
 
 #endif
@@ -0,0 +1,194 @@
+#include "structure-file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "update.h"
+
+#define STRUCTURE_FILE_MAGIC "DFCTABLE"
+#define STRUCTURE_FILE_BYTE_ORDER 0x01020304u
+
+// the tables follow the header at a page boundary, so that they may be mapped
+#define STRUCTURE_FILE_HEADER_SIZE 4096
+
+/*
+ * File layout
+ *
+ * The header is followed by the region holding the tables of the structure,
+ * see allocateDfcStructure. The tables only refer to each other by offsets,
+ * so the region is mapped and searched as it is. Only a build with the same
+ * configuration may do so, as told by the configuration hash.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint64_t configuration;
+
+  // see DFC_PATTERN_INIT, 0 if patterns were added to or removed from the
+  // structure after it was compiled
+  uint64_t patternHash;
+
+  // the region is laid out for the capacity of the tables
+  DfcMemoryRequirements capacity;
+  DfcMemoryRequirements used;
+  int32_t maxFragmentOffset;
+
+  uint64_t tableBytes;
+} StructureFileHeader;
+
+static uint64_t hashValue(uint64_t hash, uint64_t value) {
+  return (hash ^ value) * 1099511628211u;
+}
+
+// everything the layout of the tables and the way they are searched rely on
+static uint64_t hashConfiguration() {
+  uint64_t values[] = {sizeof(StructureFileHeader),
+                       sizeof(DFC_FIXED_PATTERN),
+                       sizeof(CompactTableSmallEntry),
+                       sizeof(CompactTableLargeBucket),
+                       sizeof(CompactTableLargeEntry),
+                       sizeof(CompactTableLongBucket),
+                       sizeof(CompactTableLongEntry),
+                       sizeof(PID_TYPE),
+                       REGION_ALIGNMENT,
+                       DF_SIZE_REAL,
+                       COMPACT_TABLE_SIZE_SMALL,
+                       SMALL_DF_MAX_PATTERN_SIZE,
+                       LONG_DF_MIN_PATTERN_SIZE,
+                       MAX_PATTERN_LENGTH,
+                       MAX_EQUAL_PATTERNS,
+                       BLOOM_FILTER_HASH_COUNT,
+                       BLOCKED_BLOOM_FILTER,
+                       CUCKOO_LARGE_CT,
+                       RAREST_FRAGMENT};
+
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    hash = hashValue(hash, values[i]);
+  }
+
+  return hash;
+}
+
+static StructureFileHeader createHeader(DFC_STRUCTURE *dfc) {
+  StructureFileHeader header;
+  memset(&header, 0, sizeof(header));
+
+  memcpy(header.magic, STRUCTURE_FILE_MAGIC, sizeof(header.magic));
+  header.version = STRUCTURE_FILE_VERSION;
+  header.byteOrder = STRUCTURE_FILE_BYTE_ORDER;
+  header.configuration = hashConfiguration();
+  header.patternHash = dfc->patternHash;
+  header.capacity = requirementsOfTables(dfc, dfc->updates->capacity);
+  header.used = requirementsOfTables(dfc, dfc->updates->used);
+  header.maxFragmentOffset = dfc->maxFragmentOffset;
+  header.tableBytes = dfc->tables.used;
+
+  return header;
+}
+
+static bool writeStructureFile(FILE *file, DFC_STRUCTURE *dfc) {
+  StructureFileHeader header = createHeader(dfc);
+  uint8_t padding[STRUCTURE_FILE_HEADER_SIZE - sizeof(header)];
+  memset(padding, 0, sizeof(padding));
+
+  return fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(padding, sizeof(padding), 1, file) == 1 &&
+         fwrite(dfc->tables.memory, 1, dfc->tables.used, file) ==
+             dfc->tables.used;
+}
+
+bool saveStructure(DFC_STRUCTURE *dfc, const char *path) {
+  // the tables are spread over OpenCL buffers when they are mapped
+  if (!dfc->tables.memory) {
+    return false;
+  }
+
+  // written next to the file and renamed, so that other processes never map
+  // half of it
+  char temporaryPath[4096];
+  int length = snprintf(temporaryPath, sizeof(temporaryPath), "%s.%d.tmp",
+                        path, (int)getpid());
+  if (length < 0 || length >= (int)sizeof(temporaryPath)) {
+    return false;
+  }
+
+  FILE *file = fopen(temporaryPath, "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool isWritten = writeStructureFile(file, dfc);
+  isWritten = fclose(file) == 0 && isWritten;
+
+  if (!isWritten || rename(temporaryPath, path) != 0) {
+    remove(temporaryPath);
+    return false;
+  }
+
+  return true;
+}
+
+static bool fitsThisBuild(StructureFileHeader *header, uint64_t patternHash,
+                          off_t fileSize) {
+  return memcmp(header->magic, STRUCTURE_FILE_MAGIC, sizeof(header->magic)) ==
+             0 &&
+         header->version == STRUCTURE_FILE_VERSION &&
+         header->byteOrder == STRUCTURE_FILE_BYTE_ORDER &&
+         header->configuration == hashConfiguration() &&
+         (!patternHash || header->patternHash == patternHash) &&
+         header->tableBytes == hostRegionSize(header->capacity) &&
+         (uint64_t)fileSize ==
+             STRUCTURE_FILE_HEADER_SIZE + header->tableBytes;
+}
+
+static void *mapTables(int fd, uint64_t patternHash,
+                       StructureFileHeader *header) {
+  struct stat status;
+  if (fstat(fd, &status) != 0 ||
+      pread(fd, header, sizeof(*header), 0) != sizeof(*header) ||
+      !fitsThisBuild(header, patternHash, status.st_size)) {
+    return NULL;
+  }
+
+  // private, so that updates of the structure never reach the file
+  void *tables = mmap(NULL, header->tableBytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, STRUCTURE_FILE_HEADER_SIZE);
+
+  return tables == MAP_FAILED ? NULL : tables;
+}
+
+DFC_STRUCTURE *loadStructure(const char *path, uint64_t patternHash) {
+  if (shouldUseMappedMemory()) {
+    return NULL;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  StructureFileHeader header;
+  void *tables = mapTables(fd, patternHash, &header);
+  close(fd);
+
+  if (!tables) {
+    return NULL;
+  }
+
+  HostRegion region = {
+      .memory = tables, .mappedSize = header.tableBytes, .used = 0};
+  DFC_STRUCTURE *dfc = wrapDfcStructure(region, header.capacity);
+
+  dfc->sizes = header.capacity.sizes;
+  dfc->maxFragmentOffset = header.maxFragmentOffset;
+  dfc->patternHash = header.patternHash;
+  dfc->patterns->numPatterns = header.used.patternCount;
+  dfc->updates = createUpdates(header.capacity, header.used);
+
+  return dfc;
+}
@@ -0,0 +1,16 @@
+#ifndef DFC_STRUCTURE_FILE_H
+#define DFC_STRUCTURE_FILE_H
+
+#include "dfc.h"
+
+// bumped whenever the layout of the file or of the tables changes
+#define STRUCTURE_FILE_VERSION 1
+
+// false if the file could not be written
+bool saveStructure(DFC_STRUCTURE *dfc, const char *path);
+
+// NULL if there is no such file, or if it does not fit this build, or if
+// patternHash is not 0 and the file was saved for other patterns
+DFC_STRUCTURE *loadStructure(const char *path, uint64_t patternHash);
+
+#endif
@@ -0,0 +1,157 @@
+#include "thread-pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+typedef struct {
+  ThreadPool *pool;
+  int index;
+} Worker;
+
+struct ThreadPool_ {
+  int threadCount;
+  pthread_t *threads;
+  Worker *workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t taskAvailable;
+  pthread_cond_t taskFinished;
+
+  ThreadPoolTask task;
+  void *argument;
+
+  // incremented for every task so that workers never run a task twice
+  unsigned long generation;
+  int runningWorkers;
+  bool shutdown;
+};
+
+static void *workerLoop(void *arg) {
+  Worker *worker = (Worker *)arg;
+  ThreadPool *pool = worker->pool;
+
+  unsigned long seenGeneration = 0;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown && pool->generation == seenGeneration) {
+      pthread_cond_wait(&pool->taskAvailable, &pool->lock);
+    }
+
+    if (pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+
+    seenGeneration = pool->generation;
+    ThreadPoolTask task = pool->task;
+    void *argument = pool->argument;
+    pthread_mutex_unlock(&pool->lock);
+
+    task(argument, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->runningWorkers == 0) {
+      pthread_cond_signal(&pool->taskFinished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+ThreadPool *createThreadPool(int threadCount) {
+  ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+  if (!pool) {
+    fprintf(stderr, "Could not allocate thread pool\n");
+    exit(1);
+  }
+
+  pool->threadCount = threadCount < 1 ? 1 : threadCount;
+  pool->threads = calloc(pool->threadCount, sizeof(pthread_t));
+  pool->workers = calloc(pool->threadCount, sizeof(Worker));
+  if (!pool->threads || !pool->workers) {
+    fprintf(stderr, "Could not allocate thread pool workers\n");
+    exit(1);
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->taskAvailable, NULL);
+  pthread_cond_init(&pool->taskFinished, NULL);
+
+  // index 0 is the calling thread
+  for (int i = 1; i < pool->threadCount; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+
+    if (pthread_create(&pool->threads[i], NULL, workerLoop,
+                       &pool->workers[i])) {
+      fprintf(stderr, "Could not start worker thread %d\n", i);
+      exit(COULD_NOT_START_THREAD_EXIT_CODE);
+    }
+  }
+
+  return pool;
+}
+
+void destroyThreadPool(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->taskAvailable);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 1; i < pool->threadCount; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->taskAvailable);
+  pthread_cond_destroy(&pool->taskFinished);
+
+  free(pool->threads);
+  free(pool->workers);
+  free(pool);
+}
+
+int getThreadPoolSize(ThreadPool *pool) { return pool->threadCount; }
+
+void runOnAllThreads(ThreadPool *pool, ThreadPoolTask task, void *argument) {
+  if (pool->threadCount > 1) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->argument = argument;
+    pool->runningWorkers = pool->threadCount - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->taskAvailable);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  task(argument, 0);
+
+  if (pool->threadCount > 1) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->runningWorkers > 0) {
+      pthread_cond_wait(&pool->taskFinished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static int threadCountOrOnlineCores(int threadCount) {
+  if (threadCount > 0) {
+    return threadCount;
+  }
+
+  long onlineCores = sysconf(_SC_NPROCESSORS_ONLN);
+  return onlineCores > 0 ? (int)onlineCores : 1;
+}
+
+int getConfiguredThreadCount() {
+  return threadCountOrOnlineCores(CPU_THREAD_COUNT);
+}
+
+int getConfiguredCompileThreadCount() {
+  return threadCountOrOnlineCores(COMPILE_THREAD_COUNT);
+}
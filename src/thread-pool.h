@@ -0,0 +1,25 @@
+#ifndef DFC_THREAD_POOL_H
+#define DFC_THREAD_POOL_H
+
+typedef void (*ThreadPoolTask)(void *argument, int threadIndex);
+
+typedef struct ThreadPool_ ThreadPool;
+
+/*
+ * Starts threadCount - 1 worker threads, the thread calling runOnAllThreads
+ * acts as the last worker (index 0)
+ */
+ThreadPool *createThreadPool(int threadCount);
+void destroyThreadPool(ThreadPool *pool);
+
+int getThreadPoolSize(ThreadPool *pool);
+
+// blocks until the task has finished on every thread
+void runOnAllThreads(ThreadPool *pool, ThreadPoolTask task, void *argument);
+
+// thread count given by CPU_THREAD_COUNT, 0 means one per online core
+int getConfiguredThreadCount();
+// same for COMPILE_THREAD_COUNT
+int getConfiguredCompileThreadCount();
+
+#endif
@@ -0,0 +1,820 @@
+#include "update.h"
+
+#include "shared-functions.h"
+
+// buckets of the index of the patterns by their bytes
+#define PATTERN_INDEX_SIZE 0x10000
+
+// bytes of each item of the tables, the direct filters are changed by byte
+static const size_t TABLE_ITEM_SIZES[TABLE_COUNT] = {
+    1,
+    1,
+    1,
+    1,
+    sizeof(CompactTableSmallEntry),
+    sizeof(PID_TYPE),
+    sizeof(CompactTableLargeBucket),
+    sizeof(CompactTableLargeEntry),
+    sizeof(PID_TYPE),
+    sizeof(CompactTableLongBucket),
+    sizeof(CompactTableLongEntry),
+    sizeof(PID_TYPE),
+    sizeof(DFC_FIXED_PATTERN),
+    1,
+    sizeof(PID_TYPE)};
+
+static void *allocateUpdateMemory(size_t size) {
+  void *memory = calloc(1, size);
+  if (!memory) {
+    fprintf(stderr, "Could not allocate memory for updates\n");
+    exit(1);
+  }
+
+  return memory;
+}
+
+static void setTableSpace(DfcUpdates *updates, int table, int capacity,
+                          int used) {
+  updates->capacity[table] = capacity;
+  updates->used[table] = used;
+}
+
+DfcUpdates *createUpdates(DfcMemoryRequirements capacity,
+                          DfcMemoryRequirements used) {
+  DfcUpdates *updates = allocateUpdateMemory(sizeof(DfcUpdates));
+
+  setTableSpace(updates, TABLE_CT_SMALL_PIDS, capacity.ctSmallPidCount,
+                used.ctSmallPidCount);
+  setTableSpace(updates, TABLE_CT_LARGE_ENTRIES, capacity.ctLargeEntryCount,
+                used.ctLargeEntryCount);
+  setTableSpace(updates, TABLE_CT_LARGE_PIDS, capacity.ctLargePidCount,
+                used.ctLargePidCount);
+  setTableSpace(updates, TABLE_CT_LONG_ENTRIES, capacity.ctLongEntryCount,
+                used.ctLongEntryCount);
+  setTableSpace(updates, TABLE_CT_LONG_PIDS, capacity.ctLongPidCount,
+                used.ctLongPidCount);
+  setTableSpace(updates, TABLE_PATTERNS, capacity.patternCount,
+                used.patternCount);
+  setTableSpace(updates, TABLE_PATTERN_BYTES, capacity.patternByteCount,
+                used.patternByteCount);
+  setTableSpace(updates, TABLE_EXTERNAL_IDS, capacity.externalIdCount,
+                used.externalIdCount);
+
+  return updates;
+}
+
+DfcMemoryRequirements requirementsOfTables(DFC_STRUCTURE *dfc,
+                                           const int *counts) {
+  DfcMemoryRequirements requirements = {
+      .patternCount = counts[TABLE_PATTERNS],
+      .patternByteCount = counts[TABLE_PATTERN_BYTES],
+      .externalIdCount = counts[TABLE_EXTERNAL_IDS],
+      .ctSmallPidCount = counts[TABLE_CT_SMALL_PIDS],
+      .ctLargeEntryCount = counts[TABLE_CT_LARGE_ENTRIES],
+      .ctLargePidCount = counts[TABLE_CT_LARGE_PIDS],
+      .ctLongEntryCount = counts[TABLE_CT_LONG_ENTRIES],
+      .ctLongPidCount = counts[TABLE_CT_LONG_PIDS],
+      .sizes = dfc->sizes};
+
+  return requirements;
+}
+
+void freeUpdates(DfcUpdates *updates) {
+  if (!updates) {
+    return;
+  }
+
+  for (int i = 0; i < DIRECT_FILTER_COUNT; ++i) {
+    free(updates->referenceCounts[i]);
+  }
+  free(updates->indexHeads);
+  free(updates->indexNext);
+  free(updates->freePids);
+  free(updates->pairFrequencies);
+  free(updates);
+}
+
+bool hasStartedUpdates(DFC_STRUCTURE *dfc) {
+  return dfc->updates->indexHeads != NULL;
+}
+
+void startUpdates(DFC_STRUCTURE *dfc) {
+  DfcUpdates *updates = dfc->updates;
+
+  for (int i = 0; i < DIRECT_FILTER_COUNT; ++i) {
+    updates->referenceCounts[i] =
+        allocateUpdateMemory(directFilterBitCount(dfc, i) * sizeof(uint32_t));
+  }
+
+  updates->indexHeads =
+      allocateUpdateMemory(PATTERN_INDEX_SIZE * sizeof(int32_t));
+  memset(updates->indexHeads, 0xff, PATTERN_INDEX_SIZE * sizeof(int32_t));
+  updates->indexNext = allocateUpdateMemory(
+      updates->capacity[TABLE_PATTERNS] * sizeof(int32_t));
+
+  updates->freePids = allocateUpdateMemory(
+      updates->capacity[TABLE_PATTERNS] * sizeof(PID_TYPE));
+
+  if (RAREST_FRAGMENT) {
+    updates->pairFrequencies =
+        allocateUpdateMemory((1 << 16) * sizeof(uint32_t));
+  }
+}
+
+static void markChanged(DFC_STRUCTURE *dfc, int table, int first, int count) {
+  DfcUpdates *updates = dfc->updates;
+  size_t start = first * TABLE_ITEM_SIZES[table];
+  size_t end = (first + count) * TABLE_ITEM_SIZES[table];
+
+  if (updates->changedStart[table] >= updates->changedEnd[table]) {
+    updates->changedStart[table] = start;
+    updates->changedEnd[table] = end;
+  } else {
+    if (start < updates->changedStart[table]) {
+      updates->changedStart[table] = start;
+    }
+    if (end > updates->changedEnd[table]) {
+      updates->changedEnd[table] = end;
+    }
+  }
+}
+
+void countFilterBits(DFC_STRUCTURE *dfc, FilterBits *bits) {
+  uint32_t *counts = dfc->updates->referenceCounts[bits->filter];
+
+  for (int i = 0; i < bits->bitCount; ++i) {
+    ++counts[bits->bits[i]];
+  }
+}
+
+void referenceFilterBits(DFC_STRUCTURE *dfc, FilterBits *bits, int delta) {
+  uint32_t *counts = dfc->updates->referenceCounts[bits->filter];
+  uint8_t *df = directFilterOf(dfc, bits->filter);
+
+  for (int i = 0; i < bits->bitCount; ++i) {
+    uint32_t bit = bits->bits[i];
+    counts[bit] += delta;
+
+    bool shouldBeSet = counts[bit] > 0;
+    bool isSet = df[BINDEX(bit)] & BMASK(bit);
+    if (shouldBeSet != isSet) {
+      df[BINDEX(bit)] ^= BMASK(bit);
+      markChanged(dfc, bits->filter, BINDEX(bit), 1);
+    }
+  }
+}
+
+static uint32_t hashPatternBytes(const uint8_t *pattern, int length) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; ++i) {
+    hash = (hash ^ pattern[i]) * 16777619u;
+  }
+
+  return hash & (PATTERN_INDEX_SIZE - 1);
+}
+
+int findPattern(DFC_STRUCTURE *dfc, const uint8_t *pattern, int length) {
+  DfcUpdates *updates = dfc->updates;
+
+  int32_t pid = updates->indexHeads[hashPatternBytes(pattern, length)];
+  for (; pid >= 0; pid = updates->indexNext[pid]) {
+    DFC_FIXED_PATTERN *candidate = DFC_GetPatternOf(dfc, pid);
+    if (candidate->pattern_length == length &&
+        memcmp(DFC_GetPatternBytesOf(dfc, candidate), pattern, length) == 0) {
+      return pid;
+    }
+  }
+
+  return -1;
+}
+
+void indexPattern(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  DfcUpdates *updates = dfc->updates;
+  DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+  int32_t *head = updates->indexHeads +
+                  hashPatternBytes(DFC_GetPatternBytesOf(dfc, pattern),
+                                   pattern->pattern_length);
+
+  updates->indexNext[pid] = *head;
+  *head = pid;
+}
+
+void unindexPattern(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  DfcUpdates *updates = dfc->updates;
+  DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+  int32_t *link = updates->indexHeads +
+                  hashPatternBytes(DFC_GetPatternBytesOf(dfc, pattern),
+                                   pattern->pattern_length);
+
+  while (*link != (int32_t)pid) {
+    link = updates->indexNext + *link;
+  }
+  *link = updates->indexNext[pid];
+}
+
+static void exitWithoutRoom(const char *table) {
+  fprintf(stderr,
+          "No room left in the %s for another pattern. Please compile the "
+          "patterns again or increase UPDATE_SLACK_PERCENT. (Currently %d)\n",
+          table, UPDATE_SLACK_PERCENT);
+  exit(NO_ROOM_FOR_ADDED_PATTERN_EXIT_CODE);
+}
+
+PID_TYPE takePid(DFC_STRUCTURE *dfc) {
+  DfcUpdates *updates = dfc->updates;
+  if (updates->freePidCount) {
+    return updates->freePids[--updates->freePidCount];
+  }
+
+  if (updates->used[TABLE_PATTERNS] == updates->capacity[TABLE_PATTERNS]) {
+    exitWithoutRoom("patterns");
+  }
+
+  // not packed before the pattern is set up
+  PID_TYPE pid = updates->used[TABLE_PATTERNS]++;
+  DFC_GetPatternOf(dfc, pid)->external_id_count = 0;
+  dfc->patterns->numPatterns = updates->used[TABLE_PATTERNS];
+
+  return pid;
+}
+
+void releasePid(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  DfcUpdates *updates = dfc->updates;
+
+  // patterns without external ids are left out when packing the tables
+  DFC_GetPatternOf(dfc, pid)->external_id_count = 0;
+  markPatternChanged(dfc, pid);
+
+  updates->freePids[updates->freePidCount++] = pid;
+}
+
+void markPatternChanged(DFC_STRUCTURE *dfc, PID_TYPE pid) {
+  DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+
+  markChanged(dfc, TABLE_PATTERNS, pid, 1);
+  markChanged(dfc, TABLE_PATTERN_BYTES, pattern->pattern_offset,
+              3 * pattern->pattern_length);
+}
+
+/*
+ * Packing
+ *
+ * The ranges still used are copied one after another in the order of their
+ * owners, leaving the room of the moved and removed ones at the end.
+ */
+static uint8_t *startPacking(DFC_STRUCTURE *dfc, int table) {
+  return allocateUpdateMemory(dfc->updates->capacity[table] *
+                              TABLE_ITEM_SIZES[table]);
+}
+
+// copies count items at offset to the packed ones, returns their new offset
+static int packRange(DFC_STRUCTURE *dfc, int table, uint8_t *packed,
+                     void *items, int offset, int count) {
+  size_t itemSize = TABLE_ITEM_SIZES[table];
+  int packedOffset = dfc->updates->used[table];
+
+  memcpy(packed + packedOffset * itemSize, (uint8_t *)items + offset * itemSize,
+         count * itemSize);
+  dfc->updates->used[table] += count;
+
+  return packedOffset;
+}
+
+static void finishPacking(DFC_STRUCTURE *dfc, int table, uint8_t *packed,
+                          void *items) {
+  int used = dfc->updates->used[table];
+
+  memcpy(items, packed, used * TABLE_ITEM_SIZES[table]);
+  free(packed);
+
+  markChanged(dfc, table, 0, used);
+}
+
+static void packSmallCtPids(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_CT_SMALL_PIDS);
+  dfc->updates->used[TABLE_CT_SMALL_PIDS] = 0;
+
+  for (int i = 0; i < COMPACT_TABLE_SIZE_SMALL; ++i) {
+    CompactTableSmallEntry *entry = dfc->ctSmallEntries + i;
+    entry->offset = packRange(dfc, TABLE_CT_SMALL_PIDS, packed,
+                              dfc->ctSmallPids, entry->offset, entry->pidCount);
+  }
+
+  finishPacking(dfc, TABLE_CT_SMALL_PIDS, packed, dfc->ctSmallPids);
+  markChanged(dfc, TABLE_CT_SMALL_ENTRIES, 0, COMPACT_TABLE_SIZE_SMALL);
+}
+
+static void packLargeCtPids(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_CT_LARGE_PIDS);
+  dfc->updates->used[TABLE_CT_LARGE_PIDS] = 0;
+
+  int bucketCount = ctLargeBucketCount(dfc->sizes);
+  for (int i = 0; i < bucketCount; ++i) {
+    CompactTableLargeBucket *bucket = dfc->ctLargeBuckets + i;
+
+    // the slots of the cuckoo variant are the entries of its single bucket
+    int entryOffset = CUCKOO_LARGE_CT ? 0 : (int)bucket->entryOffset;
+    int entryCount = CUCKOO_LARGE_CT ? 1 << dfc->sizes.ctLargeBits
+                                     : (int)bucket->entryCount;
+
+    for (int j = 0; j < entryCount; ++j) {
+      CompactTableLargeEntry *entry = dfc->ctLargeEntries + entryOffset + j;
+      entry->pidOffset =
+          packRange(dfc, TABLE_CT_LARGE_PIDS, packed, dfc->ctLargePids,
+                    entry->pidOffset, entry->pidCount);
+    }
+  }
+
+  finishPacking(dfc, TABLE_CT_LARGE_PIDS, packed, dfc->ctLargePids);
+  markChanged(dfc, TABLE_CT_LARGE_ENTRIES, 0,
+              dfc->updates->used[TABLE_CT_LARGE_ENTRIES]);
+}
+
+static void packLargeCtEntries(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_CT_LARGE_ENTRIES);
+  dfc->updates->used[TABLE_CT_LARGE_ENTRIES] = 0;
+
+  int bucketCount = 1 << dfc->sizes.ctLargeBits;
+  for (int i = 0; i < bucketCount; ++i) {
+    CompactTableLargeBucket *bucket = dfc->ctLargeBuckets + i;
+    bucket->entryOffset =
+        packRange(dfc, TABLE_CT_LARGE_ENTRIES, packed, dfc->ctLargeEntries,
+                  bucket->entryOffset, bucket->entryCount);
+  }
+
+  finishPacking(dfc, TABLE_CT_LARGE_ENTRIES, packed, dfc->ctLargeEntries);
+  markChanged(dfc, TABLE_CT_LARGE_BUCKETS, 0, bucketCount);
+}
+
+static void packLongCtPids(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_CT_LONG_PIDS);
+  dfc->updates->used[TABLE_CT_LONG_PIDS] = 0;
+
+  int bucketCount = 1 << dfc->sizes.ctLongBits;
+  for (int i = 0; i < bucketCount; ++i) {
+    CompactTableLongBucket *bucket = dfc->ctLongBuckets + i;
+    for (uint32_t j = 0; j < bucket->entryCount; ++j) {
+      CompactTableLongEntry *entry =
+          dfc->ctLongEntries + bucket->entryOffset + j;
+      entry->pidOffset =
+          packRange(dfc, TABLE_CT_LONG_PIDS, packed, dfc->ctLongPids,
+                    entry->pidOffset, entry->pidCount);
+    }
+  }
+
+  finishPacking(dfc, TABLE_CT_LONG_PIDS, packed, dfc->ctLongPids);
+  markChanged(dfc, TABLE_CT_LONG_ENTRIES, 0,
+              dfc->updates->used[TABLE_CT_LONG_ENTRIES]);
+}
+
+static void packLongCtEntries(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_CT_LONG_ENTRIES);
+  dfc->updates->used[TABLE_CT_LONG_ENTRIES] = 0;
+
+  int bucketCount = 1 << dfc->sizes.ctLongBits;
+  for (int i = 0; i < bucketCount; ++i) {
+    CompactTableLongBucket *bucket = dfc->ctLongBuckets + i;
+    bucket->entryOffset =
+        packRange(dfc, TABLE_CT_LONG_ENTRIES, packed, dfc->ctLongEntries,
+                  bucket->entryOffset, bucket->entryCount);
+  }
+
+  finishPacking(dfc, TABLE_CT_LONG_ENTRIES, packed, dfc->ctLongEntries);
+  markChanged(dfc, TABLE_CT_LONG_BUCKETS, 0, bucketCount);
+}
+
+static void packPatternBytes(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_PATTERN_BYTES);
+  dfc->updates->used[TABLE_PATTERN_BYTES] = 0;
+
+  for (int pid = 0; pid < dfc->patterns->numPatterns; ++pid) {
+    DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+    if (pattern->external_id_count) {
+      pattern->pattern_offset = packRange(
+          dfc, TABLE_PATTERN_BYTES, packed, dfc->patterns->patternBytes,
+          pattern->pattern_offset, 3 * pattern->pattern_length);
+    }
+  }
+
+  finishPacking(dfc, TABLE_PATTERN_BYTES, packed, dfc->patterns->patternBytes);
+  markChanged(dfc, TABLE_PATTERNS, 0, dfc->patterns->numPatterns);
+}
+
+static void packExternalIds(DFC_STRUCTURE *dfc) {
+  uint8_t *packed = startPacking(dfc, TABLE_EXTERNAL_IDS);
+  dfc->updates->used[TABLE_EXTERNAL_IDS] = 0;
+
+  for (int pid = 0; pid < dfc->patterns->numPatterns; ++pid) {
+    DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+    if (pattern->external_id_count) {
+      pattern->external_id_offset = packRange(
+          dfc, TABLE_EXTERNAL_IDS, packed, dfc->patterns->externalIds,
+          pattern->external_id_offset, pattern->external_id_count);
+    }
+  }
+
+  finishPacking(dfc, TABLE_EXTERNAL_IDS, packed, dfc->patterns->externalIds);
+  markChanged(dfc, TABLE_PATTERNS, 0, dfc->patterns->numPatterns);
+}
+
+static const char *TABLE_NAMES[TABLE_COUNT] = {
+    "small DF",       "large DF",         "large hash DF",
+    "long hash DF",   "small CT",         "small CT pids",
+    "large CT",       "large CT entries", "large CT pids",
+    "long CT",        "long CT entries",  "long CT pids",
+    "patterns",       "pattern bytes",    "external ids"};
+
+// count items at the end of the used ones, packs the table if they do not fit
+static int takeRange(DFC_STRUCTURE *dfc, int table, int count,
+                     void (*pack)(DFC_STRUCTURE *)) {
+  DfcUpdates *updates = dfc->updates;
+
+  if (updates->used[table] + count > updates->capacity[table]) {
+    pack(dfc);
+  }
+  if (updates->used[table] + count > updates->capacity[table]) {
+    exitWithoutRoom(TABLE_NAMES[table]);
+  }
+
+  int offset = updates->used[table];
+  updates->used[table] += count;
+
+  return offset;
+}
+
+// makes room for one more item after the count items at offset, moving them
+// to the end of the used ones unless they are there already
+static void growRange(DFC_STRUCTURE *dfc, int table, void *items,
+                      uint32_t *offset, int count,
+                      void (*pack)(DFC_STRUCTURE *)) {
+  DfcUpdates *updates = dfc->updates;
+  if ((int)*offset + count == updates->used[table] &&
+      updates->used[table] < updates->capacity[table]) {
+    ++updates->used[table];
+    return;
+  }
+
+  // packing moves the range as well
+  int moved = takeRange(dfc, table, count + 1, pack);
+
+  size_t itemSize = TABLE_ITEM_SIZES[table];
+  memmove((uint8_t *)items + moved * itemSize,
+          (uint8_t *)items + *offset * itemSize, count * itemSize);
+  *offset = moved;
+}
+
+uint32_t takePatternBytes(DFC_STRUCTURE *dfc, int count) {
+  return takeRange(dfc, TABLE_PATTERN_BYTES, count, packPatternBytes);
+}
+
+uint32_t takeExternalIds(DFC_STRUCTURE *dfc, int count) {
+  return takeRange(dfc, TABLE_EXTERNAL_IDS, count, packExternalIds);
+}
+
+void addExternalId(DFC_STRUCTURE *dfc, PID_TYPE pid, PID_TYPE externalId) {
+  DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+  PID_TYPE *ids = DFC_GetExternalIdsOf(dfc, pattern);
+  for (int i = 0; i < pattern->external_id_count; ++i) {
+    if (ids[i] == externalId) {
+      return;
+    }
+  }
+
+  if (pattern->external_id_count == MAX_EQUAL_PATTERNS) {
+    fprintf(stderr,
+            "Too many patterns that are equal, but with different ID. Please "
+            "either manually cull duplicates or increase MAX_EQUAL_PATTERNS. "
+            "(Currently %d)\n",
+            MAX_EQUAL_PATTERNS);
+    exit(TOO_MANY_EQUAL_PATTERNS_EXIT_CODE);
+  }
+
+  // the ids are moved by packing
+  uint32_t offset = takeExternalIds(dfc, pattern->external_id_count + 1);
+  PID_TYPE *externalIds = dfc->patterns->externalIds;
+
+  memmove(externalIds + offset, externalIds + pattern->external_id_offset,
+          pattern->external_id_count * sizeof(PID_TYPE));
+  externalIds[offset + pattern->external_id_count] = externalId;
+
+  pattern->external_id_offset = offset;
+  ++pattern->external_id_count;
+  markChanged(dfc, TABLE_PATTERNS, pid, 1);
+}
+
+// removes every occurrence of pid, returns the amount of pids left
+static int removePid(PID_TYPE *pids, int count, PID_TYPE pid) {
+  int kept = 0;
+  for (int i = 0; i < count; ++i) {
+    if (pids[i] != pid) {
+      pids[kept++] = pids[i];
+    }
+  }
+
+  return kept;
+}
+
+bool removeExternalId(DFC_STRUCTURE *dfc, PID_TYPE pid, PID_TYPE externalId) {
+  DFC_FIXED_PATTERN *pattern = DFC_GetPatternOf(dfc, pid);
+  int count = removePid(DFC_GetExternalIdsOf(dfc, pattern),
+                        pattern->external_id_count, externalId);
+  if (count == pattern->external_id_count) {
+    return false;
+  }
+
+  pattern->external_id_count = count;
+  markChanged(dfc, TABLE_PATTERNS, pid, 1);
+
+  return true;
+}
+
+void addToSmallCompactTable(DFC_STRUCTURE *dfc, uint8_t key, PID_TYPE pid) {
+  CompactTableSmallEntry *entry = dfc->ctSmallEntries + key;
+  growRange(dfc, TABLE_CT_SMALL_PIDS, dfc->ctSmallPids, &entry->offset,
+            entry->pidCount, packSmallCtPids);
+
+  entry->pattern = key;
+  dfc->ctSmallPids[entry->offset + entry->pidCount] = pid;
+  ++entry->pidCount;
+
+  markChanged(dfc, TABLE_CT_SMALL_PIDS, entry->offset, entry->pidCount);
+  markChanged(dfc, TABLE_CT_SMALL_ENTRIES, key, 1);
+}
+
+void removeFromSmallCompactTable(DFC_STRUCTURE *dfc, uint8_t key,
+                                 PID_TYPE pid) {
+  CompactTableSmallEntry *entry = dfc->ctSmallEntries + key;
+  entry->pidCount =
+      removePid(dfc->ctSmallPids + entry->offset, entry->pidCount, pid);
+
+  markChanged(dfc, TABLE_CT_SMALL_PIDS, entry->offset, entry->pidCount);
+  markChanged(dfc, TABLE_CT_SMALL_ENTRIES, key, 1);
+}
+
+static uint32_t largeCtHash(DFC_STRUCTURE *dfc, uint32_t key,
+                            uint32_t multiplier) {
+  return hashForLargeCompactTable(key, multiplier, dfc->sizes.ctLargeHashShift,
+                                  dfc->sizes.ctLargeBits);
+}
+
+static CompactTableLargeEntry *findLargeEntry(DFC_STRUCTURE *dfc,
+                                              uint32_t key) {
+  if (CUCKOO_LARGE_CT) {
+    uint32_t slots[] = {
+        largeCtHash(dfc, key, dfc->sizes.ctLargeHashMultiplier),
+        largeCtHash(dfc, key, dfc->sizes.ctLargeCuckooMultiplier)};
+
+    for (int i = 0; i < 2; ++i) {
+      CompactTableLargeEntry *slot = dfc->ctLargeEntries + slots[i];
+      if (slot->pidCount && slot->pattern == key) {
+        return slot;
+      }
+    }
+
+    return NULL;
+  }
+
+  CompactTableLargeBucket *bucket =
+      dfc->ctLargeBuckets +
+      largeCtHash(dfc, key, dfc->sizes.ctLargeHashMultiplier);
+  for (uint32_t i = 0; i < bucket->entryCount; ++i) {
+    CompactTableLargeEntry *entry =
+        dfc->ctLargeEntries + bucket->entryOffset + i;
+    if (entry->pattern == key) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+// moves the entries in the way to their other slot, like the compilation
+static void placeLargeCuckooEntry(DFC_STRUCTURE *dfc,
+                                  CompactTableLargeEntry entry) {
+  CompactTableLargeEntry *slots = dfc->ctLargeEntries;
+  uint32_t first = largeCtHash(dfc, entry.pattern,
+                               dfc->sizes.ctLargeHashMultiplier);
+  uint32_t second = largeCtHash(dfc, entry.pattern,
+                                dfc->sizes.ctLargeCuckooMultiplier);
+  uint32_t slot = slots[first].pidCount && !slots[second].pidCount ? second
+                                                                    : first;
+
+  for (int kick = 0; entry.pidCount; ++kick) {
+    if (kick == CUCKOO_MAX_KICKS) {
+      fprintf(stderr,
+              "Could not place the added large CT entry in %d cuckoo slots, "
+              "please compile the patterns again\n",
+              1 << dfc->sizes.ctLargeBits);
+      exit(TOO_MANY_ENTRIES_IN_LARGE_CT_EXIT_CODE);
+    }
+
+    CompactTableLargeEntry evicted = slots[slot];
+    slots[slot] = entry;
+    markChanged(dfc, TABLE_CT_LARGE_ENTRIES, slot, 1);
+    entry = evicted;
+
+    if (entry.pidCount) {
+      first = largeCtHash(dfc, entry.pattern,
+                          dfc->sizes.ctLargeHashMultiplier);
+      slot = slot != first ? first
+                           : largeCtHash(dfc, entry.pattern,
+                                         dfc->sizes.ctLargeCuckooMultiplier);
+    }
+  }
+}
+
+static void addLargeEntry(DFC_STRUCTURE *dfc, uint32_t key, PID_TYPE pid) {
+  // the entry has its pid before it is placed, as empty slots have none
+  CompactTableLargeEntry entry = {
+      .pattern = key,
+      .pidCount = 1,
+      .pidOffset = takeRange(dfc, TABLE_CT_LARGE_PIDS, 1, packLargeCtPids)};
+  dfc->ctLargePids[entry.pidOffset] = pid;
+  markChanged(dfc, TABLE_CT_LARGE_PIDS, entry.pidOffset, 1);
+
+  if (CUCKOO_LARGE_CT) {
+    placeLargeCuckooEntry(dfc, entry);
+    return;
+  }
+
+  uint32_t hash = largeCtHash(dfc, key, dfc->sizes.ctLargeHashMultiplier);
+  CompactTableLargeBucket *bucket = dfc->ctLargeBuckets + hash;
+  growRange(dfc, TABLE_CT_LARGE_ENTRIES, dfc->ctLargeEntries,
+            &bucket->entryOffset, bucket->entryCount, packLargeCtEntries);
+
+  dfc->ctLargeEntries[bucket->entryOffset + bucket->entryCount] = entry;
+  ++bucket->entryCount;
+
+  markChanged(dfc, TABLE_CT_LARGE_ENTRIES, bucket->entryOffset,
+              bucket->entryCount);
+  markChanged(dfc, TABLE_CT_LARGE_BUCKETS, hash, 1);
+}
+
+void addToLargeCompactTable(DFC_STRUCTURE *dfc, uint32_t key, PID_TYPE pid) {
+  CompactTableLargeEntry *entry = findLargeEntry(dfc, key);
+  if (!entry) {
+    addLargeEntry(dfc, key, pid);
+    return;
+  }
+
+  for (uint32_t i = 0; i < entry->pidCount; ++i) {
+    if (dfc->ctLargePids[entry->pidOffset + i] == pid) {
+      return;
+    }
+  }
+
+  growRange(dfc, TABLE_CT_LARGE_PIDS, dfc->ctLargePids, &entry->pidOffset,
+            entry->pidCount, packLargeCtPids);
+  dfc->ctLargePids[entry->pidOffset + entry->pidCount] = pid;
+  ++entry->pidCount;
+
+  markChanged(dfc, TABLE_CT_LARGE_PIDS, entry->pidOffset, entry->pidCount);
+  markChanged(dfc, TABLE_CT_LARGE_ENTRIES, entry - dfc->ctLargeEntries, 1);
+}
+
+void removeFromLargeCompactTable(DFC_STRUCTURE *dfc, uint32_t key,
+                                 PID_TYPE pid) {
+  CompactTableLargeEntry *entry = findLargeEntry(dfc, key);
+  if (!entry) {
+    return;
+  }
+
+  entry->pidCount =
+      removePid(dfc->ctLargePids + entry->pidOffset, entry->pidCount, pid);
+  markChanged(dfc, TABLE_CT_LARGE_PIDS, entry->pidOffset, entry->pidCount);
+  markChanged(dfc, TABLE_CT_LARGE_ENTRIES, entry - dfc->ctLargeEntries, 1);
+
+  // a cuckoo slot without pids is empty
+  if (entry->pidCount || CUCKOO_LARGE_CT) {
+    return;
+  }
+
+  uint32_t hash = largeCtHash(dfc, key, dfc->sizes.ctLargeHashMultiplier);
+  CompactTableLargeBucket *bucket = dfc->ctLargeBuckets + hash;
+  CompactTableLargeEntry *last =
+      dfc->ctLargeEntries + bucket->entryOffset + bucket->entryCount - 1;
+
+  memmove(entry, entry + 1, (last - entry) * sizeof(CompactTableLargeEntry));
+  --bucket->entryCount;
+
+  markChanged(dfc, TABLE_CT_LARGE_ENTRIES, bucket->entryOffset,
+              bucket->entryCount);
+  markChanged(dfc, TABLE_CT_LARGE_BUCKETS, hash, 1);
+}
+
+static CompactTableLongBucket *longBucket(DFC_STRUCTURE *dfc, uint64_t key) {
+  return dfc->ctLongBuckets +
+         hashForLongCompactTable(key, dfc->sizes.ctLongBits);
+}
+
+static CompactTableLongEntry *findLongEntry(DFC_STRUCTURE *dfc,
+                                            uint64_t key) {
+  CompactTableLongBucket *bucket = longBucket(dfc, key);
+  for (uint32_t i = 0; i < bucket->entryCount; ++i) {
+    CompactTableLongEntry *entry = dfc->ctLongEntries + bucket->entryOffset + i;
+    if (entry->pattern == key) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+void addToLongCompactTable(DFC_STRUCTURE *dfc, uint64_t key, PID_TYPE pid) {
+  CompactTableLongEntry *entry = findLongEntry(dfc, key);
+
+  if (!entry) {
+    CompactTableLongBucket *bucket = longBucket(dfc, key);
+    growRange(dfc, TABLE_CT_LONG_ENTRIES, dfc->ctLongEntries,
+              &bucket->entryOffset, bucket->entryCount, packLongCtEntries);
+
+    entry = dfc->ctLongEntries + bucket->entryOffset + bucket->entryCount;
+    entry->pattern = key;
+    entry->pidCount = 0;
+    entry->pidOffset = dfc->updates->used[TABLE_CT_LONG_PIDS];
+    ++bucket->entryCount;
+
+    markChanged(dfc, TABLE_CT_LONG_ENTRIES, bucket->entryOffset,
+                bucket->entryCount);
+    markChanged(dfc, TABLE_CT_LONG_BUCKETS, bucket - dfc->ctLongBuckets, 1);
+  }
+
+  growRange(dfc, TABLE_CT_LONG_PIDS, dfc->ctLongPids, &entry->pidOffset,
+            entry->pidCount, packLongCtPids);
+  dfc->ctLongPids[entry->pidOffset + entry->pidCount] = pid;
+  ++entry->pidCount;
+
+  markChanged(dfc, TABLE_CT_LONG_PIDS, entry->pidOffset, entry->pidCount);
+  markChanged(dfc, TABLE_CT_LONG_ENTRIES, entry - dfc->ctLongEntries, 1);
+}
+
+void removeFromLongCompactTable(DFC_STRUCTURE *dfc, uint64_t key,
+                                PID_TYPE pid) {
+  CompactTableLongEntry *entry = findLongEntry(dfc, key);
+  if (!entry) {
+    return;
+  }
+
+  entry->pidCount =
+      removePid(dfc->ctLongPids + entry->pidOffset, entry->pidCount, pid);
+  markChanged(dfc, TABLE_CT_LONG_PIDS, entry->pidOffset, entry->pidCount);
+  markChanged(dfc, TABLE_CT_LONG_ENTRIES, entry - dfc->ctLongEntries, 1);
+
+  if (entry->pidCount) {
+    return;
+  }
+
+  CompactTableLongBucket *bucket = longBucket(dfc, key);
+  CompactTableLongEntry *last =
+      dfc->ctLongEntries + bucket->entryOffset + bucket->entryCount - 1;
+
+  memmove(entry, entry + 1, (last - entry) * sizeof(CompactTableLongEntry));
+  --bucket->entryCount;
+
+  markChanged(dfc, TABLE_CT_LONG_ENTRIES, bucket->entryOffset,
+              bucket->entryCount);
+  markChanged(dfc, TABLE_CT_LONG_BUCKETS, bucket - dfc->ctLongBuckets, 1);
+}
+
+void uploadUpdates(DFC_STRUCTURE *dfc) {
+  DfcUpdates *updates = dfc->updates;
+
+  // the compact tables and patterns of the heterogeneous design stay on the
+  // host
+  int tableCount =
+      HETEROGENEOUS_DESIGN ? DIRECT_FILTER_COUNT : TABLE_EXTERNAL_IDS;
+  bool isOnDevice = shouldUseOpenCl() && dfc == DFC_HOST_MEMORY.dfcStructure;
+
+  void *hosts[] = {dfc->directFilterSmall,      dfc->directFilterLarge,
+                   dfc->directFilterLargeHash,  dfc->directFilterLongHash,
+                   dfc->ctSmallEntries,         dfc->ctSmallPids,
+                   dfc->ctLargeBuckets,         dfc->ctLargeEntries,
+                   dfc->ctLargePids,            dfc->ctLongBuckets,
+                   dfc->ctLongEntries,          dfc->ctLongPids,
+                   dfc->patterns->dfcMatchList, dfc->patterns->patternBytes};
+  DfcOpenClBuffers *buffers = &DFC_OPENCL_BUFFERS;
+  cl_mem deviceBuffers[] = {
+      buffers->dfSmall,        buffers->dfLarge,        buffers->dfLargeHash,
+      buffers->dfLongHash,     buffers->ctSmallEntries, buffers->ctSmallPids,
+      buffers->ctLargeBuckets, buffers->ctLargeEntries, buffers->ctLargePids,
+      buffers->ctLongBuckets,  buffers->ctLongEntries,  buffers->ctLongPids,
+      buffers->patterns,       buffers->patternBytes};
+
+  for (int i = 0; i < TABLE_COUNT; ++i) {
+    size_t start = updates->changedStart[i];
+    size_t end = updates->changedEnd[i];
+
+    if (isOnDevice && i < tableCount && start < end) {
+      if (USE_TEXTURE_MEMORY && i <= TABLE_DF_LARGE) {
+        writeOpenClTextureBuffer(DFC_OPENCL_ENVIRONMENT.queue, hosts[i],
+                                 deviceBuffers[i], DF_SIZE_REAL);
+      } else {
+        writeOpenClBufferRange(DFC_OPENCL_ENVIRONMENT.queue, hosts[i],
+                               deviceBuffers[i], start, end - start);
+      }
+    }
+
+    updates->changedStart[i] = 0;
+    updates->changedEnd[i] = 0;
+  }
+}
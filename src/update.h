@@ -0,0 +1,150 @@
+#ifndef DFC_UPDATE_H
+#define DFC_UPDATE_H
+
+#include "dfc.h"
+#include "memory.h"
+
+// moves tried before the cuckoo variant of the large compact table gives up
+// on a pair of hashes
+#define CUCKOO_MAX_KICKS 500
+
+/*
+ * The tables of a structure changed by DFC_AddPatternTo and
+ * DFC_RemovePatternFrom, in the order of their OpenCL buffers. The direct
+ * filters come first, their index is the filter of FilterBits.
+ */
+enum {
+  TABLE_DF_SMALL,
+  TABLE_DF_LARGE,
+  TABLE_DF_LARGE_HASH,
+  TABLE_DF_LONG_HASH,
+  TABLE_CT_SMALL_ENTRIES,
+  TABLE_CT_SMALL_PIDS,
+  TABLE_CT_LARGE_BUCKETS,
+  TABLE_CT_LARGE_ENTRIES,
+  TABLE_CT_LARGE_PIDS,
+  TABLE_CT_LONG_BUCKETS,
+  TABLE_CT_LONG_ENTRIES,
+  TABLE_CT_LONG_PIDS,
+  TABLE_PATTERNS,
+  TABLE_PATTERN_BYTES,
+  TABLE_EXTERNAL_IDS,  // only on the host
+  TABLE_COUNT
+};
+
+#define DIRECT_FILTER_COUNT (TABLE_DF_LONG_HASH + 1)
+
+// a 1 byte pattern sets a bit for every byte that may follow it
+#define MAX_FILTER_BITS_PER_PATTERN 256
+
+// the distinct bits a pattern sets in one of the direct filters
+typedef struct {
+  int filter;  // TABLE_DF_*
+  int bitCount;
+  uint32_t bits[MAX_FILTER_BITS_PER_PATTERN];
+} FilterBits;
+
+/*
+ * The compact tables, pids and patterns are allocated with room to spare,
+ * items are taken from the end of what is used. A range that grows is moved
+ * there unless it is the last one already, and the ranges are packed again
+ * once there is no room left. The direct filters count the patterns setting
+ * each of their bits, so that a bit is cleared with the last of them.
+ */
+typedef struct DfcUpdates_ {
+  // items of each table taken so far, out of its capacity
+  int used[TABLE_COUNT];
+  int capacity[TABLE_COUNT];
+
+  // bytes of each table changed since they were last uploaded, none if the
+  // start is not before the end
+  size_t changedStart[TABLE_COUNT];
+  size_t changedEnd[TABLE_COUNT];
+
+  // the rest is set up by the first update, see startUpdates
+  // patterns setting each filter bit, a bit may be shared by all of them
+  uint32_t *referenceCounts[DIRECT_FILTER_COUNT];
+
+  // pids of the patterns by their bytes
+  int32_t *indexHeads;
+  int32_t *indexNext;
+
+  // of removed patterns, taken again by the next ones added
+  PID_TYPE *freePids;
+  int freePidCount;
+
+  // byte pair frequencies of the patterns, only with RAREST_FRAGMENT
+  uint32_t *pairFrequencies;
+} DfcUpdates;
+
+static inline uint8_t *directFilterOf(DFC_STRUCTURE *dfc, int filter) {
+  switch (filter) {
+    case TABLE_DF_SMALL:
+      return dfc->directFilterSmall;
+    case TABLE_DF_LARGE:
+      return dfc->directFilterLarge;
+    case TABLE_DF_LARGE_HASH:
+      return dfc->directFilterLargeHash;
+    default:
+      return dfc->directFilterLongHash;
+  }
+}
+
+static inline size_t directFilterBitCount(DFC_STRUCTURE *dfc, int filter) {
+  switch (filter) {
+    case TABLE_DF_LARGE_HASH:
+      return (size_t)1 << dfc->sizes.dfLargeHashBits;
+    case TABLE_DF_LONG_HASH:
+      return (size_t)1 << dfc->sizes.dfLongHashBits;
+    default:
+      return DF_SIZE;
+  }
+}
+
+// capacity is what the structure was allocated with, of which used was taken
+// by the compiled patterns
+DfcUpdates *createUpdates(DfcMemoryRequirements capacity,
+                          DfcMemoryRequirements used);
+void freeUpdates(DfcUpdates *updates);
+// the requirements with the counts of either updates->capacity or ->used
+DfcMemoryRequirements requirementsOfTables(DFC_STRUCTURE *dfc,
+                                           const int *counts);
+
+bool hasStartedUpdates(DFC_STRUCTURE *dfc);
+void startUpdates(DFC_STRUCTURE *dfc);
+
+// counts bits that are set already, while the updates are started
+void countFilterBits(DFC_STRUCTURE *dfc, FilterBits *bits);
+// sets or clears the bits as their count changes by delta
+void referenceFilterBits(DFC_STRUCTURE *dfc, FilterBits *bits, int delta);
+
+// the pid of the pattern with these bytes, -1 if there is none
+int findPattern(DFC_STRUCTURE *dfc, const uint8_t *pattern, int length);
+void indexPattern(DFC_STRUCTURE *dfc, PID_TYPE pid);
+void unindexPattern(DFC_STRUCTURE *dfc, PID_TYPE pid);
+
+PID_TYPE takePid(DFC_STRUCTURE *dfc);
+void releasePid(DFC_STRUCTURE *dfc, PID_TYPE pid);
+uint32_t takePatternBytes(DFC_STRUCTURE *dfc, int count);
+uint32_t takeExternalIds(DFC_STRUCTURE *dfc, int count);
+void markPatternChanged(DFC_STRUCTURE *dfc, PID_TYPE pid);
+
+void addExternalId(DFC_STRUCTURE *dfc, PID_TYPE pid, PID_TYPE externalId);
+// false if the pattern does not have the id
+bool removeExternalId(DFC_STRUCTURE *dfc, PID_TYPE pid, PID_TYPE externalId);
+
+void addToSmallCompactTable(DFC_STRUCTURE *dfc, uint8_t key, PID_TYPE pid);
+void removeFromSmallCompactTable(DFC_STRUCTURE *dfc, uint8_t key,
+                                 PID_TYPE pid);
+void addToLargeCompactTable(DFC_STRUCTURE *dfc, uint32_t key, PID_TYPE pid);
+void removeFromLargeCompactTable(DFC_STRUCTURE *dfc, uint32_t key,
+                                 PID_TYPE pid);
+void addToLongCompactTable(DFC_STRUCTURE *dfc, uint64_t key, PID_TYPE pid);
+void removeFromLongCompactTable(DFC_STRUCTURE *dfc, uint64_t key,
+                                PID_TYPE pid);
+
+// writes the changed ranges to the OpenCL buffers, if they belong to the
+// structure
+void uploadUpdates(DFC_STRUCTURE *dfc);
+
+#endif
@@ -1,11 +1,18 @@
 #include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <random>
 #include <set>
 #include <thread>
 
 #include "catch.hpp"
 
 #include "dfc.h"
+#include "ring.h"
+#include "shared-functions.h"
 #include "timer.h"
 
 void addCaseSensitivePattern(DFC_PATTERN_INIT* patternInit,
@@ -24,6 +31,29 @@ struct Pattern {
   std::string pattern;
 };
 
+// distinct lowercase patterns of 1 to 24 bytes over a few letters, so that
+// many of them overlap, a third of them are case insensitive
+struct GeneratedPattern {
+  std::string pattern;
+  bool isCaseInsensitive;
+};
+std::vector<GeneratedPattern> generatePatterns(int count, unsigned seed) {
+  std::mt19937 random(seed);
+  std::set<std::string> generated;
+  std::vector<GeneratedPattern> patterns;
+  for (int i = 0; i < count; ++i) {
+    std::string pattern;
+    for (int j = 0, length = 1 + random() % 24; j < length; ++j) {
+      pattern += 'a' + random() % 8;
+    }
+
+    if (generated.insert(pattern).second) {
+      patterns.push_back(GeneratedPattern{pattern, random() % 3 == 0});
+    }
+  }
+  return patterns;
+}
+
 std::string input;
 int readCount = 0;
 int readInput(int maxLength, int maxPatternLength, char* inputBuffer) {
@@ -52,14 +82,50 @@ int readInputTwice(int maxLength, int maxPatternLength, char* inputBuffer) {
   return input.size();
 }
 
+std::vector<std::string> inputChunks;
+int readInputChunks(int maxLength, int maxPatternLength, char* inputBuffer) {
+  if (readCount == (int)inputChunks.size()) {
+    return 0;
+  }
+
+  const std::string& chunk = inputChunks[readCount++];
+  REQUIRE(maxPatternLength == MAX_PATTERN_LENGTH);
+  REQUIRE(maxLength >= (int)chunk.size());
+  memcpy(inputBuffer, chunk.data(), chunk.size());
+
+  return chunk.size();
+}
+
+struct BatchedMatches {
+  std::vector<int> batchSizes;
+  std::vector<std::pair<uint64_t, std::string>> matches;
+};
+void onMatches(DFC_MATCH* matches, int matchCount, void* userData) {
+  auto batched = (BatchedMatches*)userData;
+  batched->batchSizes.emplace_back(matchCount);
+  for (int i = 0; i < matchCount; ++i) {
+    DFC_FIXED_PATTERN* pattern = DFC_GetPattern(matches[i].pid);
+    batched->matches.emplace_back(
+        matches[i].offset,
+        std::string((const char*)DFC_GetPatternBytes(pattern),
+                    pattern->pattern_length));
+  }
+}
+
+void onMatchOffsets(DFC_MATCH* matches, int matchCount, void* userData) {
+  auto offsets = (std::vector<uint64_t>*)userData;
+  for (int i = 0; i < matchCount; ++i) {
+    offsets->emplace_back(matches[i].offset);
+  }
+}
+
 std::vector<Pattern> matches;
 void onMatch(DFC_FIXED_PATTERN* pattern) {
-  std::vector<PID_TYPE> ids;
-  for (int i = 0; i < pattern->external_id_count; ++i) {
-    ids.emplace_back(pattern->external_ids[i]);
-  }
+  PID_TYPE* externalIds = DFC_GetExternalIds(pattern);
+  std::vector<PID_TYPE> ids(externalIds,
+                            externalIds + pattern->external_id_count);
   matches.emplace_back(Pattern{
-      std::move(ids), std::string((const char*)pattern->original_pattern,
+      std::move(ids), std::string((const char*)DFC_GetPatternBytes(pattern),
                                   pattern->pattern_length)});
 }
 
@@ -499,6 +565,27 @@ TEST_CASE("DFC") {
     REQUIRE(matchCount == 2);
   }
 
+  SECTION("Long patterns with equal first 4 characters all get matched") {
+    input = "get /index.html GET /login.php";
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseInSensitivePattern(patternInit, "GET /index", 0);
+    addCaseSensitivePattern(patternInit, "GET /login.php", 1);
+    addCaseSensitivePattern(patternInit, "GET /logout", 2);
+    addCaseSensitivePattern(patternInit, "get /login", 3);
+    addCaseSensitivePattern(patternInit, "GET /", 4);
+
+    DFC_Compile(patternInit);
+
+    auto matchCount = DFC_Search(readInput, onMatch);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    // "GET /index", "GET /login.php" and "GET /"
+    REQUIRE(matchCount == 3);
+  }
+
   SECTION("Calls onMatch on match") {
     PID_TYPE pid = 0;
     input = "attack";
@@ -664,6 +751,311 @@ TEST_CASE("DFC") {
     REQUIRE(matches[0].pattern[1] == 0x00);
   }
 
+  SECTION("Verifies patterns of every length") {
+    // no character occurs twice, even when ignoring case
+    std::string alphabet =
+        "AbCdEfGhIjKlMnOpQrStUvWxYz0123456789@[`{!\"$%&'()*+,-./:;<=>?]^_|}~";
+    input = alphabet + alphabet;
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    for (int length = 4; length <= MAX_PATTERN_LENGTH; ++length) {
+      std::string pattern = input.substr(1, length);
+      addCaseSensitivePattern(patternInit, pattern, length);
+
+      // differs in the last character only
+      pattern[length - 1] = '#';
+      addCaseSensitivePattern(patternInit, pattern, 1000 + length);
+
+      std::string lowerCase = input.substr(2, length);
+      for (auto& c : lowerCase) {
+        c = tolower(c);
+      }
+      addCaseInSensitivePattern(patternInit, lowerCase, 2000 + length);
+    }
+
+    DFC_Compile(patternInit);
+
+    auto matchCount = DFC_Search(readInput, onMatch);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    // all but the altered patterns match in both copies of the alphabet
+    int lengths = MAX_PATTERN_LENGTH - 4 + 1;
+    REQUIRE(matchCount == 2 * 2 * lengths);
+  }
+
+  SECTION("Matches across positions of input longer than a filter block") {
+    PID_TYPE pid = 0;
+    input = std::string(29, 'x') + "attack" + std::string(30, 'y') + "attack" +
+            std::string(40, 'z');
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "attack", pid);
+    addCaseSensitivePattern(patternInit, "at", pid + 1);
+    addCaseSensitivePattern(patternInit, "z", pid + 2);
+
+    DFC_Compile(patternInit);
+
+    auto matchCount = DFC_Search(readInput, onMatch);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 44);
+    REQUIRE(matches.size() == 44);
+  }
+
+  SECTION("Matches patterns straddling the boundaries of filter blocks") {
+    // a small, a large and a long pattern across the 64 position blocks
+    input = std::string(300, '.');
+    input.replace(63, 2, "ab");
+    input.replace(125, 6, "attack");
+    input.replace(186, 12, "long pattern");
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "ab", 0);
+    addCaseSensitivePattern(patternInit, "attack", 1);
+    addCaseSensitivePattern(patternInit, "long pattern", 2);
+
+    DFC_Compile(patternInit);
+
+    DFC_MATCH buffer[4];
+    BatchedMatches batched;
+    auto matchCount =
+        DFC_SearchBatched(readInput, buffer, 4, onMatches, &batched);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 3);
+    std::vector<std::pair<uint64_t, std::string>> expected{
+        {63, "ab"}, {125, "attack"}, {186, "long pattern"}};
+    REQUIRE(batched.matches == expected);
+  }
+
+  SECTION("Matches at every position of input full of candidates") {
+    // more candidates than a phase of the two phase search collects
+    input.clear();
+    for (int i = 0; i < 5000; ++i) {
+      input += "at";
+    }
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "at", 0);
+    addCaseSensitivePattern(patternInit, "tata", 1);
+    addCaseSensitivePattern(patternInit, "atatatatat", 2);
+
+    DFC_Compile(patternInit);
+
+    DFC_MATCH buffer[64];
+    std::vector<uint64_t> offsets;
+    auto matchCount =
+        DFC_SearchBatched(readInput, buffer, 64, onMatchOffsets, &offsets);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    // "at" at the even, "tata" at the odd and "atatatatat" at the even
+    // positions that leave room for them
+    REQUIRE(matchCount == 5000 + 4998 + 4996);
+    REQUIRE(offsets.size() == 5000 + 4998 + 4996);
+    REQUIRE(std::is_sorted(offsets.begin(), offsets.end()));
+  }
+
+  SECTION("Finds every pattern of a large set of large patterns") {
+    // sets bits in most blocks of a blocked Bloom filter, none of the
+    // patterns may get lost among them
+    const int patternCount = 20000;
+    std::mt19937 random(13);
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    for (int i = 0; i < patternCount; ++i) {
+      std::string pattern;
+      for (int j = 0; j < 4 + i % 4; ++j) {
+        pattern += 'a' + random() % 26;
+      }
+
+      if (i % 4 == 0) {
+        addCaseInSensitivePattern(patternInit, pattern, i);
+        std::transform(pattern.begin(), pattern.end(), pattern.begin(),
+                       ::toupper);
+      } else {
+        addCaseSensitivePattern(patternInit, pattern, i);
+      }
+      input += pattern + " ";
+    }
+
+    DFC_Compile(patternInit);
+
+    DFC_Search(readInput, onMatch);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    std::set<PID_TYPE> found;
+    for (auto& match : matches) {
+      found.insert(match.ids.begin(), match.ids.end());
+    }
+    REQUIRE(found.size() == patternCount);
+  }
+
+  SECTION("Finds the matches of a naive search for generated patterns") {
+    std::mt19937 random(15);
+    std::vector<GeneratedPattern> patterns = generatePatterns(3000, 15);
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    for (size_t i = 0; i < patterns.size(); ++i) {
+      if (patterns[i].isCaseInsensitive) {
+        addCaseInSensitivePattern(patternInit, patterns[i].pattern, i);
+      } else {
+        addCaseSensitivePattern(patternInit, patterns[i].pattern, i);
+      }
+    }
+
+    // the patterns between random letters, some of them in upper case
+    while (input.size() < 50000) {
+      for (int j = 0, length = random() % 16; j < length; ++j) {
+        input += 'a' + random() % 8;
+      }
+
+      std::string pattern = patterns[random() % patterns.size()].pattern;
+      for (char& character : pattern) {
+        character = random() % 4 ? character : toupper(character);
+      }
+      input += pattern;
+    }
+
+    std::string loweredInput = input;
+    std::transform(input.begin(), input.end(), loweredInput.begin(),
+                   ::tolower);
+    std::vector<std::pair<uint64_t, std::string>> expected;
+    for (auto& generated : patterns) {
+      const std::string& searched =
+          generated.isCaseInsensitive ? loweredInput : input;
+      for (size_t position = searched.find(generated.pattern);
+           position != std::string::npos;
+           position = searched.find(generated.pattern, position + 1)) {
+        expected.emplace_back(position, generated.pattern);
+      }
+    }
+    std::sort(expected.begin(), expected.end());
+
+    DFC_Compile(patternInit);
+
+    DFC_MATCH buffer[64];
+    BatchedMatches batched;
+    auto matchCount =
+        DFC_SearchBatched(readInput, buffer, 64, onMatches, &batched);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    std::sort(batched.matches.begin(), batched.matches.end());
+    REQUIRE(matchCount == (int)expected.size());
+    REQUIRE(batched.matches == expected);
+  }
+
+#if CUCKOO_LARGE_CT
+  SECTION("Keeps each large fragment in one of its two cuckoo slots") {
+    std::vector<GeneratedPattern> patterns = generatePatterns(3000, 15);
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    for (size_t i = 0; i < patterns.size(); ++i) {
+      if (patterns[i].isCaseInsensitive) {
+        addCaseInSensitivePattern(patternInit, patterns[i].pattern, i);
+      } else {
+        addCaseSensitivePattern(patternInit, patterns[i].pattern, i);
+      }
+    }
+
+    DFC_STRUCTURE* dfc = DFC_Compile(patternInit);
+
+    // the search compares at most the entries of these two slots
+    DFC_TABLE_SIZES sizes = dfc->sizes;
+    int usedSlots = 0;
+    int misplacedSlots = 0;
+    for (uint32_t slot = 0; slot < 1u << sizes.ctLargeBits; ++slot) {
+      CompactTableLargeEntry* entry = dfc->ctLargeEntries + slot;
+      if (!entry->pidCount) {
+        continue;
+      }
+
+      ++usedSlots;
+      if (hashForLargeCompactTable(entry->pattern, sizes.ctLargeHashMultiplier,
+                                   sizes.ctLargeHashShift,
+                                   sizes.ctLargeBits) != slot &&
+          hashForLargeCompactTable(entry->pattern,
+                                   sizes.ctLargeCuckooMultiplier,
+                                   sizes.ctLargeHashShift,
+                                   sizes.ctLargeBits) != slot) {
+        ++misplacedSlots;
+      }
+    }
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(sizes.ctLargeHashMultiplier != sizes.ctLargeCuckooMultiplier);
+    REQUIRE(usedSlots > 1000);
+    REQUIRE(misplacedSlots == 0);
+  }
+
+  SECTION("Exits if the large fragments outnumber the cuckoo slots") {
+    pid_t child = fork();
+    if (!child) {
+      freopen("/dev/null", "w", stderr);
+
+      // the table has at most 2^COMPACT_TABLE_MAX_BITS slots
+      DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+      for (uint32_t i = 0; i <= 1u << COMPACT_TABLE_MAX_BITS; ++i) {
+        uint32_t fragment = i * 2654435761u;
+        DFC_AddPattern(patternInit, (unsigned char*)&fragment, 4, 0, i);
+      }
+
+      DFC_Compile(patternInit);
+      _exit(0);
+    }
+
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == TOO_MANY_ENTRIES_IN_LARGE_CT_EXIT_CODE);
+  }
+#endif
+
+  SECTION("Calls onMatch in input order for large inputs") {
+    const int needleCount = 64;
+    const int spacing = 4096;
+
+    input = std::string(needleCount * spacing, '.');
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    std::vector<std::string> expected;
+    for (int i = 0; i < needleCount; ++i) {
+      std::string needle = "needle" + std::to_string(i) + "!";
+      addCaseSensitivePattern(patternInit, needle, i);
+
+      // every 16th needle ends up across a multiple of 64 KiB
+      int position = (i + 1) * spacing - (i % 16 == 15 ? 3 : 100);
+      input.replace(position, needle.size(), needle);
+      expected.push_back(needle);
+    }
+
+    DFC_Compile(patternInit);
+
+    auto matchCount = DFC_Search(readInput, onMatch);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == needleCount);
+    REQUIRE(matches.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      REQUIRE(matches[i].pattern == expected[i]);
+    }
+  }
+
   SECTION("Matches if input and pattern is equal: Read twice") {
     PID_TYPE pid = 0;
     input = "attack";
@@ -684,6 +1076,542 @@ TEST_CASE("DFC") {
     REQUIRE(matches[1].pattern == "attack");
   }
 
+  SECTION("Passes matches with offsets in batches: Read twice") {
+    input = "attack at dawn";
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "attack", 0);
+    addCaseSensitivePattern(patternInit, "at", 1);
+
+    DFC_Compile(patternInit);
+
+    DFC_MATCH buffer[2];
+    BatchedMatches batched;
+    auto matchCount =
+        DFC_SearchBatched(readInputTwice, buffer, 2, onMatches, &batched);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 6);
+    REQUIRE(batched.batchSizes == std::vector<int>{2, 2, 2});
+
+    std::vector<std::pair<uint64_t, std::string>> expected{
+        {0, "at"}, {0, "attack"}, {7, "at"},
+        {14, "at"}, {14, "attack"}, {21, "at"}};
+    REQUIRE(batched.matches == expected);
+  }
+
+  SECTION("Passes matches of many chunks in input order") {
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "attack", 0);
+    addCaseSensitivePattern(patternInit, "at", 1);
+
+    DFC_Compile(patternInit);
+
+    // large chunks between small ones, chunks searched by several threads at
+    // once finish out of order
+    inputChunks.clear();
+    std::vector<std::pair<uint64_t, std::string>> expected;
+    uint64_t chunkOffset = 0;
+    for (int i = 0; i < 24; ++i) {
+      size_t size = i % 3 == 0 ? 300000 : 20 + i;
+      std::string chunk(size, '.');
+      chunk.replace(size / 2, 6, "attack");
+      chunk.replace(size - 2, 2, "at");
+      inputChunks.push_back(chunk);
+
+      expected.emplace_back(chunkOffset + size / 2, "at");
+      expected.emplace_back(chunkOffset + size / 2, "attack");
+      expected.emplace_back(chunkOffset + size - 2, "at");
+      chunkOffset += size;
+    }
+
+    DFC_MATCH buffer[4];
+    BatchedMatches batched;
+    auto matchCount =
+        DFC_SearchBatched(readInputChunks, buffer, 4, onMatches, &batched);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == (int)expected.size());
+    REQUIRE(batched.matches == expected);
+  }
+
+  SECTION("Stream finds matches crossing writes once") {
+    std::string stream = std::string(100, '.') + "attack at" +
+                         std::string(100, '.') + "attack";
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "attack", 0);
+    addCaseSensitivePattern(patternInit, "at", 1);
+
+    DFC_Compile(patternInit);
+
+    std::vector<std::pair<uint64_t, std::string>> expected{
+        {100, "at"}, {100, "attack"}, {107, "at"},
+        {209, "at"}, {209, "attack"}};
+
+    for (size_t writeSize : {1, 7, 70, 1000}) {
+      DFC_MATCH buffer[4];
+      BatchedMatches batched;
+      DFC_STREAM* dfcStream =
+          DFC_StreamOpen(buffer, 4, onMatches, &batched);
+
+      int matchCount = 0;
+      for (size_t i = 0; i < stream.size(); i += writeSize) {
+        int length = std::min(writeSize, stream.size() - i);
+        matchCount += DFC_StreamWrite(
+            dfcStream, (const unsigned char*)stream.data() + i, length);
+      }
+      matchCount += DFC_StreamClose(dfcStream);
+
+      REQUIRE(matchCount == 5);
+      REQUIRE(batched.matches == expected);
+    }
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+  }
+
+  SECTION("Finds patterns past 65535 pids of a compact table") {
+    // every case permutation of the first 4 bytes is a key of the large
+    // compact table, 16 per pattern
+    const int patternCount = 8000;
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    for (int i = 0; i < patternCount; ++i) {
+      std::string pattern = "abcd";
+      for (int value = i, j = 0; j < 4; ++j, value /= 26) {
+        pattern[j] = 'a' + value % 26;
+      }
+      addCaseInSensitivePattern(patternInit, pattern, i);
+    }
+    input = "#AAAA#baaa#FZKA#";
+
+    DFC_Compile(patternInit);
+    auto matchCount = DFC_Search(readInput, onMatch);
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 3);
+  }
+
+  SECTION("Reports patterns with a common prefix at their start") {
+    std::string stream = "xGET /aGET /index.html" + std::string(70, '.') +
+                         "get /INDEX.HTML";
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "GET /a", 0);
+    addCaseInSensitivePattern(patternInit, "GET /index.html", 1);
+
+    std::string sample = "GET / HTTP/1.1\r\nGET / HTTP/1.1\r\n";
+    DFC_AddFragmentSample(patternInit, (const unsigned char*)sample.data(),
+                          sample.size());
+
+    DFC_Compile(patternInit);
+
+    std::vector<std::pair<uint64_t, std::string>> expected{
+        {1, "GET /a"}, {7, "GET /index.html"}, {92, "GET /index.html"}};
+
+    for (size_t writeSize : {1, 9, 1000}) {
+      DFC_MATCH buffer[4];
+      BatchedMatches batched;
+      DFC_STREAM* dfcStream =
+          DFC_StreamOpen(buffer, 4, onMatches, &batched);
+
+      int matchCount = 0;
+      for (size_t i = 0; i < stream.size(); i += writeSize) {
+        int length = std::min(writeSize, stream.size() - i);
+        matchCount += DFC_StreamWrite(
+            dfcStream, (const unsigned char*)stream.data() + i, length);
+      }
+      matchCount += DFC_StreamClose(dfcStream);
+
+      REQUIRE(matchCount == 3);
+      REQUIRE(batched.matches == expected);
+    }
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+  }
+
+  SECTION("Searches several structures from several threads at once") {
+    std::string text;
+    std::vector<uint64_t> expectedAttacks;
+    std::vector<uint64_t> expectedDawns;
+    for (int i = 0; i < 100; ++i) {
+      text += std::string(986, '.');
+      expectedAttacks.push_back(text.size());
+      expectedDawns.push_back(text.size() + 10);
+      text += i % 2 ? "attack at DAWN" : "attack at dawn";
+    }
+
+    DFC_PATTERN_INIT* attackInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(attackInit, "attack", 0);
+    DFC_STRUCTURE* attack = DFC_Compile(attackInit);
+
+    DFC_PATTERN_INIT* dawnInit = DFC_PATTERN_INIT_New();
+    addCaseInSensitivePattern(dawnInit, "dawn", 0);
+    DFC_STRUCTURE* dawn = DFC_Compile(dawnInit);
+
+    auto searchRepeatedly = [&](DFC_STRUCTURE* dfc,
+                                std::vector<uint64_t>* offsets) {
+      DFC_SCRATCH* scratch = DFC_AllocateScratch();
+      for (int i = 0; i < 20; ++i) {
+        offsets->clear();
+        DFC_SearchWithScratch(dfc, scratch, (const unsigned char*)text.data(),
+                              text.size(), onMatchOffsets, offsets);
+      }
+      DFC_FreeScratch(scratch);
+    };
+
+    std::vector<std::vector<uint64_t>> offsets(4);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back(searchRepeatedly, i % 2 ? dawn : attack,
+                           &offsets[i]);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(DFC_GetPatternOf(dawn, 0)->pattern_length == 4);
+
+    DFC_FreeStructureOf(attack);
+    DFC_FreeStructureOf(dawn);
+    DFC_FreePatternsInit(attackInit);
+    DFC_FreePatternsInit(dawnInit);
+
+    for (int i = 0; i < 4; ++i) {
+      REQUIRE(offsets[i] == (i % 2 ? expectedDawns : expectedAttacks));
+    }
+  }
+
+  SECTION("Publishes new structures while threads search") {
+    std::string text = std::string(5000, '.') + "attack at dawn";
+    std::vector<std::string> rulesets{"attack", "dawn"};
+
+    auto compile = [&](int version) {
+      DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+      addCaseSensitivePattern(patternInit, rulesets[version % 2], version);
+      DFC_STRUCTURE* dfc = DFC_Compile(patternInit);
+      DFC_FreePatternsInit(patternInit);
+      return dfc;
+    };
+
+    DFC_PUBLISHER* publisher = DFC_CreatePublisher(compile(0));
+
+    std::atomic<bool> publishing{true};
+    std::atomic<int> mismatches{0};
+    auto searchUntilDone = [&]() {
+      DFC_SCRATCH* scratch = DFC_AllocateScratch();
+      std::vector<uint64_t> offsets;
+      do {
+        DFC_STRUCTURE* dfc = DFC_AcquireStructure(publisher);
+
+        offsets.clear();
+        DFC_SearchWithScratch(dfc, scratch, (const unsigned char*)text.data(),
+                              text.size(), onMatchOffsets, &offsets);
+
+        // the structure may not change during the search
+        PID_TYPE version =
+            DFC_GetExternalIdsOf(dfc, DFC_GetPatternOf(dfc, 0))[0];
+        uint64_t expected = version % 2 ? 5010 : 5000;
+        if (offsets != std::vector<uint64_t>{expected}) {
+          ++mismatches;
+        }
+
+        DFC_ReleaseStructure(dfc);
+      } while (publishing);
+      DFC_FreeScratch(scratch);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back(searchUntilDone);
+    }
+    for (int version = 1; version < 50; ++version) {
+      DFC_Publish(publisher, compile(version));
+    }
+    publishing = false;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    DFC_FreePublisher(publisher);
+
+    REQUIRE(mismatches == 0);
+  }
+
+  SECTION("Adds and removes patterns of a compiled structure") {
+    std::string text = "an attack at dawn, ATTACK AT DAWN";
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "attack", 0);
+    DFC_STRUCTURE* dfc = DFC_Compile(patternInit);
+
+    DFC_SCRATCH* scratch = DFC_AllocateScratch();
+    auto search = [&]() {
+      std::vector<uint64_t> offsets;
+      DFC_SearchWithScratch(dfc, scratch, (const unsigned char*)text.data(),
+                            text.size(), onMatchOffsets, &offsets);
+      return std::multiset<uint64_t>(offsets.begin(), offsets.end());
+    };
+    REQUIRE(search() == std::multiset<uint64_t>{3});
+
+    DFC_AddPatternTo(dfc, (unsigned char*)"at", 2, 0, 1);
+    DFC_AddPatternTo(dfc, (unsigned char*)"dawn", 4, 1, 2);
+    DFC_AddPatternTo(dfc, (unsigned char*)"attack at dawn", 14, 1, 3);
+    REQUIRE(search() == std::multiset<uint64_t>{3, 3, 3, 10, 13, 19, 29});
+
+    DFC_RemovePatternFrom(dfc, (unsigned char*)"attack", 6, 0);
+    DFC_RemovePatternFrom(dfc, (unsigned char*)"at", 2, 9);
+    REQUIRE(search() == std::multiset<uint64_t>{3, 3, 10, 13, 19, 29});
+
+    DFC_AddPatternTo(dfc, (unsigned char*)"at", 2, 0, 4);
+    DFC_RemovePatternFrom(dfc, (unsigned char*)"at", 2, 1);
+    DFC_FIXED_PATTERN* at = DFC_GetPatternOf(dfc, 1);
+    REQUIRE(at->external_id_count == 1);
+    REQUIRE(DFC_GetExternalIdsOf(dfc, at)[0] == 4);
+
+    // takes more room than the tables were given, unless it is reused
+    for (int i = 0; i < 1000; ++i) {
+      std::string pattern = "pattern " + std::to_string(i);
+      DFC_AddPatternTo(dfc, (unsigned char*)pattern.data(), pattern.size(),
+                       i % 2, i);
+      DFC_RemovePatternFrom(dfc, (unsigned char*)pattern.data(),
+                            pattern.size(), i);
+    }
+    REQUIRE(search() == std::multiset<uint64_t>{3, 3, 10, 13, 19, 29});
+
+    DFC_FreeScratch(scratch);
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+  }
+
+  SECTION("Saves compiled structures and maps them back") {
+    const char* path = "dfc-structure-test.bin";
+    std::string text = "an attack at dawn";
+    auto search = [&](DFC_STRUCTURE* dfc) {
+      DFC_SCRATCH* scratch = DFC_AllocateScratch();
+      std::vector<uint64_t> offsets;
+      DFC_SearchWithScratch(dfc, scratch, (const unsigned char*)text.data(),
+                            text.size(), onMatchOffsets, &offsets);
+      DFC_FreeScratch(scratch);
+      return offsets;
+    };
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(patternInit, "attack", 0);
+    addCaseInSensitivePattern(patternInit, "DAWN", 1);
+    addCaseSensitivePattern(patternInit, "an attack at", 2);
+    DFC_STRUCTURE* compiled = DFC_Compile(patternInit);
+    REQUIRE(DFC_SaveStructure(compiled, path));
+    DFC_FreeStructureOf(compiled);
+
+    DFC_STRUCTURE* loaded = DFC_LoadStructure(path, patternInit);
+    REQUIRE(loaded != NULL);
+    REQUIRE(search(loaded) == std::vector<uint64_t>{0, 3, 13});
+    REQUIRE(DFC_GetExternalIdsOf(loaded, DFC_GetPatternOf(loaded, 1))[0] == 1);
+
+    // the file stays as it was
+    DFC_AddPatternTo(loaded, (unsigned char*)"at", 2, 0, 3);
+    REQUIRE(search(loaded).size() == 5);
+    DFC_FreeStructureOf(loaded);
+    loaded = DFC_LoadStructure(path, NULL);
+    REQUIRE(search(loaded).size() == 3);
+    DFC_FreeStructureOf(loaded);
+
+    DFC_PATTERN_INIT* otherInit = DFC_PATTERN_INIT_New();
+    addCaseSensitivePattern(otherInit, "attack", 0);
+    REQUIRE(DFC_LoadStructure(path, otherInit) == NULL);
+    REQUIRE(DFC_LoadStructure("missing-structure.bin", NULL) == NULL);
+
+    DFC_STRUCTURE* cached = DFC_CompileCached(otherInit, path);
+    REQUIRE(search(cached) == std::vector<uint64_t>{3});
+    DFC_FreeStructureOf(cached);
+    cached = DFC_LoadStructure(path, otherInit);
+    REQUIRE(cached != NULL);
+    REQUIRE(search(cached) == std::vector<uint64_t>{3});
+    DFC_FreeStructureOf(cached);
+
+    remove(path);
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreePatternsInit(otherInit);
+  }
+
+  SECTION("Adds many patterns at once") {
+    std::vector<std::string> bytes{"attack", "ATTACK", "attack", "at", "dawn"};
+    std::vector<DFC_PATTERN_DESCRIPTION> descriptions;
+    DFC_PATTERN_INIT* oneByOne = DFC_PATTERN_INIT_New();
+    for (size_t i = 0; i < bytes.size(); ++i) {
+      // the third pattern only repeats the first, with another id
+      DFC_PATTERN_DESCRIPTION description = {
+          (const unsigned char*)bytes[i].data(), (int)bytes[i].size(),
+          i == 4, (PID_TYPE)(i == 2 ? 7 : i)};
+      descriptions.push_back(description);
+      DFC_AddPattern(oneByOne, (unsigned char*)bytes[i].data(),
+                     bytes[i].size(), i == 4, description.sid);
+    }
+    // ids already added are ignored
+    descriptions.push_back(descriptions[0]);
+    DFC_AddPattern(oneByOne, (unsigned char*)bytes[0].data(), bytes[0].size(),
+                   0, 0);
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    DFC_AddPatterns(patternInit, descriptions.data(), descriptions.size());
+    REQUIRE(patternInit->numPatterns == 4);
+    REQUIRE(patternInit->contentHash == oneByOne->contentHash);
+
+    input = "attack at DAWN";
+    DFC_Compile(patternInit);
+    auto matchCount = DFC_Search(readInput, onMatch);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 4);
+    for (auto& match : matches) {
+      if (match.pattern == "attack") {
+        REQUIRE(match.ids == std::vector<PID_TYPE>{0, 7});
+      }
+    }
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreePatternsInit(oneByOne);
+  }
+
+  SECTION("Adds more distinct patterns than 16 bit ids could tell apart") {
+    const int patternCount = 70000;
+
+    std::vector<std::string> bytes;
+    std::vector<DFC_PATTERN_DESCRIPTION> descriptions;
+    for (int i = 0; i < patternCount; ++i) {
+      char pattern[32];
+      snprintf(pattern, sizeof(pattern), "GET /index%07d", i);
+      bytes.push_back(pattern);
+    }
+    for (int i = 0; i < patternCount; ++i) {
+      DFC_PATTERN_DESCRIPTION description = {
+          (const unsigned char*)bytes[i].data(), (int)bytes[i].size(), 0,
+          (PID_TYPE)i};
+      descriptions.push_back(description);
+    }
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    DFC_AddPatterns(patternInit, descriptions.data(), descriptions.size());
+    REQUIRE(patternInit->numPatterns == patternCount);
+
+    input = "GET /index0000001 GET /index0065537";
+    DFC_Compile(patternInit);
+    auto matchCount = DFC_Search(readInput, onMatch);
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 2);
+    for (auto& match : matches) {
+      REQUIRE(match.ids.size() == 1);
+      REQUIRE(match.pattern == bytes[match.ids[0]]);
+    }
+  }
+
+  SECTION("Adds the patterns of a file") {
+    const char* path = "dfc-patterns-test.txt";
+    FILE* file = fopen(path, "wb");
+    fputs("# comment\n\n", file);
+    fputs("1 attack|20|at\n", file);
+    fputs("2 nocase dawn\r\n", file);
+    fputs("3 |00 7c|\n", file);
+    fputs("1 attack at", file);
+    fclose(file);
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    REQUIRE(DFC_AddPatternFile(patternInit, path) == 4);
+    REQUIRE(DFC_AddPatternFile(patternInit, "missing-patterns.txt") == -1);
+    remove(path);
+    REQUIRE(patternInit->numPatterns == 3);
+
+    input = std::string("an attack at DAWN") + '\0' + "|";
+    DFC_Compile(patternInit);
+    auto matchCount = DFC_Search(readInput, onMatch);
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == 3);
+    std::set<std::string> found;
+    for (auto& match : matches) {
+      found.insert(match.pattern);
+    }
+    REQUIRE(found == std::set<std::string>{"attack at", "dawn",
+                                           std::string("\0|", 2)});
+  }
+
+  SECTION("Exits if an id of a pattern file does not fit PID_TYPE") {
+    const char* path = "dfc-overlong-id-test.txt";
+    FILE* file = fopen(path, "wb");
+    fputs("1 attack\n", file);
+    fputs("4294967296 dawn\n", file);
+    fclose(file);
+
+    pid_t child = fork();
+    if (!child) {
+      freopen("/dev/null", "w", stderr);
+
+      DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+      DFC_AddPatternFile(patternInit, path);
+      _exit(0);
+    }
+
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    remove(path);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == INVALID_PATTERN_FILE_EXIT_CODE);
+  }
+
+  SECTION("Compiles enough patterns to be compiled on several threads") {
+    const int patternCount = 12000;
+
+    DFC_PATTERN_INIT* patternInit = DFC_PATTERN_INIT_New();
+    std::set<std::string> expected;
+    for (int i = 0; i < patternCount; ++i) {
+      char large[8];
+      char longPattern[24];
+      snprintf(large, sizeof(large), "k%05d", i);
+      snprintf(longPattern, sizeof(longPattern), "longpattern%06d", i);
+
+      if (i % 3) {
+        addCaseSensitivePattern(patternInit, large, 2 * i);
+      } else {
+        addCaseInSensitivePattern(patternInit, large, 2 * i);
+      }
+      addCaseSensitivePattern(patternInit, longPattern, 2 * i + 1);
+
+      if (i % 97 == 0) {
+        input += std::string(large) + "#" + longPattern + "#";
+        expected.insert(large);
+        expected.insert(longPattern);
+      }
+    }
+    // the case insensitive patterns match in any case
+    input += "K00003#";
+
+    DFC_Compile(patternInit);
+
+    auto matchCount = DFC_Search(readInput, onMatch);
+
+    DFC_FreePatternsInit(patternInit);
+    DFC_FreeStructure();
+
+    REQUIRE(matchCount == (int)expected.size() + 1);
+    std::set<std::string> found;
+    for (auto& match : matches) {
+      found.insert(match.pattern);
+    }
+    expected.insert("k00003");
+    REQUIRE(found == expected);
+  }
+
   DFC_ReleaseEnvironment();
 }
 
@@ -711,3 +1639,119 @@ TEST_CASE("Timer") {
     REQUIRE(readTimerMs(timer) == 0.0);
   }
 }
+
+TEST_CASE("Ring") {
+  int values[5] = {0, 1, 2, 3, 4};
+  void* data;
+
+  SECTION("Returns false when full or empty") {
+    Ring* ring = createRing(4);
+
+    REQUIRE_FALSE(tryPopFromRing(ring, &data));
+    for (int i = 0; i < 4; ++i) {
+      REQUIRE(tryPushToRing(ring, &values[i]));
+    }
+    REQUIRE_FALSE(tryPushToRing(ring, &values[4]));
+
+    REQUIRE(tryPopFromRing(ring, &data));
+    REQUIRE(data == &values[0]);
+    REQUIRE(tryPushToRing(ring, &values[4]));
+    REQUIRE_FALSE(tryPushToRing(ring, &values[4]));
+
+    for (int i = 1; i < 5; ++i) {
+      REQUIRE(tryPopFromRing(ring, &data));
+    }
+    REQUIRE_FALSE(tryPopFromRing(ring, &data));
+
+    destroyRing(ring);
+  }
+
+  SECTION("Rounds the capacity up to a power of two") {
+    Ring* ring = createRing(3);
+
+    for (int i = 0; i < 4; ++i) {
+      REQUIRE(tryPushToRing(ring, &values[i]));
+    }
+    REQUIRE_FALSE(tryPushToRing(ring, &values[4]));
+
+    destroyRing(ring);
+  }
+
+  SECTION("Pops in the order pushed") {
+    Ring* ring = createRing(4);
+
+    // wraps around the cells several times
+    int pushed = 0;
+    int popped = 0;
+    for (int round = 0; round < 10; ++round) {
+      for (int i = 0; i < 3; ++i) {
+        REQUIRE(tryPushToRing(ring, &values[pushed++ % 5]));
+      }
+      for (int i = 0; i < 3; ++i) {
+        REQUIRE(tryPopFromRing(ring, &data));
+        REQUIRE(data == &values[popped++ % 5]);
+      }
+    }
+
+    destroyRing(ring);
+  }
+
+  SECTION("Passes each item once between several producers and consumers") {
+    const int threadCount = 4;
+    const uintptr_t itemsPerProducer = 50000;
+
+    Ring* ring = createRing(16);
+
+    // items are 1 + producer * itemsPerProducer + sequence, never null
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < threadCount; ++producer) {
+      producers.emplace_back([=] {
+        for (uintptr_t i = 0; i < itemsPerProducer; ++i) {
+          pushToRing(ring, (void*)(1 + producer * itemsPerProducer + i));
+        }
+      });
+    }
+
+    std::vector<std::vector<uintptr_t>> popped(threadCount);
+    std::vector<std::thread> consumers;
+    for (int consumer = 0; consumer < threadCount; ++consumer) {
+      consumers.emplace_back([&, consumer] {
+        for (;;) {
+          uintptr_t item = (uintptr_t)popFromRing(ring);
+          if (item == 0) {
+            break;
+          }
+          popped[consumer].push_back(item - 1);
+        }
+      });
+    }
+
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    // one stop signal per consumer
+    for (int i = 0; i < threadCount; ++i) {
+      pushToRing(ring, NULL);
+    }
+    for (auto& consumer : consumers) {
+      consumer.join();
+    }
+
+    destroyRing(ring);
+
+    bool inOrder = true;
+    std::vector<int> counts(threadCount * itemsPerProducer);
+    for (auto& items : popped) {
+      // the items of each producer leave the ring in the order they entered
+      std::vector<uintptr_t> next(threadCount, 0);
+      for (uintptr_t item : items) {
+        uintptr_t producer = item / itemsPerProducer;
+        inOrder = inOrder && item >= next[producer];
+        next[producer] = item + 1;
+        ++counts[item];
+      }
+    }
+    REQUIRE(inOrder);
+    REQUIRE(std::count(counts.begin(), counts.end(), 1) == (int)counts.size());
+  }
+}